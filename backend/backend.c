@@ -1,15 +1,34 @@
 #include "backend.h"
 #include "controllers/controllers.h"
 #include "utils/utils.h"
+#include "utils/arena.h"
+#include "utils/msgpack.h"
+#include "utils/ws_deflate.h"
+#include "cache/catalog.h"
+#include "cache/tree.h"
+#include "cache/content.h"
+#include "cache/writeback.h"
+#include "wobj/index.h"
+#include "watch/watch.h"
+#include "fs/commit.h"
+#include "jobs/jobs.h"
+#include "session/session.h"
+#include "metrics/metrics.h"
 
-static const controller_t controllers[] = {
+#include <ctype.h>
+
+const controller_t controllers[] = {
     {.path = "/", .method = NORA_GET, .fun = get_status},
+    {.path = "/stats", .method = NORA_GET, .fun = get_stats},
+    {.path = "/metrics", .method = NORA_GET, .fun = get_metrics},
     {.path = "/projects", .method = NORA_GET, .fun = get_projects},
     {.path = "/projects", .method = NORA_POST, .fun = create_project},
     {.path = "/projects/files", .method = NORA_GET, .fun = get_project_files},
     {.path = "/projects/files/delete", .method = NORA_POST, .fun = delete_project_file},
 
     {.path = "/files", .method = NORA_GET, .fun = get_file},
+    {.path = "/files/raw", .method = NORA_GET, .fun = get_file_raw},
+    {.path = "/files/batch", .method = NORA_POST, .fun = get_files_batch},
     {.path = "/files", .method = NORA_POST, .fun = create_file},
     {.path = "/files/update", .method = NORA_POST, .fun = update_file},
 
@@ -20,6 +39,99 @@ static const controller_t controllers[] = {
     {NULL, NULL, 0}
 };
 
+controller_stats_t controller_stats[sizeof(controllers) / sizeof(controllers[0])];
+_Static_assert(sizeof(controllers) / sizeof(controllers[0]) <= METRICS_MAX_CONTROLLERS + 1,
+               "raise METRICS_MAX_CONTROLLERS, the metrics only keep that many routes");
+
+static arena_t request_arena;
+
+#define LOOP_POLL_MS 50
+
+// mongoose runs timers right after its wait, a 0 ms one marks where the wait ended
+static uint64_t loop_woke_us;
+
+static void loop_woke(void *arg) {
+    (void) arg;
+    loop_woke_us = metrics_now_us();
+}
+
+static void call_controller(int i, struct mg_connection *c, struct mg_http_message *hm) {
+    arena_begin(&request_arena);
+    uint64_t start = metrics_now_us();
+    size_t queued = c->send.len;
+    controllers[i].fun(c, hm);
+    uint64_t elapsed = metrics_now_us() - start;
+    metrics_request(i, elapsed, c->send.len > queued ? c->send.len - queued : 0);
+    metrics_call(elapsed, hm->method, hm->uri, controllers[i].path);
+
+    controller_stats_t *st = &controller_stats[i];
+    st->requests++;
+    st->arena_allocations += request_arena.allocations;
+    st->arena_bytes += request_arena.bytes;
+    st->system_allocations += request_arena.system_allocations;
+    arena_end(&request_arena);
+}
+
+// Ids are echoed into JSON and logs, so they are kept to a safe alphabet
+static int valid_id(const char *id) {
+    for (const char *p = id; *p; p++) {
+        if (!isalnum((unsigned char) *p) && !strchr("-_.:", *p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void ws_message(struct mg_connection *c, struct mg_str data) {
+    DEBUG("Received message: %.*s\n", (int) data.len, data.buf);
+
+    char id[JOB_ID_LEN] = "";
+    int id_len = json_get_str(data, "$.id", id, sizeof(id));
+    if (id_len == -2 || (id_len > 0 && !valid_id(id))) {
+        ws_response(c, WS_ERROR, "Invalid 'id' field");
+        return;
+    }
+
+    char type[64];
+    if (json_get_str(data, "$.type", type, sizeof(type)) > 0) {
+        if (strcmp(type, "ping") == 0) {
+            return;
+        }
+        if (strcmp(type, "subscribe") == 0) {
+            subscribe(c, data, id);
+            return;
+        }
+        if (strcmp(type, "unsubscribe") == 0) {
+            unsubscribe(c, data, id);
+            return;
+        }
+        if (strcmp(type, "resume") == 0) {
+            session_resume(c, id, data);
+            return;
+        }
+        if (strcmp(type, "cancel") == 0) {
+            job_cancel(c, id);
+            return;
+        }
+        if (strcmp(type, "attach") == 0) {
+            job_attach(c, id, data);
+            return;
+        }
+        if (strcmp(type, "detach") == 0) {
+            job_detach(c, id);
+            return;
+        }
+        if (strcmp(type, "runs") == 0) {
+            jobs_list(c, id);
+            return;
+        }
+
+        run(c, data, type, id);
+        return;
+    }
+    DEBUG("Type not found");
+}
+
 static void ev_handler(struct mg_connection *c, int ev, void *ev_data) {
     if (ev == MG_EV_HTTP_MSG) {
         struct mg_http_message *hm = (struct mg_http_message *) ev_data;
@@ -30,15 +142,16 @@ static void ev_handler(struct mg_connection *c, int ev, void *ev_data) {
             mg_http_reply(c, 204,
                           "Access-Control-Allow-Origin: *\r\n"
                           "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
-                          "Access-Control-Allow-Headers: Content-Type, Authorization\r\n"
+                          "Access-Control-Allow-Headers: Content-Type, Authorization, If-None-Match, If-Modified-Since, Range\r\n"
                           "Access-Control-Max-Age: 86400\r\n"
                           "Content-Length: 0\r\n", "");
             return;
         }
 
         if (mg_match(hm->uri, mg_str("/ws"), NULL)) {
-            // Upgrade the connection to WebSocket
-            mg_ws_upgrade(c, hm, NULL);
+            // Upgrade the connection to WebSocket, in the protocol the client asked for
+            ws_upgrade(c, hm);
+            session_open(c);
             DEBUG("Client upgraded to WebSocket!\n");
             return;
         }
@@ -53,11 +166,11 @@ static void ev_handler(struct mg_connection *c, int ev, void *ev_data) {
                 DEBUG("Matched path: %s, method: %s\n", ct.path, ct.method == NORA_GET ? "GET" : "POST");
                 if (ct.method == NORA_GET && mg_match(hm->method, mg_str("GET"), NULL)) {
                     found = 1;
-                    ct.fun(c, hm);
+                    call_controller(i, c, hm);
                     break;
                 } else if (ct.method == NORA_POST && mg_match(hm->method, mg_str("POST"), NULL)) {
                     found = 1;
-                    ct.fun(c, hm);
+                    call_controller(i, c, hm);
                     break;
                 }
             }
@@ -71,25 +184,40 @@ static void ev_handler(struct mg_connection *c, int ev, void *ev_data) {
         DEBUG("Received WebSocket message");
         struct mg_ws_message *wm = (struct mg_ws_message *) ev_data;
 
-        DEBUG("Received message: %.*s\n", (int) wm->data.len, wm->data.buf);
-
-        cJSON *json = cJSON_Parse(wm->data.buf);
-        if (!json) {
-            DEBUG("Failed to parse JSON from WebSocket message: %.*s", (int) wm->data.len, wm->data.buf);
-        }
-
-        DEBUG_JSON(json);
-        char *type = cJSON_GetStringValue(cJSON_GetObjectItem(json, "type"));
-
-        if (type) {
-            if (strcmp(type, "ping") == 0) {
+        // permessage-deflate marks compressed messages with RSV1
+        struct mg_str data = wm->data;
+        struct mg_iobuf inflated = {.align = 4096};
+        if (wm->flags & WS_RSV1) {
+            if (ws_inflate(c, wm->data, &inflated) != 0) {
+                mg_iobuf_free(&inflated);
+                mg_error(c, "Invalid compressed WebSocket message");
                 return;
             }
+            data = mg_str_n((char *) inflated.buf, inflated.len);
+        }
+        metrics_ws_in(data.len);
+        uint64_t start = metrics_now_us();
 
-            run(c, json, type);
-            return;
+        // binary frames carry MessagePack, the handlers read JSON
+        if ((wm->flags & 0x0f) == WEBSOCKET_OP_BINARY) {
+            struct mg_iobuf json = {.align = 256};
+            if (mp_to_json(data, &json) == 0) {
+                ws_message(c, mg_str_n((char *) json.buf, json.len));
+            } else {
+                ws_response(c, WS_ERROR, "Invalid MessagePack message");
+            }
+            mg_iobuf_free(&json);
+        } else {
+            ws_message(c, data);
         }
-        DEBUG("Type not found");
+        mg_iobuf_free(&inflated);
+        metrics_call(metrics_now_us() - start, mg_str("WS"), mg_str("/ws"), "ws_message");
+    } else if (ev == MG_EV_WAKEUP) {
+        update_file_committed(c, (struct mg_str *) ev_data);
+    } else if (ev == MG_EV_CLOSE && c->is_websocket) {
+        events_close(c);
+        session_close(c);
+        ws_deflate_close(c);
     }
 }
 
@@ -97,8 +225,11 @@ void *start_backend(void *arg) {
     threads_args_t *args = (threads_args_t *) arg;
 
     mg_log_set(MG_LL_ERROR);
+    arena_init_hooks();
     struct mg_mgr mgr;
     mg_mgr_init(&mgr);
+    // the pipe's receiving end is the first connection; waking it only interrupts the poll
+    unsigned long pipe_id = mg_wakeup_init(&mgr) ? mgr.conns->id : 0;
 
     char listen_addr[256];
     snprintf(listen_addr, sizeof(listen_addr), "http://%s:%d", args->server_host, args->server_port);
@@ -112,11 +243,48 @@ void *start_backend(void *arg) {
     printf("Backend HTTP server started on %s\n", listen_addr);
     printf("Backend WS server started on ws:// or %s\n", ws_listen_addr);
 
+    watch_init();
+    catalog_init(args->workspace_root);
+    tree_init(args->workspace_root);
+    events_init();
+    jobs_init(&mgr, pipe_id);
+    status_init();
+    if (args->durable && commit_init(&mgr) != 0) {
+        WARNING("Failed to start the commit worker, saves are not synced to disk");
+    }
+    // acknowledging from memory would break the durable promise
+    writeback_init(args->durable ? 0 : args->writeback_ms);
+    metrics_set_stall_budget(args->stall_ms);
+    mg_timer_add(&mgr, 0, MG_TIMER_REPEAT, loop_woke, NULL);
+
+    // short poll so filesystem events are picked up promptly between requests
     while (keep_running) {
-        mg_mgr_poll(&mgr, 1000);
+        uint64_t start = metrics_now_us();
+        loop_woke_us = start;
+        mg_mgr_poll(&mgr, LOOP_POLL_MS);
+        watch_poll();
+        tree_tick();
+        writeback_tick();
+        jobs_tick();
+        session_tick();
+        status_tick(&mgr);
+        uint64_t end = metrics_now_us();
+        metrics_loop(end - start, end - loop_woke_us);
     }
 
+    session_free_all();
+    jobs_free();
+
+    writeback_flush();
+
+    commit_free();
     mg_mgr_free(&mgr);
+    status_free();
+    content_free();
+    wobj_index_free();
+    tree_free();
+    catalog_free();
+    watch_free();
 
     printf("bye! (from backend)\n");
 
@@ -29,6 +29,16 @@ typedef struct {
     methods_t method;
 } controller_t;
 
+typedef struct {
+    unsigned long requests;
+    unsigned long arena_allocations;
+    unsigned long arena_bytes;
+    unsigned long system_allocations;
+} controller_stats_t;
+
+extern const controller_t controllers[];
+extern controller_stats_t controller_stats[];
+
 extern volatile sig_atomic_t keep_running;
 
 void *start_backend(void *arg);
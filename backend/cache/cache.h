@@ -0,0 +1,14 @@
+#ifndef NORA_C_CACHE_H
+#define NORA_C_CACHE_H
+
+#include <stddef.h>
+
+// Counters of one of the caches, for the status endpoint
+typedef struct {
+    unsigned long hits;
+    unsigned long misses; // includes lookups that could not be cached
+    int entries;
+    size_t bytes;
+} cache_stats_t;
+
+#endif //NORA_C_CACHE_H
@@ -0,0 +1,339 @@
+#include "catalog.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+#include "../../webDriver/src/utils/utils.h"
+#include "../watch/watch.h"
+#include "../fs/fs.h"
+#include "../wobj/index.h"
+
+#define ROOT_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define PROJECT_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR)
+
+typedef struct {
+    char name[256];
+    char *json; // nora.json as found on disk, NULL when missing or invalid
+    size_t json_len;
+    int wd;
+    int dirty;
+} project_entry_t;
+
+static char root_path[1024];
+static project_entry_t **entries = NULL;
+static int entries_count = 0;
+static int entries_capacity = 0;
+
+static int root_wd = -1;
+static int rescan = 1; // the workspace listing changed
+static int stale = 1;  // the serialized body has to be rebuilt
+
+static char *body = NULL;
+static size_t body_len = 0;
+static unsigned long generation = 0;
+static time_t started = 0;
+static time_t modified = 0;
+static char etag[64];
+static unsigned long hits = 0, misses = 0;
+
+static void project_cb(const struct inotify_event *ev, void *ctx) {
+    project_entry_t *e = ctx;
+
+    if (ev->mask & IN_IGNORED) {
+        e->wd = -1;
+        rescan = 1;
+        return;
+    }
+    // only a reload that actually changes the text bumps the catalog ETag
+    if ((ev->mask & IN_Q_OVERFLOW) || (ev->len > 0 && strcmp(ev->name, "nora.json") == 0)) {
+        e->dirty = 1;
+    }
+}
+
+static void root_cb(const struct inotify_event *ev, void *ctx) {
+    (void) ctx;
+
+    if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        root_wd = -1;
+    }
+    // the cached directory fd and object index would keep pointing at the old project
+    if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_DELETE | IN_MOVED_FROM)) && ev->len > 0) {
+        fs_forget_project(ev->name);
+        wobj_index_forget(ev->name);
+    }
+    if ((ev->mask & IN_Q_OVERFLOW) || (ev->mask & IN_ISDIR) || root_wd < 0) {
+        rescan = 1;
+    }
+}
+
+static void entry_free(project_entry_t *e) {
+    if (e->wd >= 0) {
+        watch_remove(e->wd, project_cb, e);
+    }
+    free(e->json);
+    free(e);
+}
+
+// Returns 1 when the stored nora.json text changed
+static int entry_load(project_entry_t *e) {
+    // a missing or invalid file stays dirty, it may still be on its way (e.g. right after create_project)
+    e->dirty = 1;
+    char *buffer = NULL;
+    size_t read_bytes = 0;
+
+    FILE *f = fs_fopen(e->name, "nora.json", "r");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        long length = ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        buffer = length >= 0 ? malloc(length + 1) : NULL;
+        if (buffer) {
+            read_bytes = fread(buffer, 1, length, f);
+            while (read_bytes > 0 && isspace((unsigned char) buffer[read_bytes - 1])) {
+                read_bytes--;
+            }
+            buffer[read_bytes] = '\0';
+
+            // the text is pasted into the catalog as is, so it has to be one object and nothing else;
+            // mg_json_get stops after the first value
+            int value_len = 0;
+            int ofs = read_bytes > 0 ? mg_json_get(mg_str_n(buffer, read_bytes), "$", &value_len) : -1;
+            if (ofs < 0 || (size_t) ofs + (size_t) value_len != read_bytes || buffer[ofs] != '{') {
+                free(buffer);
+                buffer = NULL;
+                read_bytes = 0;
+            } else {
+                if (ofs > 0) {
+                    memmove(buffer, buffer + ofs, (size_t) value_len + 1);
+                    read_bytes = (size_t) value_len;
+                }
+                e->dirty = 0;
+            }
+        }
+        fclose(f);
+    }
+
+    int changed = (buffer == NULL) != (e->json == NULL) ||
+                  (buffer && (read_bytes != e->json_len || memcmp(buffer, e->json, read_bytes) != 0));
+    free(e->json);
+    e->json = buffer;
+    e->json_len = read_bytes;
+    return changed;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp((*(project_entry_t *const *) a)->name, (*(project_entry_t *const *) b)->name);
+}
+
+static void catalog_rescan(void) {
+    rescan = 0;
+
+    if (root_wd < 0) {
+        root_wd = watch_add(root_path, ROOT_MASK, root_cb, NULL);
+    }
+
+    DIR *dir = opendir(root_path);
+    if (!dir) {
+        for (int i = 0; i < entries_count; i++) {
+            entry_free(entries[i]);
+        }
+        stale |= entries_count > 0;
+        entries_count = 0;
+        return;
+    }
+
+    // mark and sweep: entries not seen in the listing are dropped
+    int known = entries_count;
+    char *seen = calloc(known > 0 ? known : 1, 1);
+    if (!seen) {
+        closedir(dir);
+        rescan = 1;
+        return;
+    }
+
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        if (d->d_type != DT_DIR || strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 ||
+            strlen(d->d_name) >= sizeof(((project_entry_t *) 0)->name)) {
+            continue;
+        }
+
+        int found = 0;
+        for (int i = 0; i < known; i++) {
+            if (strcmp(entries[i]->name, d->d_name) == 0) {
+                seen[i] = 1;
+                found = 1;
+                break;
+            }
+        }
+        if (found) {
+            continue;
+        }
+
+        if (entries_count == entries_capacity) {
+            int capacity = entries_capacity ? entries_capacity * 2 : 64;
+            project_entry_t **tmp = realloc(entries, capacity * sizeof(project_entry_t *));
+            if (!tmp) {
+                break;
+            }
+            entries = tmp;
+            entries_capacity = capacity;
+        }
+
+        project_entry_t *e = calloc(1, sizeof(project_entry_t));
+        if (!e) {
+            break;
+        }
+        snprintf(e->name, sizeof(e->name), "%s", d->d_name);
+        e->dirty = 1;
+
+        char project_path[2048];
+        snprintf(project_path, sizeof(project_path), "%s/%s", root_path, e->name);
+        e->wd = watch_add(project_path, PROJECT_MASK, project_cb, e);
+        entries[entries_count++] = e;
+        stale = 1;
+    }
+    closedir(dir);
+
+    // entries appended during this scan sit past `known` and are kept
+    int j = 0;
+    for (int i = 0; i < entries_count; i++) {
+        if (i < known && !seen[i]) {
+            entry_free(entries[i]);
+            stale = 1;
+            continue;
+        }
+        entries[j++] = entries[i];
+    }
+    entries_count = j;
+    free(seen);
+
+    qsort(entries, entries_count, sizeof(project_entry_t *), compare_entries);
+}
+
+static int catalog_serialize(void) {
+    size_t needed = 2;
+    for (int i = 0; i < entries_count; i++) {
+        if (entries[i]->json) {
+            needed += entries[i]->json_len + 1;
+        }
+    }
+
+    char *buffer = malloc(needed + 1);
+    if (!buffer) {
+        return -1;
+    }
+
+    size_t pos = 0;
+    buffer[pos++] = '[';
+    for (int i = 0; i < entries_count; i++) {
+        if (!entries[i]->json) {
+            continue;
+        }
+        if (pos > 1) {
+            buffer[pos++] = ',';
+        }
+        memcpy(buffer + pos, entries[i]->json, entries[i]->json_len);
+        pos += entries[i]->json_len;
+    }
+    buffer[pos++] = ']';
+    buffer[pos] = '\0';
+
+    free(body);
+    body = buffer;
+    body_len = pos;
+    generation++;
+    modified = time(NULL);
+    snprintf(etag, sizeof(etag), "\"catalog-%lx-%lx\"", (unsigned long) started, generation);
+    stale = 0;
+    return 0;
+}
+
+int catalog_init(const char *root) {
+    snprintf(root_path, sizeof(root_path), "%s", root);
+    started = time(NULL);
+    rescan = 1;
+    stale = 1;
+
+    root_wd = watch_add(root_path, ROOT_MASK, root_cb, NULL);
+    if (root_wd < 0) {
+        DEBUG("Project catalog without inotify, rescanning on every request");
+    }
+    return 0;
+}
+
+void catalog_free(void) {
+    for (int i = 0; i < entries_count; i++) {
+        entry_free(entries[i]);
+    }
+    free(entries);
+    entries = NULL;
+    entries_count = entries_capacity = 0;
+
+    if (root_wd >= 0) {
+        watch_remove(root_wd, root_cb, NULL);
+        root_wd = -1;
+    }
+
+    free(body);
+    body = NULL;
+    body_len = 0;
+}
+
+int catalog_get(const char **json, size_t *len, const char **tag, time_t *last_modified) {
+    if (root_wd < 0) {
+        rescan = 1;
+    }
+    int missed = rescan || stale || !body;
+    if (rescan) {
+        catalog_rescan();
+    }
+
+    for (int i = 0; i < entries_count; i++) {
+        if (entries[i]->dirty || entries[i]->wd < 0) {
+            missed = 1;
+            if (entry_load(entries[i])) {
+                stale = 1;
+            }
+        }
+    }
+    if (missed) {
+        misses++;
+    } else {
+        hits++;
+    }
+
+    if ((stale || !body) && catalog_serialize() != 0) {
+        return -1;
+    }
+
+    *json = body;
+    *len = body_len;
+    if (tag) {
+        *tag = etag;
+    }
+    if (last_modified) {
+        *last_modified = modified;
+    }
+    return 0;
+}
+
+cache_stats_t catalog_stats(void) {
+    return (cache_stats_t) {.hits = hits, .misses = misses, .entries = entries_count, .bytes = body ? body_len : 0};
+}
+
+void catalog_invalidate(const char *project) {
+    for (int i = 0; i < entries_count; i++) {
+        if (strcmp(entries[i]->name, project) == 0) {
+            entries[i]->dirty = 1;
+            return;
+        }
+    }
+    rescan = 1;
+}
@@ -0,0 +1,27 @@
+#ifndef NORA_C_CATALOG_H
+#define NORA_C_CATALOG_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "cache.h"
+
+/*
+ In-memory catalog of the projects in the workspace, i.e. every <project>/nora.json.
+ inotify marks single projects dirty; catalog_get() reloads only those and
+ re-serializes the JSON array once, so an unchanged catalog is served as is.
+ Without inotify every call rescans the workspace.
+ */
+
+int catalog_init(const char *root);
+void catalog_free(void);
+
+// Serialized project list with its validators, valid until the next catalog call
+int catalog_get(const char **json, size_t *len, const char **etag, time_t *last_modified);
+
+void catalog_invalidate(const char *project);
+
+// A hit is a catalog_get() that reloaded nothing; entries are the projects
+cache_stats_t catalog_stats(void);
+
+#endif //NORA_C_CATALOG_H
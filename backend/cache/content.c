@@ -0,0 +1,216 @@
+#include "content.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../webDriver/src/utils/utils.h"
+#include "../utils/utils.h"
+#include "../fs/fs.h"
+
+typedef struct {
+    char project[256];
+    char *path; // NULL for a free slot
+    content_t content;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtim;
+    unsigned long used;
+} content_entry_t;
+
+static content_entry_t entries[CONTENT_MAX_FILES];
+static size_t total_bytes = 0;
+static unsigned long tick = 0;
+static unsigned long hits = 0, misses = 0;
+// a file too big to keep, held only until the next call
+static content_entry_t loose;
+
+uint64_t content_hash(const char *data, size_t len) {
+    return fnv1a(FNV1A_INIT, data, len);
+}
+
+void content_hash_hex(uint64_t hash, char buf[CONTENT_HASH_LEN]) {
+    snprintf(buf, CONTENT_HASH_LEN, "%016llx", (unsigned long long) hash);
+}
+
+static void entry_clear(content_entry_t *e) {
+    if (e != &loose) {
+        total_bytes -= e->content.len;
+    }
+    free((char *) e->content.data);
+    free(e->path);
+    memset(e, 0, sizeof(*e));
+}
+
+static content_entry_t *entry_find(const char *project, const char *path) {
+    for (int i = 0; i < CONTENT_MAX_FILES; i++) {
+        if (entries[i].path && strcmp(entries[i].project, project) == 0 && strcmp(entries[i].path, path) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static int entry_matches(const content_entry_t *e, const struct stat *st) {
+    return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size &&
+           e->mtim.tv_sec == st->st_mtim.tv_sec && e->mtim.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// A slot for len more bytes, evicting the least recently used entries
+static content_entry_t *entry_slot(size_t len) {
+    if (len > CONTENT_MAX_BYTES / 4) {
+        if (loose.path) {
+            entry_clear(&loose);
+        }
+        return &loose;
+    }
+
+    for (;;) {
+        content_entry_t *free_slot = NULL, *oldest = NULL;
+        for (int i = 0; i < CONTENT_MAX_FILES; i++) {
+            content_entry_t *e = &entries[i];
+            if (!e->path) {
+                free_slot = free_slot ? free_slot : e;
+            } else if (!oldest || e->used < oldest->used) {
+                oldest = e;
+            }
+        }
+
+        if (free_slot && total_bytes + len <= CONTENT_MAX_BYTES) {
+            return free_slot;
+        }
+        if (!oldest) {
+            return NULL;
+        }
+        entry_clear(oldest);
+    }
+}
+
+static int entry_set(content_entry_t *e, const char *project, const char *path, char *data, size_t len,
+                     const struct stat *st) {
+    char *copy = strdup(path);
+    if (!copy) {
+        return -1;
+    }
+
+    snprintf(e->project, sizeof(e->project), "%s", project);
+    e->path = copy;
+    e->content = (content_t) {.data = data, .len = len, .hash = content_hash(data, len)};
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtim = st->st_mtim;
+    e->used = ++tick;
+    if (e != &loose) {
+        total_bytes += len;
+    }
+    return 0;
+}
+
+static char *read_all(int fd, size_t size, size_t *len) {
+    char *data = malloc(size + 1);
+    if (!data) {
+        return NULL;
+    }
+
+    size_t pos = 0;
+    while (pos < size) {
+        ssize_t n = read(fd, data + pos, size - pos);
+        if (n < 0) {
+            free(data);
+            return NULL;
+        }
+        if (n == 0) {
+            break; // truncated meanwhile, the next stat sees it
+        }
+        pos += (size_t) n;
+    }
+    data[pos] = '\0';
+    *len = pos;
+    return data;
+}
+
+const content_t *content_get(const char *project, const char *path) {
+    if (loose.path) {
+        entry_clear(&loose);
+    }
+
+    int fd = fs_open(project, path, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    content_entry_t *e = entry_find(project, path);
+    if (e && entry_matches(e, &st)) {
+        close(fd);
+        e->used = ++tick;
+        hits++;
+        return &e->content;
+    }
+    misses++;
+    if (e) {
+        entry_clear(e);
+    }
+
+    size_t len;
+    char *data = read_all(fd, (size_t) st.st_size, &len);
+    close(fd);
+    if (!data) {
+        return NULL;
+    }
+
+    e = entry_slot(len);
+    if (!e || entry_set(e, project, path, data, len, &st) != 0) {
+        free(data);
+        return NULL;
+    }
+    return &e->content;
+}
+
+void content_put(const char *project, const char *path, char *data, size_t len, const struct stat *st) {
+    content_entry_t *e = entry_find(project, path);
+    if (e) {
+        entry_clear(e);
+    }
+
+    e = entry_slot(len);
+    if (!e || entry_set(e, project, path, data, len, st) != 0) {
+        free(data);
+    }
+}
+
+void content_forget(const char *project, const char *path) {
+    content_entry_t *e = entry_find(project, path);
+    if (e) {
+        entry_clear(e);
+    }
+}
+
+cache_stats_t content_stats(void) {
+    cache_stats_t st = {.hits = hits, .misses = misses, .bytes = total_bytes};
+    for (int i = 0; i < CONTENT_MAX_FILES; i++) {
+        if (entries[i].path) {
+            st.entries++;
+        }
+    }
+    return st;
+}
+
+void content_free(void) {
+    for (int i = 0; i < CONTENT_MAX_FILES; i++) {
+        if (entries[i].path) {
+            entry_clear(&entries[i]);
+        }
+    }
+    if (loose.path) {
+        entry_clear(&loose);
+    }
+    total_bytes = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef NORA_C_CONTENT_H
+#define NORA_C_CONTENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+/*
+ Copies of recently edited files, so a patch (range edits against a base hash)
+ is applied without reading the whole file again. An entry is only used while
+ the file's inode, size and mtime still match what was cached, anything else
+ reloads it from disk. Only touched from the backend thread.
+ */
+
+#define CONTENT_MAX_FILES 32
+#define CONTENT_MAX_BYTES (16 * 1024 * 1024)
+#define CONTENT_HASH_LEN 17
+
+typedef struct {
+    const char *data;
+    size_t len;
+    uint64_t hash;
+} content_t;
+
+// Current content of a regular file, NULL if there is none; valid until the next content call
+const content_t *content_get(const char *project, const char *path);
+
+// Replaces the copy after a write, takes ownership of data (malloc'd); st is the written file
+void content_put(const char *project, const char *path, char *data, size_t len, const struct stat *st);
+void content_forget(const char *project, const char *path);
+void content_free(void);
+cache_stats_t content_stats(void);
+
+uint64_t content_hash(const char *data, size_t len);
+void content_hash_hex(uint64_t hash, char buf[CONTENT_HASH_LEN]);
+
+#endif //NORA_C_CONTENT_H
@@ -0,0 +1,1117 @@
+#include "tree.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+#include "../../webDriver/src/utils/utils.h"
+#include "../utils/arena.h"
+#include "../utils/utils.h"
+#include "../watch/watch.h"
+#include "../fs/fs.h"
+
+#define TREE_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_ONLYDIR)
+#define TREE_PENDING_MOVES 64
+
+const char *const tree_roots[TREE_ROOTS] = {"objects", "scenes", "scripts", "reports"};
+
+typedef struct tree_project tree_project_t;
+
+typedef enum {
+    TREE_ADDED,
+    TREE_REMOVED,
+    TREE_RENAMED,
+    TREE_MODIFIED,
+    TREE_RESET
+} tree_op_t;
+
+// Paths are relative to the project, e.g. "objects/login/button.wobj"
+typedef struct {
+    tree_op_t op;
+    char *path;
+    char *from; // TREE_RENAMED only
+    int is_folder;
+    time_t mtime;
+    off_t size;
+} tree_event_t;
+
+typedef struct tree_node {
+    char *name;
+    int is_folder;
+    int wd; // -1 when not watched
+    int scanned; // children have been read
+    time_t mtime;
+    off_t size;
+    struct tree_node *parent;
+    struct tree_node *children; // sorted by name
+    struct tree_node *next;
+    tree_project_t *project;
+} tree_node_t;
+
+struct tree_project {
+    char name[256];
+    tree_node_t roots[TREE_ROOTS];
+    int watches;
+    int built;    // nodes mirror the disk
+    int reset;    // drop the nodes on the next tick, e.g. after hitting the watch cap
+    int uncached; // too big to cache, retried after TREE_RETRY_SECONDS
+    time_t uncached_at;
+    int stale;    // json has to be rebuilt
+    unsigned long version; // bumped on every change, for the query ETags
+    struct mg_iobuf json;
+    unsigned long generation;
+    time_t modified;
+    char etag[64];
+    unsigned long last_used;
+    int subscribers;
+    tree_event_t *events; // collected since the last tick, only while subscribed
+    int events_count;
+    int events_capacity;
+};
+
+// Nodes detached by IN_MOVED_FROM, waiting for the IN_MOVED_TO with the same cookie
+typedef struct {
+    uint32_t cookie;
+    tree_node_t *node;
+    char *from;
+} pending_move_t;
+
+static char root_path[1024];
+static tree_project_t *projects[TREE_MAX_PROJECTS];
+static pending_move_t pending[TREE_PENDING_MOVES];
+static int pending_count = 0;
+static int overflowed = 0;
+static unsigned long use_clock = 0;
+static unsigned long hits = 0, misses = 0;
+static time_t started = 0;
+static tree_listener_t tree_listener = NULL;
+
+static void tree_cb(const struct inotify_event *ev, void *ctx);
+
+// mg_pfn_iobuf grows the buffer by its alignment only, which is quadratic for big trees
+static void pfn_grow(char ch, void *param) {
+    struct mg_iobuf *io = param;
+    if (io->len + 2 > io->size) {
+        mg_iobuf_resize(io, io->size < 4096 ? 4096 : io->size * 2);
+    }
+    mg_pfn_iobuf(ch, param);
+}
+
+static int path_fits(int n, size_t len) {
+    if (n < 0 || (size_t) n >= len) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+// inotify only takes paths, everything else goes through node_open()
+static int node_path(const tree_node_t *node, char *buf, size_t len) {
+    if (node->parent == NULL) {
+        return path_fits(snprintf(buf, len, "%s/%s/%s", root_path, node->project->name, node->name), len);
+    }
+
+    char parent[4096];
+    if (node_path(node->parent, parent, sizeof(parent)) != 0) {
+        return -1;
+    }
+    return path_fits(snprintf(buf, len, "%s/%s", parent, node->name), len);
+}
+
+// -1 when the path does not fit, such nodes get no events
+static int node_rel_path(const tree_node_t *node, char *buf, size_t len) {
+    if (node->parent == NULL) {
+        return path_fits(snprintf(buf, len, "%s", node->name), len);
+    }
+
+    char parent[4096];
+    if (node_rel_path(node->parent, parent, sizeof(parent)) != 0) {
+        return -1;
+    }
+    return path_fits(snprintf(buf, len, "%s/%s", parent, node->name), len);
+}
+
+// The folder opened relative to its project directory
+static int node_open(const tree_node_t *node) {
+    char path[4096];
+    if (node_rel_path(node, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    return fs_open(node->project->name, path, O_RDONLY | O_DIRECTORY, 0);
+}
+
+static void events_clear(tree_project_t *p) {
+    for (int i = 0; i < p->events_count; i++) {
+        free(p->events[i].path);
+        free(p->events[i].from);
+    }
+    p->events_count = 0;
+}
+
+static void event_push(tree_project_t *p, tree_op_t op, const char *path, const char *from, const tree_node_t *node) {
+    if (p->subscribers == 0) {
+        return;
+    }
+
+    // several writes to one file within a tick become one event
+    if (op == TREE_MODIFIED) {
+        for (int i = 0; i < p->events_count; i++) {
+            tree_event_t *e = &p->events[i];
+            if (e->op == TREE_MODIFIED && strcmp(e->path, path) == 0) {
+                e->mtime = node->mtime;
+                e->size = node->size;
+                return;
+            }
+        }
+    }
+
+    if (p->events_count == p->events_capacity) {
+        int capacity = p->events_capacity ? p->events_capacity * 2 : 32;
+        tree_event_t *tmp = realloc(p->events, capacity * sizeof(tree_event_t));
+        if (!tmp) {
+            return;
+        }
+        p->events = tmp;
+        p->events_capacity = capacity;
+    }
+
+    tree_event_t *e = &p->events[p->events_count];
+    *e = (tree_event_t) {.op = op};
+    e->path = path ? strdup(path) : NULL;
+    e->from = from ? strdup(from) : NULL;
+    if (node) {
+        e->is_folder = node->is_folder;
+        e->mtime = node->mtime;
+        e->size = node->size;
+    }
+    p->events_count++;
+}
+
+static void event_push_subtree(tree_project_t *p, const tree_node_t *node) {
+    if (p->subscribers == 0) {
+        return;
+    }
+
+    char path[4096];
+    if (node_rel_path(node, path, sizeof(path)) != 0) {
+        return;
+    }
+    event_push(p, TREE_ADDED, path, NULL, node);
+    for (const tree_node_t *child = node->children; child; child = child->next) {
+        event_push_subtree(p, child);
+    }
+}
+
+static tree_node_t *node_new(const char *name, int is_folder, tree_project_t *p) {
+    tree_node_t *node = calloc(1, sizeof(tree_node_t));
+    if (!node) {
+        return NULL;
+    }
+    node->name = strdup(name);
+    if (!node->name) {
+        free(node);
+        return NULL;
+    }
+    node->is_folder = is_folder;
+    node->wd = -1;
+    node->project = p;
+    return node;
+}
+
+static void node_unwatch(tree_node_t *node) {
+    if (node->wd >= 0) {
+        watch_remove(node->wd, tree_cb, node);
+        node->wd = -1;
+        node->project->watches--;
+    }
+}
+
+static void node_free_children(tree_node_t *node) {
+    tree_node_t *child = node->children;
+    while (child) {
+        tree_node_t *next = child->next;
+        node_free_children(child);
+        node_unwatch(child);
+        free(child->name);
+        free(child);
+        child = next;
+    }
+    node->children = NULL;
+}
+
+static void node_free(tree_node_t *node) {
+    node_free_children(node);
+    node_unwatch(node);
+    free(node->name);
+    free(node);
+}
+
+static tree_node_t *node_find_child(const tree_node_t *parent, const char *name) {
+    for (tree_node_t *child = parent->children; child; child = child->next) {
+        if (strcmp(child->name, name) == 0) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+static void node_attach(tree_node_t *parent, tree_node_t *child) {
+    tree_node_t **link = &parent->children;
+    while (*link && strcmp((*link)->name, child->name) < 0) {
+        link = &(*link)->next;
+    }
+    child->next = *link;
+    child->parent = parent;
+    *link = child;
+}
+
+static void node_detach(tree_node_t *child) {
+    tree_node_t **link = &child->parent->children;
+    while (*link && *link != child) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = child->next;
+    }
+    child->next = NULL;
+}
+
+static int node_watch(tree_node_t *node) {
+    tree_project_t *p = node->project;
+    if (p->watches >= TREE_MAX_WATCHES) {
+        return -1;
+    }
+
+    char path[4096];
+    if (node_path(node, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    node->wd = watch_add(path, TREE_MASK, tree_cb, node);
+    if (node->wd < 0) {
+        return -1;
+    }
+    p->watches++;
+    return 0;
+}
+
+static int compare_nodes(const void *a, const void *b) {
+    return strcmp((*(tree_node_t *const *) a)->name, (*(tree_node_t *const *) b)->name);
+}
+
+// Reads the entries of a folder. With `watch` every folder below it is watched
+// and read as well; -1 when the watch cap is hit
+static int node_scan(tree_node_t *node, int watch) {
+    int fd = node_open(node);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0; // gone already, its parent gets the IN_DELETE
+    }
+    node->scanned = 1;
+
+    // a fresh folder is sorted once instead of inserting every entry in order
+    int fresh = node->children == NULL;
+    tree_node_t **added = NULL;
+    size_t added_count = 0, added_capacity = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || fs_is_temp(entry->d_name) ||
+            (!fresh && node_find_child(node, entry->d_name) != NULL)) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+
+        tree_node_t *child = node_new(entry->d_name, S_ISDIR(st.st_mode), node->project);
+        if (!child) {
+            continue;
+        }
+        child->mtime = st.st_mtime;
+        child->size = st.st_size;
+
+        if (!fresh) {
+            node_attach(node, child);
+            continue;
+        }
+
+        if (added_count == added_capacity) {
+            size_t capacity = added_capacity ? added_capacity * 2 : 64;
+            tree_node_t **tmp = realloc(added, capacity * sizeof(tree_node_t *));
+            if (!tmp) {
+                node_free(child);
+                continue;
+            }
+            added = tmp;
+            added_capacity = capacity;
+        }
+        added[added_count++] = child;
+    }
+    closedir(dir);
+
+    if (added_count > 0) {
+        qsort(added, added_count, sizeof(tree_node_t *), compare_nodes);
+        for (size_t i = 0; i < added_count; i++) {
+            added[i]->parent = node;
+            added[i]->next = i + 1 < added_count ? added[i + 1] : NULL;
+        }
+        node->children = added[0];
+    }
+    free(added);
+
+    if (!watch) {
+        return 0;
+    }
+
+    // watch first, then read, so nothing created in between is missed
+    for (tree_node_t *child = node->children; child; child = child->next) {
+        if (child->is_folder && child->wd < 0 && (node_watch(child) != 0 || node_scan(child, 1) != 0)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void project_changed(tree_project_t *p) {
+    p->stale = 1;
+    p->version++;
+    p->modified = time(NULL);
+}
+
+static void project_clear(tree_project_t *p) {
+    for (int i = 0; i < TREE_ROOTS; i++) {
+        node_free_children(&p->roots[i]);
+        node_unwatch(&p->roots[i]);
+    }
+    p->built = 0;
+    p->reset = 0;
+}
+
+// 0 on success, -1 if a root folder is missing, 1 if the project is too big to cache
+// Every root has to be a folder before a tree is built for the project
+static int project_readable(const char *name) {
+    for (int i = 0; i < TREE_ROOTS; i++) {
+        struct stat st;
+        if (fs_stat(name, tree_roots[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int project_build(tree_project_t *p) {
+    if (!project_readable(p->name)) {
+        project_clear(p);
+        return -1;
+    }
+
+    for (int i = 0; i < TREE_ROOTS; i++) {
+        if (node_watch(&p->roots[i]) != 0 || node_scan(&p->roots[i], 1) != 0) {
+            DEBUG("Project %s needs more than %d watches, not caching its tree", p->name, TREE_MAX_WATCHES);
+            project_clear(p);
+            p->uncached = 1;
+            p->uncached_at = time(NULL);
+            return 1;
+        }
+    }
+
+    p->built = 1;
+    project_changed(p);
+    return 0;
+}
+
+static void project_free(tree_project_t *p) {
+    project_clear(p);
+    events_clear(p);
+    free(p->events);
+    mg_iobuf_free(&p->json);
+    free(p);
+}
+
+static void node_serialize(struct mg_iobuf *io, const tree_node_t *node) {
+    for (const tree_node_t *child = node->children; child; child = child->next) {
+        mg_xprintf(pfn_grow, io, "%s{\"name\":%m,\"topParent\":%m,\"isFolder\":%s",
+                   child == node->children ? "" : ",", MG_ESC(child->name), MG_ESC(node->name),
+                   child->is_folder ? "true" : "false");
+        if (child->is_folder) {
+            mg_xprintf(pfn_grow, io, ",\"children\":[");
+            node_serialize(io, child);
+            mg_xprintf(pfn_grow, io, "]");
+        }
+        mg_xprintf(pfn_grow, io, "}");
+    }
+}
+
+static void project_serialize(tree_project_t *p) {
+    mg_iobuf_free(&p->json);
+    mg_iobuf_init(&p->json, 0, 4096);
+
+    mg_xprintf(pfn_grow, &p->json, "{");
+    for (int i = 0; i < TREE_ROOTS; i++) {
+        mg_xprintf(pfn_grow, &p->json, "%s%m:[", i ? "," : "", MG_ESC(tree_roots[i]));
+        node_serialize(&p->json, &p->roots[i]);
+        mg_xprintf(pfn_grow, &p->json, "]");
+    }
+    mg_xprintf(pfn_grow, &p->json, "}");
+
+    p->generation++;
+    snprintf(p->etag, sizeof(p->etag), "\"tree-%lx-%lx\"", (unsigned long) started, p->generation);
+    p->stale = 0;
+}
+
+static void on_modified(tree_node_t *parent, const struct inotify_event *ev);
+
+// Whether a IN_MOVED_FROM of this project is waiting for its IN_MOVED_TO
+static int pending_find(uint32_t cookie, const tree_project_t *p) {
+    for (int i = 0; i < pending_count; i++) {
+        if (pending[i].cookie == cookie && pending[i].node->project == p) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void on_added(tree_node_t *parent, const struct inotify_event *ev) {
+    tree_project_t *p = parent->project;
+
+    tree_node_t *existing = node_find_child(parent, ev->name);
+    if (existing && !existing->is_folder && (ev->mask & IN_MOVED_TO) && !pending_find(ev->cookie, p)) {
+        on_modified(parent, ev); // an atomic save renamed its temp file over the old version
+        return;
+    }
+    if (existing) {
+        node_detach(existing);
+        node_free(existing);
+    }
+
+    // a rename inside the same project keeps the subtree and its watches
+    if (ev->mask & IN_MOVED_TO) {
+        for (int i = 0; i < pending_count; i++) {
+            tree_node_t *moved = pending[i].node;
+            if (pending[i].cookie != ev->cookie || moved->project != p) {
+                continue;
+            }
+
+            char *from = pending[i].from;
+            pending[i] = pending[--pending_count];
+
+            char *name = strdup(ev->name);
+            if (name) {
+                free(moved->name);
+                moved->name = name;
+                node_attach(parent, moved);
+                project_changed(p);
+
+                char path[4096];
+                if (node_rel_path(moved, path, sizeof(path)) == 0) {
+                    event_push(p, TREE_RENAMED, path, from, moved);
+                }
+                free(from);
+                return;
+            }
+            event_push(p, TREE_REMOVED, from, NULL, NULL);
+            free(from);
+            node_free(moved);
+            break;
+        }
+    }
+
+    struct stat st;
+    int dir_fd = node_open(parent);
+    int found = dir_fd >= 0 && fstatat(dir_fd, ev->name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    if (dir_fd >= 0) {
+        close(dir_fd);
+    }
+    if (!found) {
+        return; // already gone again, the IN_DELETE follows
+    }
+
+    tree_node_t *child = node_new(ev->name, S_ISDIR(st.st_mode), p);
+    if (!child) {
+        p->reset = 1;
+        return;
+    }
+    child->mtime = st.st_mtime;
+    child->size = st.st_size;
+    node_attach(parent, child);
+    project_changed(p);
+
+    if (child->is_folder && (node_watch(child) != 0 || node_scan(child, 1) != 0)) {
+        DEBUG("Project %s grew past %d watches, no longer caching its tree", p->name, TREE_MAX_WATCHES);
+        p->reset = 1;
+        p->uncached = 1;
+        p->uncached_at = time(NULL);
+        return;
+    }
+    event_push_subtree(p, child);
+}
+
+static void on_removed(tree_node_t *parent, const struct inotify_event *ev) {
+    tree_node_t *child = node_find_child(parent, ev->name);
+    if (!child) {
+        return;
+    }
+    char path[4096];
+    int named = node_rel_path(child, path, sizeof(path)) == 0;
+    node_detach(child);
+    project_changed(parent->project);
+
+    if (named && (ev->mask & IN_MOVED_FROM) && pending_count < TREE_PENDING_MOVES) {
+        pending[pending_count++] = (pending_move_t) {.cookie = ev->cookie, .node = child, .from = strdup(path)};
+    } else {
+        if (named) {
+            event_push(parent->project, TREE_REMOVED, path, NULL, NULL);
+        }
+        node_free(child);
+    }
+}
+
+static void on_modified(tree_node_t *parent, const struct inotify_event *ev) {
+    tree_node_t *child = node_find_child(parent, ev->name);
+    if (!child) {
+        return;
+    }
+
+    char rel_path[4096];
+    if (node_rel_path(child, rel_path, sizeof(rel_path)) != 0) {
+        return;
+    }
+    struct stat st;
+    if (fs_stat(child->project->name, rel_path, &st) == 0) {
+        child->mtime = st.st_mtime;
+        child->size = st.st_size;
+    }
+
+    event_push(child->project, TREE_MODIFIED, rel_path, NULL, child);
+}
+
+static void tree_cb(const struct inotify_event *ev, void *ctx) {
+    tree_node_t *node = ctx;
+    tree_project_t *p = node->project;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        overflowed = 1;
+        return;
+    }
+    if (ev->mask & IN_IGNORED) {
+        // the watch module already forgot this subscriber
+        node->wd = -1;
+        p->watches--;
+        if (node->parent == NULL) {
+            p->reset = 1; // a root folder is gone
+        }
+        return;
+    }
+    if ((ev->mask & IN_MOVE_SELF) && node->parent == NULL) {
+        p->reset = 1;
+        return;
+    }
+    if (!p->built || p->reset || ev->len == 0 || fs_is_temp(ev->name)) {
+        return;
+    }
+
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+        on_added(node, ev);
+    } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        on_removed(node, ev);
+    } else if (ev->mask & IN_CLOSE_WRITE) {
+        on_modified(node, ev);
+    }
+}
+
+static tree_project_t *project_new(const char *name) {
+    tree_project_t *p = calloc(1, sizeof(tree_project_t));
+    if (!p) {
+        return NULL;
+    }
+    snprintf(p->name, sizeof(p->name), "%s", name);
+
+    // the roots are linked like siblings so the project itself can be listed as a folder
+    for (int i = 0; i < TREE_ROOTS; i++) {
+        p->roots[i].name = (char *) tree_roots[i];
+        p->roots[i].is_folder = 1;
+        p->roots[i].wd = -1;
+        p->roots[i].project = p;
+        p->roots[i].next = i + 1 < TREE_ROOTS ? &p->roots[i + 1] : NULL;
+    }
+    return p;
+}
+
+static tree_project_t *project_get(const char *name) {
+    tree_project_t **slot = NULL;
+    for (int i = 0; i < TREE_MAX_PROJECTS; i++) {
+        if (projects[i] && strcmp(projects[i]->name, name) == 0) {
+            return projects[i];
+        }
+        if (!projects[i]) {
+            if (!slot) slot = &projects[i];
+        }
+    }
+
+    if (!slot) {
+        for (int i = 0; i < TREE_MAX_PROJECTS; i++) {
+            if (projects[i]->subscribers == 0 && (!slot || projects[i]->last_used < (*slot)->last_used)) {
+                slot = &projects[i];
+            }
+        }
+        if (!slot) {
+            return NULL; // every cached project is subscribed to
+        }
+        project_free(*slot);
+        *slot = NULL;
+    }
+
+    tree_project_t *p = project_new(name);
+    *slot = p;
+    return p;
+}
+
+static void project_drop(tree_project_t *p) {
+    for (int i = 0; i < TREE_MAX_PROJECTS; i++) {
+        if (projects[i] == p) {
+            projects[i] = NULL;
+        }
+    }
+    project_free(p);
+}
+
+int tree_init(const char *root) {
+    snprintf(root_path, sizeof(root_path), "%s", root);
+    started = time(NULL);
+    return 0;
+}
+
+void tree_free(void) {
+    tree_listener = NULL;
+    tree_tick();
+    for (int i = 0; i < TREE_MAX_PROJECTS; i++) {
+        if (projects[i]) {
+            project_free(projects[i]);
+            projects[i] = NULL;
+        }
+    }
+}
+
+static tree_project_t *project_lookup(const char *name) {
+    for (int i = 0; i < TREE_MAX_PROJECTS; i++) {
+        if (projects[i] && strcmp(projects[i]->name, name) == 0) {
+            return projects[i];
+        }
+    }
+    return NULL;
+}
+
+// Looks up or builds the tree of a project, see tree_get for the return values
+static int project_ready(const char *project, tree_project_t **out) {
+    if (project[0] == '\0' || strchr(project, '/') != NULL || strcmp(project, ".") == 0 ||
+        strcmp(project, "..") == 0 || strlen(project) >= sizeof(((tree_project_t *) 0)->name)) {
+        return -1;
+    }
+
+    // a missing project must not evict a cached one
+    if (!project_lookup(project) && !project_readable(project)) {
+        misses++;
+        return -1;
+    }
+
+    tree_project_t *p = project_get(project);
+    if (!p) {
+        misses++;
+        return 1;
+    }
+    p->last_used = ++use_clock;
+    *out = p;
+
+    if (p->built && !p->reset && !p->uncached) {
+        hits++;
+        return 0;
+    }
+    misses++;
+
+    if (p->uncached) {
+        if (time(NULL) - p->uncached_at < TREE_RETRY_SECONDS) {
+            return 1;
+        }
+        p->uncached = 0;
+    }
+
+    if (p->reset) {
+        project_clear(p);
+    }
+    if (!p->built) {
+        int rc = project_build(p);
+        if (rc < 0 && p->subscribers == 0) {
+            project_drop(p);
+            *out = NULL;
+        }
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int tree_get(const char *project, const char **json, size_t *len, const char **etag, time_t *last_modified) {
+    tree_project_t *p = NULL;
+    int rc = project_ready(project, &p);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (p->stale) {
+        project_serialize(p);
+    }
+
+    *json = (const char *) p->json.buf;
+    *len = p->json.len;
+    if (etag) {
+        *etag = p->etag;
+    }
+    if (last_modified) {
+        *last_modified = p->modified;
+    }
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    int index;
+} intern_slot_t;
+
+typedef struct {
+    const tree_query_t *q;
+    int temporary;         // nodes come from a one-off disk read, folders are read on demand
+    struct mg_iobuf items; // nested objects, or the flat triples
+    struct mg_iobuf names;
+    intern_slot_t *slots;
+    size_t slots_capacity;
+    int names_count;
+    int nodes_count;
+    const char *next_cursor;
+} query_state_t;
+
+static int intern(query_state_t *qs, const char *name) {
+    if ((size_t) qs->names_count * 2 >= qs->slots_capacity) {
+        size_t capacity = qs->slots_capacity ? qs->slots_capacity * 2 : 256;
+        intern_slot_t *slots = arena_alloc(capacity * sizeof(intern_slot_t));
+        if (!slots) {
+            return -1;
+        }
+        memset(slots, 0, capacity * sizeof(intern_slot_t));
+        for (size_t i = 0; i < qs->slots_capacity; i++) {
+            if (qs->slots[i].name) {
+                size_t j = fnv1a(FNV1A_INIT, qs->slots[i].name, strlen(qs->slots[i].name)) & (capacity - 1);
+                while (slots[j].name) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = qs->slots[i];
+            }
+        }
+        arena_free(qs->slots);
+        qs->slots = slots;
+        qs->slots_capacity = capacity;
+    }
+
+    size_t i = fnv1a(FNV1A_INIT, name, strlen(name)) & (qs->slots_capacity - 1);
+    while (qs->slots[i].name) {
+        if (strcmp(qs->slots[i].name, name) == 0) {
+            return qs->slots[i].index;
+        }
+        i = (i + 1) & (qs->slots_capacity - 1);
+    }
+
+    qs->slots[i] = (intern_slot_t) {.name = name, .index = qs->names_count};
+    mg_xprintf(pfn_grow, &qs->names, "%s%m", qs->names_count ? "," : "", MG_ESC(name));
+    return qs->names_count++;
+}
+
+static void query_write(query_state_t *qs, tree_node_t *first, const char *parent_name, int parent_index, int level) {
+    const tree_query_t *q = qs->q;
+    int top = level == 1;
+    int depth = q->depth > 0 && q->depth < TREE_MAX_DEPTH ? q->depth : TREE_MAX_DEPTH;
+    int emitted = 0;
+
+    for (tree_node_t *n = first; n; n = n->next) {
+        if (top && q->cursor && q->cursor[0] && strcmp(n->name, q->cursor) <= 0) {
+            continue;
+        }
+        if (top && q->limit > 0 && emitted == q->limit) {
+            break;
+        }
+
+        int expand = n->is_folder && level < depth;
+        if (expand && qs->temporary && !n->scanned) {
+            node_scan(n, 0);
+        }
+
+        if (q->flat) {
+            int index = qs->nodes_count++;
+            int flags = (n->is_folder ? 1 : 0) | (n->is_folder && !expand ? 2 : 0);
+            mg_xprintf(pfn_grow, &qs->items, "%s%d,%d,%d", index ? "," : "", intern(qs, n->name),
+                       parent_index, flags);
+            if (expand) {
+                query_write(qs, n->children, n->name, index, level + 1);
+            }
+        } else {
+            mg_xprintf(pfn_grow, &qs->items, "%s{\"name\":%m,\"topParent\":%m,\"isFolder\":%s",
+                       emitted ? "," : "", MG_ESC(n->name), MG_ESC(parent_name), n->is_folder ? "true" : "false");
+            if (expand) {
+                mg_xprintf(pfn_grow, &qs->items, ",\"children\":[");
+                query_write(qs, n->children, n->name, -1, level + 1);
+                mg_xprintf(pfn_grow, &qs->items, "]");
+            } else if (n->is_folder) {
+                mg_xprintf(pfn_grow, &qs->items, ",\"lazy\":true");
+            }
+            mg_xprintf(pfn_grow, &qs->items, "}");
+        }
+
+        emitted++;
+        if (top && q->limit > 0 && emitted == q->limit && n->next) {
+            qs->next_cursor = n->name;
+        }
+    }
+}
+
+// Walks path one component at a time, so ".." or "." can never leave the project.
+// *folder is NULL for the project itself; -1 if path is not a folder
+static int query_resolve(tree_project_t *p, const char *path, int temporary, tree_node_t **folder) {
+    tree_node_t *first = &p->roots[0];
+    tree_node_t *node = NULL;
+
+    char buf[2048];
+    snprintf(buf, sizeof(buf), "%s", path);
+    char *save = NULL;
+    for (char *part = strtok_r(buf, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        tree_node_t *next = NULL;
+        for (tree_node_t *n = first; n; n = n->next) {
+            if (strcmp(n->name, part) == 0) {
+                next = n;
+                break;
+            }
+        }
+
+        // a one-off tree only reads the folders on the way, not their siblings
+        if (!next && temporary && node && strcmp(part, ".") != 0 && strcmp(part, "..") != 0) {
+            struct stat st;
+            int dir_fd = node_open(node);
+            if (dir_fd >= 0 && fstatat(dir_fd, part, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) {
+                next = node_new(part, 1, p);
+                if (next) {
+                    node_attach(node, next);
+                }
+            }
+            if (dir_fd >= 0) {
+                close(dir_fd);
+            }
+        }
+
+        if (!next || !next->is_folder) {
+            return -1;
+        }
+        if (temporary && !next->scanned) {
+            node_scan(next, 0);
+        }
+        node = next;
+        first = node->children;
+    }
+
+    *folder = node;
+    return 0;
+}
+
+int tree_query(const char *project, tree_query_t *q, struct mg_iobuf *out) {
+    q->etag[0] = '\0';
+    q->last_modified = 0;
+
+    tree_project_t *p = NULL;
+    int rc = project_ready(project, &p);
+    if (rc < 0) {
+        return -1;
+    }
+
+    int temporary = rc > 0;
+    if (temporary) {
+        p = project_new(project);
+        if (!p) {
+            return -1;
+        }
+
+        struct stat st;
+        if (fs_stat(project, NULL, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            project_free(p);
+            return -1;
+        }
+    }
+
+    const char *path = q->path ? q->path : "";
+    tree_node_t *folder = NULL;
+    if (query_resolve(p, path, temporary, &folder) != 0) {
+        if (temporary) {
+            project_free(p);
+        }
+        return -2;
+    }
+
+    // the project itself lists its root folders
+    tree_node_t *first = folder ? folder->children : &p->roots[0];
+    const char *parent_name = folder ? folder->name : "";
+
+    query_state_t qs = {.q = q, .temporary = temporary};
+    mg_iobuf_init(&qs.items, 0, 4096);
+    mg_iobuf_init(&qs.names, 0, 1024);
+    query_write(&qs, first, parent_name, -1, 1);
+
+    mg_xprintf(pfn_grow, out, "{\"path\":%m,", MG_ESC(path));
+    if (q->flat) {
+        mg_xprintf(pfn_grow, out, "\"names\":[");
+        mg_iobuf_add(out, out->len, qs.names.buf, qs.names.len);
+        mg_xprintf(pfn_grow, out, "],\"nodes\":[");
+    } else {
+        mg_xprintf(pfn_grow, out, "\"items\":[");
+    }
+    mg_iobuf_add(out, out->len, qs.items.buf, qs.items.len);
+    mg_xprintf(pfn_grow, out, "],");
+    if (qs.next_cursor) {
+        mg_xprintf(pfn_grow, out, "\"nextCursor\":%m}", MG_ESC(qs.next_cursor));
+    } else {
+        mg_xprintf(pfn_grow, out, "\"nextCursor\":null}");
+    }
+
+    mg_iobuf_free(&qs.items);
+    mg_iobuf_free(&qs.names);
+    arena_free(qs.slots);
+
+    if (temporary) {
+        project_free(p);
+        return 0;
+    }
+
+    uint64_t hash = fnv1a(FNV1A_INIT, path, strlen(path));
+    hash = fnv1a(hash, &q->depth, sizeof(q->depth));
+    hash = fnv1a(hash, &q->limit, sizeof(q->limit));
+    hash = fnv1a(hash, &q->flat, sizeof(q->flat));
+    if (q->cursor) {
+        hash = fnv1a(hash, q->cursor, strlen(q->cursor));
+    }
+    snprintf(q->etag, sizeof(q->etag), "\"tree-%lx-%lx-%016llx\"", (unsigned long) started, p->version,
+             (unsigned long long) hash);
+    q->last_modified = p->modified;
+    return 0;
+}
+
+cache_stats_t tree_stats(void) {
+    cache_stats_t st = {.hits = hits, .misses = misses};
+    for (int i = 0; i < TREE_MAX_PROJECTS; i++) {
+        if (projects[i] && projects[i]->built) {
+            st.entries++;
+            st.bytes += projects[i]->json.len;
+        }
+    }
+    return st;
+}
+
+void tree_set_listener(tree_listener_t listener) {
+    tree_listener = listener;
+}
+
+int tree_subscribe(const char *project) {
+    tree_project_t *p = NULL;
+    int rc = project_ready(project, &p);
+    if (rc == 0) {
+        p->subscribers++;
+    }
+    return rc;
+}
+
+void tree_unsubscribe(const char *project) {
+    tree_project_t *p = project_lookup(project);
+    if (p && p->subscribers > 0 && --p->subscribers == 0) {
+        events_clear(p);
+    }
+}
+
+static const char *op_name(tree_op_t op) {
+    return op == TREE_ADDED ? "added" :
+           op == TREE_REMOVED ? "removed" :
+           op == TREE_RENAMED ? "renamed" :
+           op == TREE_MODIFIED ? "modified" : "reset";
+}
+
+static void project_flush(tree_project_t *p) {
+    struct mg_iobuf io;
+    mg_iobuf_init(&io, 0, 1024);
+
+    mg_xprintf(pfn_grow, &io, "{\"type\":\"fs\",\"projectName\":%m,\"events\":[", MG_ESC(p->name));
+    for (int i = 0; i < p->events_count; i++) {
+        tree_event_t *e = &p->events[i];
+        mg_xprintf(pfn_grow, &io, "%s{\"op\":\"%s\"", i ? "," : "", op_name(e->op));
+        if (e->path) {
+            mg_xprintf(pfn_grow, &io, ",\"path\":%m", MG_ESC(e->path));
+        }
+        if (e->op == TREE_RENAMED) {
+            mg_xprintf(pfn_grow, &io, ",\"from\":%m", MG_ESC(e->from));
+        }
+        if (e->op == TREE_ADDED || e->op == TREE_RENAMED) {
+            mg_xprintf(pfn_grow, &io, ",\"isFolder\":%s", e->is_folder ? "true" : "false");
+        }
+        if (e->op == TREE_ADDED || e->op == TREE_MODIFIED) {
+            mg_xprintf(pfn_grow, &io, ",\"mtime\":%lld,\"size\":%lld", (long long) e->mtime, (long long) e->size);
+        }
+        mg_xprintf(pfn_grow, &io, "}");
+    }
+    mg_xprintf(pfn_grow, &io, "]}");
+
+    if (tree_listener && io.len > 0) {
+        tree_listener(p->name, (const char *) io.buf, io.len);
+    }
+    mg_iobuf_free(&io);
+    events_clear(p);
+}
+
+void tree_tick(void) {
+    // moves out of the cached trees, nothing to pair them with anymore
+    for (int i = 0; i < pending_count; i++) {
+        tree_node_t *node = pending[i].node;
+        event_push(node->project, TREE_REMOVED, pending[i].from, NULL, NULL);
+        free(pending[i].from);
+        node_free(node);
+    }
+    pending_count = 0;
+
+    for (int i = 0; i < TREE_MAX_PROJECTS; i++) {
+        tree_project_t *p = projects[i];
+        if (!p) {
+            continue;
+        }
+
+        if (overflowed || p->reset) {
+            project_clear(p);
+            project_changed(p);
+
+            // events were lost, subscribers have to refetch; rebuild so the next ones are caught
+            if (p->subscribers > 0) {
+                events_clear(p);
+                event_push(p, TREE_RESET, NULL, NULL, NULL);
+                if (!p->uncached) {
+                    project_build(p);
+                }
+            }
+        }
+
+        if (p->events_count > 0) {
+            project_flush(p);
+        }
+    }
+    overflowed = 0;
+}
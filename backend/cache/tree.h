@@ -0,0 +1,62 @@
+#ifndef NORA_C_TREE_H
+#define NORA_C_TREE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+#include "cache.h"
+
+/*
+ In-memory file tree of the recently used projects (objects, scenes, scripts
+ and reports). Built with readdir on first use, then kept current from inotify
+ events so serving it costs no syscalls. Projects needing more than
+ TREE_MAX_WATCHES watches are not cached and tree_get() returns 1 for them.
+ While a project has subscribers its changes are also collected as events and
+ handed to the listener once per tick, as a single JSON message.
+ */
+
+#define TREE_ROOTS 4
+#define TREE_MAX_PROJECTS 8
+#define TREE_MAX_WATCHES 1024
+#define TREE_RETRY_SECONDS 60
+#define TREE_MAX_DEPTH 64
+
+extern const char *const tree_roots[TREE_ROOTS];
+
+int tree_init(const char *root);
+void tree_free(void);
+
+// 0 on success, -1 if the project can not be read, 1 if it is not cached
+int tree_get(const char *project, const char **json, size_t *len, const char **etag, time_t *last_modified);
+
+typedef struct {
+    const char *path;   // folder inside the project, "" for the project itself
+    int depth;          // levels to include, 0 for TREE_MAX_DEPTH
+    const char *cursor; // continue the listing of path after this name
+    int limit;          // entries of path per page, 0 for all of them
+    int flat;           // interned names plus [name, parent, flags] triples instead of nested objects
+    // set by tree_query
+    char etag[96];      // empty if the project is not cached
+    time_t last_modified;
+} tree_query_t;
+
+// Lists part of a project tree into out; projects that are not cached are read from disk.
+// 0 on success, -1 if the project can not be read, -2 if path is not a folder
+int tree_query(const char *project, tree_query_t *q, struct mg_iobuf *out);
+
+typedef void (*tree_listener_t)(const char *project, const char *json, size_t len);
+
+void tree_set_listener(tree_listener_t listener);
+
+// Same return values as tree_get; a subscribed project is never evicted
+int tree_subscribe(const char *project);
+void tree_unsubscribe(const char *project);
+
+// Called once per loop iteration, after watch_poll()
+void tree_tick(void);
+
+// A hit is a lookup answered from an already built tree; bytes are the serialized trees
+cache_stats_t tree_stats(void);
+
+#endif //NORA_C_TREE_H
@@ -0,0 +1,193 @@
+#include "writeback.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+#include "../../webDriver/src/utils/utils.h"
+#include "../fs/fs.h"
+
+typedef struct {
+    char project[256];
+    char *path; // NULL for a free slot
+    content_t content;
+    time_t modified;
+    uint64_t first_ms; // first save since the last write
+    uint64_t last_ms;
+    uint64_t retry_ms; // not written before this, after a failed write
+} writeback_entry_t;
+
+static writeback_entry_t entries[WRITEBACK_MAX_FILES];
+static int pending = 0;
+static size_t total_bytes = 0;
+static int delay = 0;
+
+void writeback_init(int delay_ms) {
+    delay = delay_ms > 0 ? delay_ms : 0;
+    if (delay > 0) {
+        DEBUG("Saves are written behind, after %d ms without changes", delay);
+    }
+}
+
+int writeback_enabled(void) {
+    return delay > 0;
+}
+
+int writeback_pending(void) {
+    return pending;
+}
+
+// fs tolerates leading, doubled and trailing slashes, so one file has several spellings
+static const char *key_path(const char *path, char key[PATH_MAX]) {
+    size_t n = 0;
+    for (const char *p = path; *p && n < PATH_MAX - 1; p++) {
+        if (*p != '/' || (n > 0 && key[n - 1] != '/')) {
+            key[n++] = *p;
+        }
+    }
+    while (n > 0 && key[n - 1] == '/') {
+        n--;
+    }
+    key[n] = '\0';
+    return key;
+}
+
+static writeback_entry_t *entry_find(const char *project, const char *path) {
+    char key[PATH_MAX];
+    path = key_path(path, key);
+    for (int i = 0; i < WRITEBACK_MAX_FILES; i++) {
+        if (entries[i].path && strcmp(entries[i].project, project) == 0 && strcmp(entries[i].path, path) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void entry_clear(writeback_entry_t *e) {
+    pending--;
+    total_bytes -= e->content.len;
+    free((char *) e->content.data);
+    free(e->path);
+    memset(e, 0, sizeof(*e));
+}
+
+// The written text becomes the content cache's copy, so the next patch needs no read.
+// A failed write keeps the save, it was acknowledged; it is retried after WRITEBACK_RETRY_MS.
+static int entry_write(writeback_entry_t *e) {
+    struct stat st;
+    if (fs_write_atomic(e->project, e->path, e->content.data, e->content.len, &st) != 0) {
+        WARNING("Failed to write %s/%s, retrying in %d ms", e->project, e->path, WRITEBACK_RETRY_MS);
+        e->retry_ms = mg_millis() + WRITEBACK_RETRY_MS;
+        return -1;
+    }
+
+    content_put(e->project, e->path, (char *) e->content.data, e->content.len, &st);
+    total_bytes -= e->content.len;
+    e->content.data = NULL;
+    e->content.len = 0;
+    entry_clear(e);
+    return 0;
+}
+
+int writeback_put(const char *project, const char *path, char *data, size_t len) {
+    if (delay <= 0) {
+        return -1;
+    }
+    char key[PATH_MAX];
+    path = key_path(path, key);
+
+    writeback_entry_t *e = entry_find(project, path);
+    if (!e) {
+        // only saves that can not fail later are acknowledged early
+        struct stat st;
+        if (fs_stat(project, path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            return -1;
+        }
+        for (int i = 0; i < WRITEBACK_MAX_FILES && !e; i++) {
+            e = entries[i].path ? NULL : &entries[i];
+        }
+        if (!e) {
+            return -1;
+        }
+    }
+
+    size_t previous = e->path ? e->content.len : 0;
+    if (total_bytes - previous + len > WRITEBACK_MAX_BYTES) {
+        return -1;
+    }
+
+    uint64_t now = mg_millis();
+    if (!e->path) {
+        e->path = strdup(path);
+        if (!e->path) {
+            return -1;
+        }
+        snprintf(e->project, sizeof(e->project), "%s", project);
+        e->first_ms = now;
+        pending++;
+    }
+
+    free((char *) e->content.data);
+    total_bytes = total_bytes - previous + len;
+    e->content = (content_t) {.data = data, .len = len, .hash = content_hash(data, len)};
+    e->modified = time(NULL);
+    e->last_ms = now;
+    return 0;
+}
+
+const content_t *writeback_get(const char *project, const char *path, time_t *modified) {
+    writeback_entry_t *e = entry_find(project, path);
+    if (!e) {
+        return NULL;
+    }
+    if (modified) {
+        *modified = e->modified;
+    }
+    return &e->content;
+}
+
+void writeback_sync(const char *project, const char *path) {
+    writeback_entry_t *e = entry_find(project, path);
+    if (e) {
+        entry_write(e);
+    }
+}
+
+void writeback_forget(const char *project, const char *path) {
+    char key[PATH_MAX];
+    path = key_path(path, key);
+    size_t n = strlen(path);
+    for (int i = 0; i < WRITEBACK_MAX_FILES; i++) {
+        writeback_entry_t *e = &entries[i];
+        if (e->path && strcmp(e->project, project) == 0 && strncmp(e->path, path, n) == 0 &&
+            (n == 0 || e->path[n] == '\0' || e->path[n] == '/')) {
+            entry_clear(e);
+        }
+    }
+}
+
+void writeback_tick(void) {
+    if (pending == 0) {
+        return;
+    }
+
+    uint64_t now = mg_millis();
+    for (int i = 0; i < WRITEBACK_MAX_FILES; i++) {
+        writeback_entry_t *e = &entries[i];
+        if (e->path && now >= e->retry_ms && (now - e->last_ms >= (uint64_t) delay || now - e->first_ms >= WRITEBACK_MAX_DELAY_MS)) {
+            entry_write(e);
+        }
+    }
+}
+
+void writeback_flush(void) {
+    for (int i = 0; i < WRITEBACK_MAX_FILES; i++) {
+        if (entries[i].path && entry_write(&entries[i]) != 0) {
+            WARNING("Giving up on %s/%s at shutdown, its last save is lost", entries[i].project, entries[i].path);
+            entry_clear(&entries[i]);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef NORA_C_WRITEBACK_H
+#define NORA_C_WRITEBACK_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "content.h"
+
+/*
+ Write-behind buffer for saves (--writeback, off in durable mode). A save of an
+ existing file is acknowledged from memory; more saves of the same file replace
+ the pending text, and the last one is written once the file has been quiet for
+ the delay, or at the latest WRITEBACK_MAX_DELAY_MS after its first pending save.
+ Readers ask writeback_get() first so they never see the older text on disk.
+ A save that fails to be written stays pending and is retried.
+ Only touched from the backend thread.
+ */
+
+#define WRITEBACK_MAX_FILES 64
+#define WRITEBACK_MAX_BYTES (32 * 1024 * 1024)
+#define WRITEBACK_MAX_DELAY_MS 2000
+#define WRITEBACK_RETRY_MS 5000
+
+void writeback_init(int delay_ms);
+int writeback_enabled(void);
+// Files whose save is still only in memory
+int writeback_pending(void);
+
+// Takes ownership of data (malloc'd) on success; -1 when the caller has to write it itself
+int writeback_put(const char *project, const char *path, char *data, size_t len);
+
+// The pending text of a file, NULL if there is none; valid until the next writeback call
+const content_t *writeback_get(const char *project, const char *path, time_t *modified);
+
+// Writes the pending text of path now, for readers that go to the disk themselves
+void writeback_sync(const char *project, const char *path);
+
+// Drops pending saves of path and of everything below it, e.g. before deleting it
+void writeback_forget(const char *project, const char *path);
+
+// Called once per loop iteration, writes the files whose delay is over
+void writeback_tick(void);
+
+// Writes everything still pending, at shutdown
+void writeback_flush(void);
+
+#endif //NORA_C_WRITEBACK_H
@@ -5,5 +5,6 @@
 #include "status/status.h"
 #include "files/files.h"
 #include "run/run.h"
+#include "events/events.h"
 
 #endif //NORA_C_CONTROLLERS_H
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include "events.h"
+
+#include <string.h>
+
+#include "../../../webDriver/src/utils/utils.h"
+#include "../../utils/utils.h"
+#include "../../utils/msgpack.h"
+#include "../../session/session.h"
+#include "../../cache/tree.h"
+
+typedef struct {
+    struct mg_connection *c;
+    char project[256];
+} subscription_t;
+
+static subscription_t subscriptions[EVENTS_MAX_SUBSCRIPTIONS];
+static int subscriptions_count = 0;
+
+static void on_tree_events(const char *project, const char *json, size_t len) {
+    // transcoded once for all binary subscribers of the project
+    struct mg_iobuf packed = {.align = 4096};
+    int packed_state = 0; // 0 not tried, 1 done, -1 failed
+
+    for (int i = 0; i < subscriptions_count; i++) {
+        if (strcmp(subscriptions[i].project, project) != 0) {
+            continue;
+        }
+        struct mg_connection *c = subscriptions[i].c;
+        if (ws_is_binary(c) && packed_state == 0) {
+            packed_state = mp_from_json(mg_str_n(json, len), &packed) == 0 ? 1 : -1;
+        }
+        if (ws_is_binary(c) && packed_state == 1) {
+            session_send(c, packed.buf, packed.len, WEBSOCKET_OP_BINARY);
+        } else {
+            session_send(c, json, len, WEBSOCKET_OP_TEXT);
+        }
+    }
+    mg_iobuf_free(&packed);
+}
+
+static int find(struct mg_connection *c, const char *project) {
+    for (int i = 0; i < subscriptions_count; i++) {
+        if (subscriptions[i].c == c && strcmp(subscriptions[i].project, project) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void remove_at(int i) {
+    tree_unsubscribe(subscriptions[i].project);
+    subscriptions[i] = subscriptions[--subscriptions_count];
+}
+
+void events_init(void) {
+    tree_set_listener(on_tree_events);
+}
+
+int subscribe(struct mg_connection *c, struct mg_str content, const char *id) {
+    char project[256];
+    if (json_get_str(content, "$.projectName", project, sizeof(project)) <= 0) {
+        ws_response_id(c, id, WS_ERROR, "Missing or invalid 'projectName' field");
+        return -1;
+    }
+
+    if (find(c, project) < 0) {
+        if (subscriptions_count == EVENTS_MAX_SUBSCRIPTIONS) {
+            ws_response_id(c, id, WS_ERROR, "Too many subscriptions");
+            return -1;
+        }
+
+        int rc = tree_subscribe(project);
+        if (rc < 0) {
+            ws_response_id(c, id, WS_ERROR, "Project not found");
+            return -1;
+        }
+        if (rc > 0) {
+            ws_response_id(c, id, WS_WARNING, "Project too large for live file updates");
+            return -1;
+        }
+
+        subscription_t *s = &subscriptions[subscriptions_count++];
+        s->c = c;
+        snprintf(s->project, sizeof(s->project), "%s", project);
+        DEBUG("Connection %lu subscribed to %s", c->id, project);
+    }
+
+    char *ack = id && *id
+                ? mg_mprintf("{%m:%m,%m:%m,%m:%m}", MG_ESC("id"), MG_ESC(id), MG_ESC("type"), MG_ESC("subscribed"),
+                             MG_ESC("projectName"), MG_ESC(project))
+                : mg_mprintf("{%m:%m,%m:%m}", MG_ESC("type"), MG_ESC("subscribed"), MG_ESC("projectName"),
+                             MG_ESC(project));
+    if (ack) {
+        ws_send_json(c, ack, strlen(ack));
+        mg_free(ack);
+    }
+    return 0;
+}
+
+int unsubscribe(struct mg_connection *c, struct mg_str content, const char *id) {
+    char project[256];
+    if (json_get_str(content, "$.projectName", project, sizeof(project)) <= 0) {
+        ws_response_id(c, id, WS_ERROR, "Missing or invalid 'projectName' field");
+        return -1;
+    }
+
+    int i = find(c, project);
+    if (i >= 0) {
+        remove_at(i);
+    }
+    return 0;
+}
+
+void events_close(struct mg_connection *c) {
+    for (int i = subscriptions_count - 1; i >= 0; i--) {
+        if (subscriptions[i].c == c) {
+            remove_at(i);
+        }
+    }
+}
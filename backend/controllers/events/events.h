@@ -0,0 +1,20 @@
+#ifndef NORA_C_EVENTS_H
+#define NORA_C_EVENTS_H
+
+#include "../../../lib/Mongoose/mongoose.h"
+
+#define EVENTS_MAX_SUBSCRIPTIONS 64
+
+/*
+ File-system change events over /ws. A {"type":"subscribe","projectName":...}
+ message registers the connection; from then on every poll tick with changes
+ in that project sends one {"type":"fs","projectName":...,"events":[...]},
+ as MessagePack on binary connections.
+ */
+
+void events_init(void);
+int subscribe(struct mg_connection *c, struct mg_str content, const char *id);
+int unsubscribe(struct mg_connection *c, struct mg_str content, const char *id);
+void events_close(struct mg_connection *c);
+
+#endif //NORA_C_EVENTS_H
@@ -2,70 +2,63 @@
 
 #include <cjson/cJSON.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../../../webDriver/src/utils/utils.h"
 #include "../../utils/utils.h"
+#include "../../utils/json_writer.h"
+#include "../../utils/arena.h"
+#include "../../fs/fs.h"
+#include "../../cache/content.h"
+#include "../../cache/writeback.h"
+#include "../../fs/commit.h"
+#include "../../wobj/wobj.h"
 
-void create_entity(struct mg_connection *c, struct mg_http_message *hm, int type) {
-    char *body = malloc(hm->body.len + 1);
-    if (!body) {
-        error_response(c, 500, "Memory allocation failed");
-        return;
-    }
-    memcpy(body, hm->body.buf, hm->body.len);
-    body[hm->body.len] = '\0';
+#define RAW_MIME_TYPES "wobj=application/json,wscene=text/plain; charset=utf-8,c=text/x-c; charset=utf-8," \
+                       "h=text/x-c; charset=utf-8,log=text/plain; charset=utf-8"
 
-    cJSON *json = cJSON_Parse(body);
-    free(body);
-
-    if (!json) {
+void create_entity(struct mg_connection *c, struct mg_http_message *hm, int type) {
+    if (mg_json_get(hm->body, "$", NULL) < 0) {
         error_response(c, 400, "Invalid JSON");
         return;
     }
 
-    const cJSON *projectName = cJSON_GetObjectItemCaseSensitive(json, "projectName");
-    const cJSON *path = cJSON_GetObjectItemCaseSensitive(json, "path");
-
-    if (!cJSON_IsString(projectName) || (projectName->valuestring == NULL) ||
-        !cJSON_IsString(path) || (path->valuestring == NULL)) {
-        cJSON_Delete(json);
+    char project_name[256];
+    char path[2048];
+    if (json_get_str(hm->body, "$.projectName", project_name, sizeof(project_name)) < 0 ||
+        json_get_str(hm->body, "$.path", path, sizeof(path)) < 0) {
         error_response(c, 400, "Missing or invalid 'projectName' or 'path' field");
         return;
     }
 
-    char *home = getenv("HOME");
-    if (!home) {
-        cJSON_Delete(json);
-        error_response(c, 500, "HOME environment variable not set");
+    if (!fs_valid_name(project_name) || !fs_valid_path(path)) {
+        error_response(c, 400, "Invalid 'projectName' or 'path' field");
         return;
     }
 
-    char full_path[2048];
-    snprintf(full_path, sizeof(full_path), "%s/Documents/Nora/%s/%s", home, projectName->valuestring,
-             path->valuestring);
-
     if (type == 0) {
         // Create file
-        FILE *f = fopen(full_path, "w");
-        if (f) {
-            fclose(f);
+        int fd = fs_open(project_name, path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            close(fd);
             mg_http_reply(c, 200, DEFAULT_TEXT_HEADER, "File created successfully");
         } else {
             error_response(c, 500, "Failed to create file");
         }
     } else {
         // Create folder
-        if (mkdir_p(full_path) == 0) {
+        if (fs_mkdir(project_name, path) == 0) {
             mg_http_reply(c, 200, DEFAULT_TEXT_HEADER, "Folder created successfully");
         } else {
             error_response(c, 500, "Failed to create folder");
         }
     }
-
-    cJSON_Delete(json);
 }
 
 void create_file(struct mg_connection *c, struct mg_http_message *hm) {
@@ -76,6 +69,48 @@ void create_folder(struct mg_connection *c, struct mg_http_message *hm) {
     create_entity(c, hm, 1);
 }
 
+// A regular file of the project opened for reading, -1 if there is none
+static int open_regular(const char *project, const char *path, struct stat *st) {
+    int fd = fs_open(project, path, O_RDONLY, 0);
+    if (fd >= 0 && (fstat(fd, st) != 0 || !S_ISREG(st->st_mode))) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Streams the file as the "content" string, then its "hash" (the base for patches), and closes it
+static void write_content(json_writer_t *w, FILE *f) {
+    jw_string_begin(w, "content");
+
+    uint64_t hash = FNV1A_INIT;
+    char buf[16384];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        jw_string_append(w, buf, n);
+        hash = fnv1a(hash, buf, n);
+    }
+    fclose(f);
+
+    jw_string_end(w);
+
+    char hex[CONTENT_HASH_LEN];
+    content_hash_hex(hash, hex);
+    jw_string(w, "hash", hex);
+}
+
+// A save still held by the write-behind buffer, served as the file
+static void write_pending(json_writer_t *w, const content_t *pending) {
+    char hex[CONTENT_HASH_LEN];
+    content_hash_hex(pending->hash, hex);
+    jw_string_n(w, "content", pending->data, pending->len);
+    jw_string(w, "hash", hex);
+}
+
+static void pending_etag(const content_t *pending, char *buf, size_t len) {
+    snprintf(buf, len, "\"wb-%016llx\"", (unsigned long long) pending->hash);
+}
+
 void get_file(struct mg_connection *c, struct mg_http_message *hm) {
     char project_name[256];
     if (mg_http_get_var(&hm->query, "projectName", project_name, sizeof(project_name)) <= 0) {
@@ -89,104 +124,452 @@ void get_file(struct mg_connection *c, struct mg_http_message *hm) {
         return;
     }
 
-    char *home = getenv("HOME");
-    if (!home) {
-        error_response(c, 500, "HOME environment variable not set");
+    if (!fs_valid_name(project_name) || !fs_valid_path(file_path)) {
+        error_response(c, 400, "Invalid 'projectName' or 'path' query parameter");
+        return;
+    }
+
+    time_t pending_modified;
+    const content_t *pending = writeback_get(project_name, file_path, &pending_modified);
+    if (pending) {
+        char etag[64];
+        pending_etag(pending, etag, sizeof(etag));
+        if (http_not_modified(hm, etag, pending_modified)) {
+            not_modified_response(c, etag, pending_modified);
+            return;
+        }
+
+        char headers[512];
+        validator_headers(headers, sizeof(headers), DEFAULT_JSON_HEADER, etag, pending_modified);
+        json_writer_t w;
+        jw_begin(&w, c, 200, headers, 1);
+        jw_object_open(&w, NULL);
+        write_pending(&w, pending);
+        jw_object_close(&w);
+        jw_end(&w);
+        return;
+    }
+
+    // one open for both the validators and the content
+    struct stat st;
+    int fd = open_regular(project_name, file_path, &st);
+    if (fd < 0) {
+        error_response(c, 404, "File not found");
+        return;
+    }
+
+    char etag[64];
+    stat_etag(&st, etag, sizeof(etag));
+    if (http_not_modified(hm, etag, st.st_mtime)) {
+        close(fd);
+        not_modified_response(c, etag, st.st_mtime);
+        return;
+    }
+
+    FILE *f = fdopen(fd, "r");
+    if (!f) {
+        close(fd);
+        error_response(c, 500, "Failed to read file");
+        return;
+    }
+
+    char headers[512];
+    validator_headers(headers, sizeof(headers), DEFAULT_JSON_HEADER, etag, st.st_mtime);
+
+    json_writer_t w;
+    jw_begin(&w, c, 200, headers, 1);
+    jw_object_open(&w, NULL);
+    write_content(&w, f);
+    jw_object_close(&w);
+    jw_end(&w);
+}
+
+static void batch_error(json_writer_t *w, int status, const char *message) {
+    jw_int(w, "status", status);
+    jw_string(w, "error", message);
+}
+
+// One response for many files: {"projectName", "files": [{"path", "etag", "content"} | {"path", "status", "error"}]}
+void get_files_batch(struct mg_connection *c, struct mg_http_message *hm) {
+    if (mg_json_get(hm->body, "$", NULL) < 0) {
+        error_response(c, 400, "Invalid JSON");
+        return;
+    }
+
+    char project_name[256];
+    if (json_get_str(hm->body, "$.projectName", project_name, sizeof(project_name)) < 0 ||
+        !fs_valid_name(project_name)) {
+        error_response(c, 400, "Missing or invalid 'projectName' field");
         return;
     }
 
-    char full_path[4096];
-    snprintf(full_path, sizeof(full_path), "%s/Documents/Nora/%s/%s", home, project_name, file_path);
+    int paths_len = 0;
+    int paths_ofs = mg_json_get(hm->body, "$.paths", &paths_len);
+    if (paths_ofs < 0 || hm->body.buf[paths_ofs] != '[') {
+        error_response(c, 400, "Missing or invalid 'paths' field");
+        return;
+    }
+    struct mg_str paths = mg_str_n(hm->body.buf + paths_ofs, (size_t) paths_len);
 
-    FILE *f = fopen(full_path, "r");
-    if (f) {
-        fseek(f, 0, SEEK_END);
-        long fsize = ftell(f);
-        fseek(f, 0, SEEK_SET);
+    int count = 0;
+    struct mg_str value;
+    for (size_t ofs = 0; (ofs = mg_json_next(paths, ofs, NULL, &value)) > 0;) {
+        count++;
+    }
+    if (count > FILES_BATCH_MAX) {
+        char message[64];
+        snprintf(message, sizeof(message), "Too many paths, at most %d per request", FILES_BATCH_MAX);
+        error_response(c, 400, message);
+        return;
+    }
 
-        char *content = malloc(fsize + 1);
-        if (content) {
-            fread(content, 1, fsize, f);
-            content[fsize] = '\0';
-            cJSON *response_json = cJSON_CreateObject();
-            cJSON_AddStringToObject(response_json, "content", content);
-            char *response = cJSON_Print(response_json);
-            cJSON_Delete(response_json);
-            mg_http_reply(c, 200, DEFAULT_JSON_HEADER, "%s", response);
-            free(response);
-            free(content);
+    struct stat project_st;
+    if (fs_stat(project_name, NULL, &project_st) != 0 || !S_ISDIR(project_st.st_mode)) {
+        error_response(c, 404, "Project not found");
+        return;
+    }
+
+    json_writer_t w;
+    jw_begin(&w, c, 200, DEFAULT_JSON_HEADER, 1);
+    jw_object_open(&w, NULL);
+    jw_string(&w, "projectName", project_name);
+    jw_array_open(&w, "files");
+
+    for (size_t ofs = 0; (ofs = mg_json_next(paths, ofs, NULL, &value)) > 0;) {
+        char path[2048];
+        int valid = json_get_str(value, "$", path, sizeof(path)) >= 0;
+
+        jw_object_open(&w, NULL);
+        if (valid) {
+            jw_string(&w, "path", path);
         } else {
-            error_response(c, 500, "Memory allocation failed");
+            jw_null(&w, "path");
         }
-        fclose(f);
-    } else {
-        error_response(c, 404, "File not found");
+
+        struct stat st;
+        int fd = -1;
+        FILE *f = NULL;
+        const content_t *pending = NULL;
+        if (!valid || !fs_valid_path(path)) {
+            batch_error(&w, 400, "Invalid path");
+        } else if ((pending = writeback_get(project_name, path, NULL)) != NULL) {
+            char etag[64];
+            pending_etag(pending, etag, sizeof(etag));
+            jw_string(&w, "etag", etag);
+            write_pending(&w, pending);
+        } else if ((fd = open_regular(project_name, path, &st)) < 0) {
+            batch_error(&w, 404, "File not found");
+        } else if ((f = fdopen(fd, "r")) == NULL) {
+            close(fd);
+            batch_error(&w, 500, "Failed to read file");
+        } else {
+            char etag[64];
+            stat_etag(&st, etag, sizeof(etag));
+            jw_string(&w, "etag", etag);
+            write_content(&w, f);
+        }
+        jw_object_close(&w);
     }
+
+    jw_array_close(&w);
+    jw_object_close(&w);
+    jw_end(&w);
 }
 
-int update_text_file(FILE *file, const cJSON *content) {
-    fwrite(content->valuestring, 1, strlen(content->valuestring), file);
-    DEBUG("Updated text file with content: %s", content->valuestring);
-    return 1;
+/*
+ mongoose serves files through an mg_fs that takes paths. This one takes
+ "<project>/<path>" and opens it with fs_open, so raw files are confined to
+ their project like every other handler's.
+ */
+static int raw_open_fd(const char *path) {
+    const char *slash = strchr(path, '/');
+    char project[256];
+    if (!slash || (size_t) (slash - path) >= sizeof(project)) {
+        return -1;
+    }
+    memcpy(project, path, (size_t) (slash - path));
+    project[slash - path] = '\0';
+    return fs_valid_name(project) ? fs_open(project, slash + 1, O_RDONLY, 0) : -1;
 }
 
-int update_wobj_file(FILE *file, const cJSON *content) {
-    // just to verify
-    cJSON *data = cJSON_Parse(content->valuestring);
-    if (!data) {
+static int raw_stat(const char *path, size_t *size, time_t *mtime) {
+    struct stat st;
+    int fd = raw_open_fd(path);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    close(fd);
+    if (!ok) {
         return 0;
     }
+    if (size) {
+        *size = (size_t) st.st_size;
+    }
+    if (mtime) {
+        *mtime = st.st_mtime;
+    }
+    return MG_FS_READ;
+}
 
-    fwrite(content->valuestring, 1, strlen(content->valuestring), file);
+static void *raw_open(const char *path, int flags) {
+    if (flags & MG_FS_WRITE) {
+        return NULL;
+    }
+    int fd = raw_open_fd(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "rb") : NULL;
+    if (fd >= 0 && !f) {
+        close(fd);
+    }
+    return f;
+}
 
-    cJSON_Delete(data);
-    DEBUG("Updated .wobj file with content: %s", content->valuestring);
-    return 1;
+static void raw_close(void *fd) {
+    fclose((FILE *) fd);
 }
 
-void update_file(struct mg_connection *c, struct mg_http_message *hm) {
-    char *body = malloc(hm->body.len + 1);
-    if (!body) {
-        error_response(c, 500, "Memory allocation failed");
+static size_t raw_read(void *fd, void *buf, size_t len) {
+    return fread(buf, 1, len, (FILE *) fd);
+}
+
+static size_t raw_seek(void *fd, size_t offset) {
+    if (fseeko((FILE *) fd, (off_t) offset, SEEK_SET) != 0) {
+        return 0;
+    }
+    return offset;
+}
+
+static struct mg_fs raw_fs = {.st = raw_stat, .op = raw_open, .cl = raw_close, .rd = raw_read, .sk = raw_seek};
+
+// Streams the file straight from disk into the socket, mongoose handles Range and If-None-Match
+void get_file_raw(struct mg_connection *c, struct mg_http_message *hm) {
+    char project_name[256];
+    if (mg_http_get_var(&hm->query, "projectName", project_name, sizeof(project_name)) <= 0) {
+        error_response(c, 400, "Missing 'projectName' query parameter");
         return;
     }
-    memcpy(body, hm->body.buf, hm->body.len);
-    body[hm->body.len] = '\0';
 
-    cJSON *json = cJSON_Parse(body);
-    free(body);
+    char file_path[2048];
+    if (mg_http_get_var(&hm->query, "path", file_path, sizeof(file_path)) <= 0) {
+        error_response(c, 400, "Missing 'path' query parameter");
+        return;
+    }
 
-    if (!json) {
-        error_response(c, 400, "Invalid JSON");
+    char raw_path[sizeof(project_name) + sizeof(file_path) + 1];
+    if (!fs_valid_name(project_name) || !fs_valid_path(file_path)) {
+        error_response(c, 400, "Invalid 'projectName' or 'path' query parameter");
         return;
     }
+    snprintf(raw_path, sizeof(raw_path), "%s/%s", project_name, file_path);
+    writeback_sync(project_name, file_path);
+
+    struct mg_http_serve_opts opts = {
+        .mime_types = RAW_MIME_TYPES,
+        .extra_headers = CORS REVALIDATE_HEADER "Accept-Ranges: bytes\r\n",
+        .fs = &raw_fs,
+    };
+    mg_http_serve_file(c, hm, raw_path, &opts);
+}
+
+// .wobj files have to stay valid selector lists, anything else is stored as is. Answers 400 when not.
+static int valid_content(struct mg_connection *c, const char *extension, const char *content, size_t len) {
+    wobj_error_t err;
+    if (strcmp(extension, "wobj") != 0 || wobj_validate(content, len, &err) == 0) {
+        return 1;
+    }
 
-    const cJSON *projectName = cJSON_GetObjectItemCaseSensitive(json, "projectName");
-    const cJSON *path = cJSON_GetObjectItemCaseSensitive(json, "path");
-    const cJSON *content = cJSON_GetObjectItemCaseSensitive(json, "content");
+    char message[256];
+    snprintf(message, sizeof(message), "Invalid .wobj content at byte %zu: %s", err.offset, err.message);
+    error_response(c, 400, message);
+    return 0;
+}
 
-    if (!cJSON_IsString(projectName) || (projectName->valuestring == NULL) ||
-        !cJSON_IsString(path) || (path->valuestring == NULL) ||
-        !cJSON_IsString(content) || (content->valuestring == NULL)) {
-        cJSON_Delete(json);
-        error_response(c, 400, "Missing or invalid 'projectName', 'path' or 'content' field");
+typedef struct {
+    size_t start;
+    size_t end;
+    const char *text;
+    size_t text_len;
+} file_edit_t;
+
+static void hash_response(struct mg_connection *c, uint64_t hash) {
+    char hex[CONTENT_HASH_LEN];
+    content_hash_hex(hash, hex);
+    mg_http_reply(c, 200, DEFAULT_JSON_HEADER, "{\"hash\":\"%s\"}", hex);
+}
+
+// "edits" are [start, end) byte ranges of the base, ascending and not overlapping, replaced by "text"
+static file_edit_t *parse_edits(struct mg_str body, size_t base_len, int *count) {
+    int len = 0;
+    int ofs = mg_json_get(body, "$.edits", &len);
+    if (ofs < 0 || body.buf[ofs] != '[') {
+        return NULL;
+    }
+    struct mg_str edits = mg_str_n(body.buf + ofs, (size_t) len);
+
+    struct mg_str value;
+    int n = 0;
+    for (size_t pos = 0; (pos = mg_json_next(edits, pos, NULL, &value)) > 0;) {
+        n++;
+    }
+    if (n > FILES_MAX_EDITS) {
+        return NULL;
+    }
+
+    file_edit_t *out = arena_alloc((n > 0 ? n : 1) * sizeof(file_edit_t));
+    if (!out) {
+        return NULL;
+    }
+
+    size_t previous_end = 0;
+    int i = 0;
+    for (size_t pos = 0; (pos = mg_json_next(edits, pos, NULL, &value)) > 0; i++) {
+        long start = mg_json_get_long(value, "$.start", -1);
+        long end = mg_json_get_long(value, "$.end", -1);
+        const char *text = json_get_str_arena(value, "$.text", &out[i].text_len);
+        if (start < 0 || end < start || (size_t) end > base_len || (size_t) start < previous_end || !text) {
+            return NULL;
+        }
+        out[i].start = (size_t) start;
+        out[i].end = (size_t) end;
+        out[i].text = text;
+        previous_end = (size_t) end;
+    }
+
+    *count = n;
+    return out;
+}
+
+// Replaces the file with data (malloc'd, owned) through a temp file and a rename, so a failed or
+// interrupted save never leaves it truncated. In durable mode the answer comes from the commit worker,
+// with write-behind the save is answered from memory and written by writeback_tick().
+static void save_file(struct mg_connection *c, const char *project_name, const char *path, char *data, size_t len) {
+    if (commit_enabled()) {
+        content_forget(project_name, path);
+        if (commit_submit(c->id, project_name, path, data, len) != 0) {
+            error_response(c, 503, "Too many pending saves");
+        }
+        return;
+    }
+
+    uint64_t hash = content_hash(data, len);
+    if (writeback_put(project_name, path, data, len) == 0) {
+        content_forget(project_name, path);
+        hash_response(c, hash);
+        return;
+    }
+
+    struct stat st;
+    if (fs_write_atomic(project_name, path, data, len, &st) != 0) {
+        int status = errno == ENOENT || errno == ENOTDIR ? 404 : 500;
+        free(data);
+        content_forget(project_name, path);
+        error_response(c, status, status == 404 ? "File not found" : "Failed to update file");
+        return;
+    }
+
+    content_put(project_name, path, data, len, &st);
+    hash_response(c, hash);
+}
+
+void update_file_committed(struct mg_connection *c, struct mg_str *data) {
+    commit_result_t result;
+    if (data->len != sizeof(result)) {
         return;
     }
+    memcpy(&result, data->buf, sizeof(result));
+
+    if (result.status == 200) {
+        hash_response(c, result.hash);
+    } else {
+        error_response(c, result.status, result.status == 404 ? "File not found" : "Failed to update file");
+    }
+}
 
-    char *home = getenv("HOME");
-    if (!home) {
-        cJSON_Delete(json);
-        error_response(c, 500, "HOME environment variable not set");
+// Applies range edits to the cached copy when "baseHash" still matches it, 409 otherwise
+static void update_file_patch(struct mg_connection *c, struct mg_http_message *hm, const char *project_name,
+                              const char *path, const char *extension) {
+    char base_hash[CONTENT_HASH_LEN + 1];
+    if (json_get_str(hm->body, "$.baseHash", base_hash, sizeof(base_hash)) < 0) {
+        error_response(c, 400, "Missing or invalid 'baseHash' field");
         return;
     }
 
-    char full_path[2048];
-    snprintf(full_path, sizeof(full_path), "%s/Documents/Nora/%s/%s", home, projectName->valuestring,
-             path->valuestring);
+    const content_t *base = writeback_get(project_name, path, NULL);
+    if (!base) {
+        base = content_get(project_name, path);
+    }
+    if (!base) {
+        error_response(c, 404, "File not found");
+        return;
+    }
 
-    DEBUG("Updating file at path: %s", full_path);
+    char current[CONTENT_HASH_LEN];
+    content_hash_hex(base->hash, current);
+    if (strcmp(current, base_hash) != 0) {
+        error_response(c, 409, "File changed since 'baseHash', send the whole content");
+        return;
+    }
+
+    int count = 0;
+    file_edit_t *edits = parse_edits(hm->body, base->len, &count);
+    if (!edits) {
+        error_response(c, 400, "Invalid 'edits' field");
+        return;
+    }
+
+    size_t len = base->len;
+    for (int i = 0; i < count; i++) {
+        len = len - (edits[i].end - edits[i].start) + edits[i].text_len;
+    }
+
+    char *data = malloc(len + 1);
+    if (!data) {
+        error_response(c, 500, "Failed to update file");
+        return;
+    }
+
+    size_t src = 0, dst = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(data + dst, base->data + src, edits[i].start - src);
+        dst += edits[i].start - src;
+        memcpy(data + dst, edits[i].text, edits[i].text_len);
+        dst += edits[i].text_len;
+        src = edits[i].end;
+    }
+    memcpy(data + dst, base->data + src, base->len - src);
+    data[len] = '\0';
+
+    if (!valid_content(c, extension, data, len)) {
+        free(data);
+        return;
+    }
+
+    DEBUG("Patching %s/%s with %d edits", project_name, path, count);
+    save_file(c, project_name, path, data, len);
+}
+
+void update_file(struct mg_connection *c, struct mg_http_message *hm) {
+    if (mg_json_get(hm->body, "$", NULL) < 0) {
+        error_response(c, 400, "Invalid JSON");
+        return;
+    }
+
+    char project_name[256];
+    char path[2048];
+    if (json_get_str(hm->body, "$.projectName", project_name, sizeof(project_name)) < 0 ||
+        json_get_str(hm->body, "$.path", path, sizeof(path)) < 0) {
+        error_response(c, 400, "Missing or invalid 'projectName', 'path' or 'content' field");
+        return;
+    }
+
+    if (!fs_valid_name(project_name) || !fs_valid_path(path)) {
+        error_response(c, 400, "Invalid 'projectName' or 'path' field");
+        return;
+    }
+
+    DEBUG("Updating file at path: %s/%s", project_name, path);
     char extension[16];
-    const char *dot = strrchr(path->valuestring, '.');
+    const char *dot = strrchr(path, '.');
     if (dot && strlen(dot) < sizeof(extension)) {
         strncpy(extension, dot + 1, sizeof(extension) - 1);
         extension[sizeof(extension) - 1] = '\0';
@@ -195,26 +578,29 @@ void update_file(struct mg_connection *c, struct mg_http_message *hm) {
     }
     DEBUG("Extension %s", extension);
 
-    FILE *f = fopen(full_path, "w");
-    if (!f) {
-        error_response(c, 404, "File not found");
-        cJSON_Delete(json);
+    if (mg_json_get(hm->body, "$.edits", NULL) >= 0) {
+        update_file_patch(c, hm, project_name, path, extension);
         return;
     }
 
-    int result = 0;
-    if (strcmp(extension, "wobj") == 0) {
-        result = update_wobj_file(f, content);
-    } else {
-        result = update_text_file(f, content);
+    size_t content_len = 0;
+    char *content = json_get_str_arena(hm->body, "$.content", &content_len);
+    if (!content) {
+        error_response(c, 400, "Missing or invalid 'projectName', 'path' or 'content' field");
+        return;
     }
 
-    fclose(f);
-    if (result) {
-        mg_http_reply(c, 200, DEFAULT_TEXT_HEADER, "File updated successfully");
-    } else {
-        error_response(c, 500, "Failed to update file");
+    // checked before anything touches the file
+    if (!valid_content(c, extension, content, content_len)) {
+        return;
     }
 
-    cJSON_Delete(json);
+    char *data = malloc(content_len + 1);
+    if (!data) {
+        error_response(c, 500, "Failed to update file");
+        return;
+    }
+    memcpy(data, content, content_len);
+    data[content_len] = '\0';
+    save_file(c, project_name, path, data, content_len);
 }
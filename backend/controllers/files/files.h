@@ -3,9 +3,16 @@
 
 #include "../../../lib/Mongoose/mongoose.h"
 
+#define FILES_BATCH_MAX 256
+#define FILES_MAX_EDITS 1024
+
 void create_file(struct mg_connection *c, struct mg_http_message *hm);
 void create_folder(struct mg_connection *c, struct mg_http_message *hm);
 void get_file(struct mg_connection *c, struct mg_http_message *hm);
+void get_files_batch(struct mg_connection *c, struct mg_http_message *hm);
+void get_file_raw(struct mg_connection *c, struct mg_http_message *hm);
 void update_file(struct mg_connection *c, struct mg_http_message *hm);
+// MG_EV_WAKEUP of a save answered by the durable commit worker
+void update_file_committed(struct mg_connection *c, struct mg_str *data);
 
 #endif //NORA_C_FILES_H
\ No newline at end of file
@@ -2,184 +2,223 @@
 
 #include <cjson/cJSON.h>
 #include <dirent.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../../../webDriver/src/utils/utils.h"
 #include "../../utils/utils.h"
+#include "../../utils/json_writer.h"
+#include "../../utils/arena.h"
+#include "../../cache/catalog.h"
+#include "../../cache/tree.h"
+#include "../../cache/writeback.h"
+#include "../../fs/fs.h"
 
 void get_projects(struct mg_connection *c, struct mg_http_message *hm) {
-    (void) hm;
-
-    cJSON *response_json = cJSON_CreateArray();
-
-    char *home = getenv("HOME");
-    if (!home) {
-        cJSON_Delete(response_json);
-        error_response(c, 500, "HOME environment variable not set");
-        return;
-    }
-
-    char path[1024];
-    snprintf(path, sizeof(path), "%s/Documents/Nora", home);
-
-    DIR *noraDir = opendir(path);
-    if (!noraDir) {
-        cJSON_Delete(response_json);
+    const char *json, *etag;
+    size_t len;
+    time_t last_modified;
+    if (catalog_get(&json, &len, &etag, &last_modified) != 0) {
         error_response(c, 500, "Failed to open projects directory");
         return;
     }
 
-    struct dirent *dir;
-    while ((dir = readdir(noraDir)) != NULL) {
-        if (dir->d_type == DT_DIR && strcmp(dir->d_name, ".") != 0 && strcmp(dir->d_name, "..") != 0) {
-            char filepath[2048];
-            snprintf(filepath, sizeof(filepath), "%s/%s/nora.json", path, dir->d_name);
-
-            FILE *f = fopen(filepath, "r");
-            if (f) {
-                fseek(f, 0, SEEK_END);
-                long length = ftell(f);
-                fseek(f, 0, SEEK_SET);
-
-                char *buffer = malloc(length + 1);
-                if (buffer) {
-                    fread(buffer, 1, length, f);
-                    buffer[length] = '\0';
-
-                    cJSON *item = cJSON_Parse(buffer);
-                    if (item) {
-                        cJSON_AddItemToArray(response_json, item);
-                    }
-                    free(buffer);
-                }
-                fclose(f);
-            }
-        }
+    if (http_not_modified(hm, etag, last_modified)) {
+        not_modified_response(c, etag, last_modified);
+        return;
     }
-    closedir(noraDir);
 
-    char* response = cJSON_Print(response_json);
-    cJSON_Delete(response_json);
-    mg_http_reply(c, 200, DEFAULT_JSON_HEADER, "%s", response);
-    free(response);
+    char headers[512];
+    validator_headers(headers, sizeof(headers), DEFAULT_JSON_HEADER, etag, last_modified);
+    buffer_response(c, headers, json, len);
 }
 
 void create_project(struct mg_connection *c, struct mg_http_message *hm) {
-    char *body = malloc(hm->body.len + 1);
-    if (!body) {
-        error_response(c, 500, "Memory allocation failed");
+    if (mg_json_get(hm->body, "$", NULL) < 0) {
+        error_response(c, 400, "Invalid JSON");
         return;
     }
-    memcpy(body, hm->body.buf, hm->body.len);
-    body[hm->body.len] = '\0';
-
-    cJSON *json = cJSON_Parse(body);
-    free(body);
 
-    if (!json) {
-        error_response(c, 400, "Invalid JSON");
+    char name[256];
+    if (json_get_str(hm->body, "$.name", name, sizeof(name)) < 0) {
+        error_response(c, 400, "Missing or invalid 'name' field");
         return;
     }
+    char *description = json_get_str_arena(hm->body, "$.description", NULL);
 
-    const cJSON *name = cJSON_GetObjectItemCaseSensitive(json, "name");
-    if (!cJSON_IsString(name) || (name->valuestring == NULL)) {
-        cJSON_Delete(json);
-        error_response(c, 400, "Missing or invalid 'name' field");
+    if (!fs_valid_name(name)) {
+        error_response(c, 400, "Invalid 'name' field");
         return;
     }
+    DEBUG("%s/%s", fs_root(), name);
 
-    char *home = getenv("HOME");
-    if (home) {
-        char path[1024];
-        snprintf(path, sizeof(path), "%s/Documents/Nora/%s", home, name->valuestring);
-        DEBUG("%s", path);
+    if (fs_create_project(name) == -1) {
+        error_response(c, 500, "Failed to create project directory");
+        return;
+    }
 
-        if (mkdir_p(path) == -1) {
-            cJSON_Delete(json);
-            error_response(c, 500, "Failed to create project directory");
-            return;
+    FILE *f = fs_fopen(name, "nora.json", "w");
+    if (f) {
+        cJSON *project_json = cJSON_CreateObject();
+        cJSON_AddStringToObject(project_json, "name", name);
+        cJSON_AddStringToObject(project_json, "description", description ? description : "");
+
+        char date[64];
+        time_t t = time(NULL);
+        struct tm tm = *localtime(&t);
+        snprintf(date, sizeof(date), "%04d-%02d-%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+        cJSON_AddStringToObject(project_json, "created_at", date);
+
+        char *prj_json_str = cJSON_Print(project_json);
+        fprintf(f, "%s", prj_json_str);
+        fclose(f);
+        cJSON_Delete(project_json);
+        catalog_invalidate(name);
+
+        for (int i = 0; i < TREE_ROOTS; i++) {
+            if (fs_mkdir(name, tree_roots[i]) == -1) {
+                cJSON_free(prj_json_str);
+                error_response(c, 500, "Failed to create project subdirectories");
+                return;
+            }
         }
 
-        char filepath[2048];
-        snprintf(filepath, sizeof(filepath), "%s/nora.json", path);
+        mg_http_reply(c, 201, DEFAULT_JSON_HEADER, "%s", prj_json_str);
+        cJSON_free(prj_json_str);
+    } else {
+        error_response(c, 500, "Failed to create project file");
+    }
+}
 
-        FILE *f = fopen(filepath, "w");
-        if (f) {
-            cJSON *project_json = cJSON_CreateObject();
-            cJSON_AddStringToObject(project_json, "name", name->valuestring);
+void get_files_recursive(const char *project, const char *path, json_writer_t *w, int depth) {
+    DIR *dir = fs_opendir(project, path);
+    if (!dir) {
+        return;
+    }
 
-            const cJSON *description = cJSON_GetObjectItemCaseSensitive(json, "description");
-            if (cJSON_IsString(description) && (description->valuestring != NULL)) {
-                cJSON_AddStringToObject(project_json, "description", description->valuestring);
-            } else {
-                cJSON_AddStringToObject(project_json, "description", "");
-            }
+    const char *subdir = strrchr(path, '/');
+    subdir = subdir ? subdir + 1 : path;
 
-            char date[64];
-            time_t t = time(NULL);
-            struct tm tm = *localtime(&t);
-            snprintf(date, sizeof(date), "%04d-%02d-%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
-            cJSON_AddStringToObject(project_json, "created_at", date);
-
-            char *prj_json_str = cJSON_Print(project_json);
-            fprintf(f, "%s", prj_json_str);
-            fclose(f);
-            cJSON_Delete(project_json);
-
-            char subdirs[4][20] = {"objects", "scenes", "scripts", "reports"};
-            for (int i = 0; i < 4; i++) {
-                char subdir_path[2048];
-                snprintf(subdir_path, sizeof(subdir_path), "%s/%s", path, subdirs[i]);
-                if (mkdir_p(subdir_path) == -1) {
-                    cJSON_Delete(json);
-                    error_response(c, 500, "Failed to create project subdirectories");
-                    return;
-                }
-            }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || fs_is_temp(entry->d_name)) {
+            continue;
+        }
+
+        jw_object_open(w, NULL);
+        jw_string(w, "name", entry->d_name);
+        jw_string(w, "topParent", subdir);
+        jw_bool(w, "isFolder", entry->d_type == DT_DIR);
 
-            mg_http_reply(c, 201, DEFAULT_JSON_HEADER, "%s", prj_json_str);
-            free(prj_json_str);
-        } else {
-            error_response(c, 500, "Failed to create project file");
+        if (entry->d_type == DT_DIR) {
+            jw_array_open(w, "children");
+            if (depth < TREE_MAX_DEPTH) {
+                char sub_path[4096];
+                snprintf(sub_path, sizeof(sub_path), "%s/%s", path, entry->d_name);
+                get_files_recursive(project, sub_path, w, depth + 1);
+            }
+            jw_array_close(w);
         }
-    } else {
-        error_response(c, 500, "HOME environment variable not set");
-    }
 
-    cJSON_Delete(json);
+        jw_object_close(w);
+    }
+    closedir(dir);
 }
 
-void get_files_recursive(const char *base_path, const char *subdir, cJSON *files_array) {
-    char path[2048];
-    snprintf(path, sizeof(path), "%s/%s", base_path, subdir);
+// The tree only holds names, so directory inodes and mtimes are enough to tell if it changed
+void tree_validator_recursive(const char *project, const char *path, uint64_t *hash, time_t *last_modified) {
+    struct stat st;
+    if (fs_stat(project, path, &st) != 0) {
+        return;
+    }
 
-    DIR *dir = opendir(path);
+    *hash = fnv1a(*hash, &st.st_ino, sizeof(st.st_ino));
+    *hash = fnv1a(*hash, &st.st_mtim, sizeof(st.st_mtim));
+    if (st.st_mtime > *last_modified) {
+        *last_modified = st.st_mtime;
+    }
+
+    DIR *dir = fs_opendir(project, path);
     if (!dir) {
         return;
     }
 
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
 
-        cJSON *file_json = cJSON_CreateObject();
-        cJSON_AddStringToObject(file_json, "name", entry->d_name);
-        cJSON_AddStringToObject(file_json, "topParent", subdir);
-        cJSON_AddBoolToObject(file_json, "isFolder", entry->d_type == DT_DIR);
+        char sub_path[4096];
+        snprintf(sub_path, sizeof(sub_path), "%s/%s", path, entry->d_name);
+        tree_validator_recursive(project, sub_path, hash, last_modified);
+    }
+    closedir(dir);
+}
 
-        if (entry->d_type == DT_DIR) {
-            cJSON * sub_files_array = cJSON_CreateArray();
-            get_files_recursive(path, entry->d_name, sub_files_array);
-            cJSON_AddItemToObject(file_json, "children", sub_files_array);
+static int has_tree_query(struct mg_http_message *hm) {
+    const char *params[] = {"path", "depth", "cursor", "limit", "format"};
+    for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+        if (mg_http_var(hm->query, mg_str(params[i])).buf != NULL) {
+            return 1;
         }
+    }
+    return 0;
+}
 
-        cJSON_AddItemToArray(files_array, file_json);
+static int query_int(struct mg_http_message *hm, const char *name, int *value) {
+    char buf[16];
+    if (mg_http_get_var(&hm->query, name, buf, sizeof(buf)) <= 0) {
+        return 0;
     }
-    closedir(dir);
+
+    char *end;
+    long v = strtol(buf, &end, 10);
+    if (*end != '\0' || v < 0 || v > 1000000) {
+        return -1;
+    }
+    *value = (int) v;
+    return 0;
+}
+
+// Lazy listing: one folder (path), a bounded number of levels (depth) and a page of its entries (cursor, limit)
+static void get_project_files_query(struct mg_connection *c, struct mg_http_message *hm, const char *project_name) {
+    char path[2048];
+    char cursor[256];
+    char format[16];
+    mg_http_get_var(&hm->query, "path", path, sizeof(path));
+    mg_http_get_var(&hm->query, "cursor", cursor, sizeof(cursor));
+    mg_http_get_var(&hm->query, "format", format, sizeof(format));
+
+    tree_query_t q = {.path = path, .cursor = cursor, .flat = strcmp(format, "flat") == 0};
+    if (query_int(hm, "depth", &q.depth) != 0 || query_int(hm, "limit", &q.limit) != 0) {
+        error_response(c, 400, "Invalid 'depth' or 'limit' query parameter");
+        return;
+    }
+    if (format[0] != '\0' && !q.flat && strcmp(format, "nested") != 0) {
+        error_response(c, 400, "Invalid 'format' query parameter, expected 'nested' or 'flat'");
+        return;
+    }
+
+    struct mg_iobuf out;
+    mg_iobuf_init(&out, 0, 4096);
+    int rc = tree_query(project_name, &q, &out);
+    if (rc == -1) {
+        error_response(c, 404, "Project not found");
+    } else if (rc == -2) {
+        error_response(c, 404, "Folder not found");
+    } else if (q.etag[0] != '\0' && http_not_modified(hm, q.etag, q.last_modified)) {
+        not_modified_response(c, q.etag, q.last_modified);
+    } else if (q.etag[0] != '\0') {
+        char headers[512];
+        validator_headers(headers, sizeof(headers), DEFAULT_JSON_HEADER, q.etag, q.last_modified);
+        buffer_response(c, headers, out.buf, out.len);
+    } else {
+        buffer_response(c, DEFAULT_JSON_HEADER, out.buf, out.len);
+    }
+    mg_iobuf_free(&out);
 }
 
 void get_project_files(struct mg_connection *c, struct mg_http_message *hm) {
@@ -189,89 +228,89 @@ void get_project_files(struct mg_connection *c, struct mg_http_message *hm) {
         return;
     }
 
-    char *home = getenv("HOME");
-    if (!home) {
-        error_response(c, 500, "HOME environment variable not set");
+    if (has_tree_query(hm)) {
+        get_project_files_query(c, hm, project_name);
         return;
     }
 
-    char path[1024];
-    snprintf(path, sizeof(path), "%s/Documents/Nora/%s", home, project_name);
+    const char *json, *tree_etag;
+    size_t len;
+    time_t tree_modified;
+    if (tree_get(project_name, &json, &len, &tree_etag, &tree_modified) == 0) {
+        if (http_not_modified(hm, tree_etag, tree_modified)) {
+            not_modified_response(c, tree_etag, tree_modified);
+            return;
+        }
 
-    DIR *dir = opendir(path);
-    if (!dir) {
-        error_response(c, 404, "Project not found");
+        char headers[512];
+        validator_headers(headers, sizeof(headers), DEFAULT_JSON_HEADER, tree_etag, tree_modified);
+        buffer_response(c, headers, json, len);
         return;
     }
 
-    closedir(dir);
-    char subdirs[4][20] = {"objects", "scenes", "scripts", "reports"};
-
-    cJSON *response_json = cJSON_CreateObject();
-    for (int i = 0; i < 4; i++) {
-        char subdir_path[2048];
-        snprintf(subdir_path, sizeof(subdir_path), "%s/%s", path, subdirs[i]);
+    // not cached (too many folders to watch, or unreadable): walk the disk
+    struct stat st;
+    if (fs_stat(project_name, NULL, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        error_response(c, 404, "Project not found");
+        return;
+    }
 
-        DIR *subdir = opendir(subdir_path);
-        if (!subdir) {
+    uint64_t hash = FNV1A_INIT;
+    time_t last_modified = 0;
+    for (int i = 0; i < TREE_ROOTS; i++) {
+        if (fs_stat(project_name, tree_roots[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
             error_response(c, 500, "Failed to open project subdirectory");
             return;
         }
-
-        cJSON *files_array = cJSON_CreateArray();
-        get_files_recursive(path, subdirs[i], files_array);
-
-        cJSON_AddItemToObject(response_json, subdirs[i], files_array);
+        tree_validator_recursive(project_name, tree_roots[i], &hash, &last_modified);
     }
 
-    char* response = cJSON_Print(response_json);
-    cJSON_Delete(response_json);
-    mg_http_reply(c, 200, DEFAULT_JSON_HEADER, "%s", response);
-    free(response);
-}
-
-void delete_project_file(struct mg_connection *c, struct mg_http_message *hm) {
-    char *body = malloc(hm->body.len + 1);
-    if (!body) {
-        error_response(c, 500, "Memory allocation failed");
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"tree-%016llx\"", (unsigned long long) hash);
+    if (http_not_modified(hm, etag, last_modified)) {
+        not_modified_response(c, etag, last_modified);
         return;
     }
-    memcpy(body, hm->body.buf, hm->body.len);
-    body[hm->body.len] = '\0';
 
-    cJSON *json = cJSON_Parse(body);
-    free(body);
+    char headers[512];
+    validator_headers(headers, sizeof(headers), DEFAULT_JSON_HEADER, etag, last_modified);
 
-    if (!json) {
+    json_writer_t w;
+    jw_begin(&w, c, 200, headers, 1);
+    jw_object_open(&w, NULL);
+    for (int i = 0; i < TREE_ROOTS; i++) {
+        jw_array_open(&w, tree_roots[i]);
+        get_files_recursive(project_name, tree_roots[i], &w, 1);
+        jw_array_close(&w);
+    }
+    jw_object_close(&w);
+    jw_end(&w);
+}
+
+void delete_project_file(struct mg_connection *c, struct mg_http_message *hm) {
+    if (mg_json_get(hm->body, "$", NULL) < 0) {
         error_response(c, 400, "Invalid JSON");
         return;
     }
 
-    const cJSON *projectName = cJSON_GetObjectItemCaseSensitive(json, "projectName");
-    const cJSON *path = cJSON_GetObjectItemCaseSensitive(json, "path");
-
-    if (!cJSON_IsString(projectName) || (projectName->valuestring == NULL) ||
-        !cJSON_IsString(path) || (path->valuestring == NULL)) {
-        cJSON_Delete(json);
+    char project_name[256];
+    char path[2048];
+    if (json_get_str(hm->body, "$.projectName", project_name, sizeof(project_name)) < 0 ||
+        json_get_str(hm->body, "$.path", path, sizeof(path)) < 0) {
         error_response(c, 400, "Missing or invalid 'projectName' or 'path' field");
         return;
     }
 
-    char *home = getenv("HOME");
-    if (!home) {
-        cJSON_Delete(json);
-        error_response(c, 500, "HOME environment variable not set");
+    if (!fs_valid_name(project_name) || !fs_valid_path(path)) {
+        error_response(c, 400, "Invalid 'projectName' or 'path' field");
         return;
     }
 
-    char full_path[2048];
-    snprintf(full_path, sizeof(full_path), "%s/Documents/Nora/%s/%s", home, projectName->valuestring, path->valuestring);
-
-    if (remove(full_path) == 0) {
+    if (fs_remove(project_name, path) == 0) {
+        // a pending save would bring the file back; kept if the remove failed, it was acknowledged
+        writeback_forget(project_name, path);
         mg_http_reply(c, 200, DEFAULT_TEXT_HEADER, "File deleted successfully");
     } else {
         error_response(c, 500, "Failed to delete file");
     }
-
-    cJSON_Delete(json);
-}
\ No newline at end of file
+}
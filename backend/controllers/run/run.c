@@ -1,5 +1,10 @@
 #include <stdio.h>
 #include "run.h"
+#include "../../fs/fs.h"
+#include "../../cache/writeback.h"
+#include "../../session/session.h"
+#include "../../jobs/jobs.h"
+#include "../../metrics/metrics.h"
 
 /*
  to run a file
@@ -12,22 +17,30 @@
  6. compile the C file with nora webdriver
  7. run compiled
 
+ the files are read on the backend thread, then 3. onwards runs as a job
+ (jobs/jobs.h) so a long run does not hold up the socket, and can be cancelled
+
 
  for all scenes, just repeat 3. to 5. until all files parsed
 
  */
 
 int get_file_content(char **content, char *project, char *file_path) {
-    char *home = getenv("HOME");
-    if (!home) {
-        return -1;
+    DEBUG("Getting file content from path: %s/%s", project, file_path);
+
+    // a save not written yet is newer than the disk
+    const content_t *pending = writeback_get(project, file_path, NULL);
+    if (pending) {
+        *content = malloc(pending->len + 1);
+        if (!*content) {
+            return -1;
+        }
+        memcpy(*content, pending->data, pending->len);
+        (*content)[pending->len] = '\0';
+        return 0;
     }
 
-    char full_path[4096];
-    snprintf(full_path, sizeof(full_path), "%s/Documents/Nora/%s/%s", home, project, file_path);
-    DEBUG("Getting file content from path: %s", full_path);
-
-    FILE *f = fopen(full_path, "r");
+    FILE *f = fs_fopen(project, file_path, "r");
     if (!f) {
         return -1;
     }
@@ -92,17 +105,10 @@ int convert_file_in_lines(char ***array, char **content) {
 }
 
 int get_c_files_path(char ***c_files, int *count, char *project) {
-    char *home = getenv("HOME");
-    if (!home) {
-        return -1;
-    }
-
-    char project_path[4096];
-    snprintf(project_path, sizeof(project_path), "%s/Documents/Nora/%s/scripts", home, project);
-    DEBUG("Getting C files from project path: %s", project_path);
+    DEBUG("Getting C files from project path: %s/scripts", project);
 
     // TODO: recursive folders
-    DIR *dir = opendir(project_path);
+    DIR *dir = fs_opendir(project, "scripts");
     if (!dir) {
         return -1;
     }
@@ -136,18 +142,20 @@ int get_c_files_path(char ***c_files, int *count, char *project) {
     return 0;
 }
 
-int match_c_with_scenes(cJSON **scenes, char **content, int content_count, char *project, char **c_files_path, int files_count) {
-    int r = 0;
+int match_c_with_scenes(job_t *job, cJSON **scenes, char **content, int content_count, char **c_files_path,
+                        char **c_files_content, int files_count) {
     for (int i = 0; i < files_count; i++) {
-        char *file_content = NULL;
-        char file_path[4096];
-        snprintf(file_path, sizeof(file_path), "scripts/%s", c_files_path[i]);
-        r = get_file_content(&file_content, project, file_path);
-        if (r < 0) {
+        if (job_cancelled(job)) {
+            return -1;
+        }
+
+        char *file_content = c_files_content[i];
+        if (file_content == NULL) {
             DEBUG("Failed to get file content for C file: %s", c_files_path[i]);
             continue;
         }
 
+        uint64_t step_start = metrics_now_us();
         char *ptr = file_content;
         while (ptr != NULL) {
             if (*ptr == '$') {
@@ -221,37 +229,46 @@ int match_c_with_scenes(cJSON **scenes, char **content, int content_count, char
                 ptr++;
             }
         }
-
-        free(file_content);
+        metrics_run_step(metrics_now_us() - step_start);
     }
 
     return 0;
 }
 
-int run_file(struct mg_connection *c, const cJSON *ws_content) {
-    DEBUG("Running file");
-    char *projectName = cJSON_GetStringValue(cJSON_GetObjectItem(ws_content, "projectName"));
-    char *filePath = cJSON_GetStringValue(cJSON_GetObjectItem(ws_content, "path"));
-
-    char *content = NULL;
-
-    int r = get_file_content(&content, projectName, filePath);
-    if (r < 0) {
-        DEBUG("Failed to get file content for project: %s, path: %s, exit code: %i", projectName, filePath, r);
-        ws_response(c, WS_ERROR, "Failed to get file content");
-        return -1;
+typedef struct {
+    char project[256];
+    char path[2048];
+    char *content;
+    char **c_files_path;
+    char **c_files_content;
+    int c_file_count;
+} run_ctx_t;
+
+static void run_ctx_free(void *arg) {
+    run_ctx_t *ctx = (run_ctx_t *) arg;
+    for (int i = 0; i < ctx->c_file_count; i++) {
+        free(ctx->c_files_path[i]);
+        free(ctx->c_files_content[i]);
     }
+    free(ctx->c_files_path);
+    free(ctx->c_files_content);
+    free(ctx->content);
+    free(ctx);
+}
+
+// Job thread: everything it reads was loaded by run_file, the caches are not touched here
+static void run_file_job(job_t *job, void *arg) {
+    run_ctx_t *ctx = (run_ctx_t *) arg;
 
-    DEBUG("File content: %s", content);
+    DEBUG("File content: %s", ctx->content);
 
     char **content_array = NULL;
     int content_array_count = 0;
-    r = convert_file_in_lines(&content_array, &content);
+    int r = convert_file_in_lines(&content_array, &ctx->content);
     if (r < 0) {
-        DEBUG("Failed to convert file content to lines for project: %s, path: %s, exit code: %i", projectName, filePath, r);
-        ws_response(c, WS_ERROR, "Failed to convert file content to lines");
-        free(content);
-        return -1;
+        DEBUG("Failed to convert file content to lines for project: %s, path: %s, exit code: %i", ctx->project, ctx->path, r);
+        job_send(job, WS_ERROR, "Failed to convert file content to lines");
+        return;
     }
     content_array_count = r;
 
@@ -259,31 +276,21 @@ int run_file(struct mg_connection *c, const cJSON *ws_content) {
     for (int i = 0; i < content_array_count; i++) {
         DEBUG("Content line %i: %s", i, content_array[i]);
     }
-#endif
-
-    char **c_files_path = NULL;
-    int c_file_count = 0;
-    r = get_c_files_path(&c_files_path, &c_file_count, projectName);
-    if (r < 0) {
-        DEBUG("Failed to get C files: %s, path: %s, exit code: %i", projectName, c_files_path, r);
-        ws_response(c, WS_ERROR, "Failed to get C files");
-    }
-
-    DEBUG("Found %i C files", c_file_count);
-
-#ifdef DEBUG_ENABLED
-    for (int i = 0; i < c_file_count; i++) {
-        DEBUG("C file %i: %s", i, c_files_path[i]);
+    for (int i = 0; i < ctx->c_file_count; i++) {
+        DEBUG("C file %i: %s", i, ctx->c_files_path[i]);
     }
 #endif
 
 
     DEBUG("\n\n------------------\n\n")
     cJSON *scenes = cJSON_CreateArray();
-    r = match_c_with_scenes(&scenes, content_array, content_array_count, projectName, c_files_path, c_file_count);
+    r = match_c_with_scenes(job, &scenes, content_array, content_array_count, ctx->c_files_path,
+                            ctx->c_files_content, ctx->c_file_count);
     if (r < 0) {
-        DEBUG("Failed to match C files with scenes: %s, path: %s, exit code: %i", projectName, c_files_path, r);
-        ws_response(c, WS_ERROR, "Failed to match C files with scenes");
+        DEBUG("Stopped matching C files with scenes: %s, path: %s", ctx->project, ctx->path);
+        cJSON_Delete(scenes);
+        free(content_array);
+        return;
     }
 
     DEBUG("Found %i matched scenes", cJSON_GetArraySize(scenes));
@@ -298,13 +305,15 @@ int run_file(struct mg_connection *c, const cJSON *ws_content) {
         DEBUG("Content line not match: '%s'", content_array[i]);
         char *msg = NULL;
         asprintf(&msg, "Scene step not found: '%s'\nCreate a function like the example bellow to start:", content_array[i]);
-        ws_response(c, WS_ERROR, msg);
+        job_send(job, WS_ERROR, msg);
         free(msg);
 
         asprintf(&msg, "$ %s\nvoid your_function_name(){\n\t// TODO\n}", content_array[i]);
-        ws_response(c, WS_CODE_ERROR, msg);
+        job_send(job, WS_CODE_ERROR, msg);
         free(msg);
-        return -1;
+        cJSON_Delete(scenes);
+        free(content_array);
+        return;
     }
 
     DEBUG("\n\n------------------\n\n")
@@ -314,31 +323,74 @@ int run_file(struct mg_connection *c, const cJSON *ws_content) {
 
 
 
-    for (int i = 0; i < c_file_count; i++) {
-        free(c_files_path[i]);
-    }
-    free(c_files_path);
     cJSON_Delete(scenes);
-    free(content);
     free(content_array);
+}
 
+int run_file(struct mg_connection *c, struct mg_str ws_content, const char *id) {
+    DEBUG("Running file");
+    run_ctx_t *ctx = calloc(1, sizeof(run_ctx_t));
+    if (!ctx) {
+        ws_response_id(c, id, WS_ERROR, "Failed to start the run");
+        return -1;
+    }
+    if (json_get_str(ws_content, "$.projectName", ctx->project, sizeof(ctx->project)) < 0 ||
+        json_get_str(ws_content, "$.path", ctx->path, sizeof(ctx->path)) < 0) {
+        ws_response_id(c, id, WS_ERROR, "Missing or invalid 'projectName' or 'path' field");
+        free(ctx);
+        return -1;
+    }
 
-    return 0;
+    // pending saves and the object index belong to this thread, so the inputs are read before the job starts
+    int r = get_file_content(&ctx->content, ctx->project, ctx->path);
+    if (r < 0) {
+        DEBUG("Failed to get file content for project: %s, path: %s, exit code: %i", ctx->project, ctx->path, r);
+        ws_response_id(c, id, WS_ERROR, "Failed to get file content");
+        run_ctx_free(ctx);
+        return -1;
+    }
+
+    r = get_c_files_path(&ctx->c_files_path, &ctx->c_file_count, ctx->project);
+    if (r < 0) {
+        DEBUG("Failed to get C files: %s, exit code: %i", ctx->project, r);
+        ws_response_id(c, id, WS_ERROR, "Failed to get C files");
+        ctx->c_file_count = 0;
+    }
+
+    DEBUG("Found %i C files", ctx->c_file_count);
+
+    ctx->c_files_content = calloc(ctx->c_file_count > 0 ? ctx->c_file_count : 1, sizeof(char *));
+    if (!ctx->c_files_content) {
+        ws_response_id(c, id, WS_ERROR, "Failed to start the run");
+        ctx->c_file_count = 0;
+        run_ctx_free(ctx);
+        return -1;
+    }
+    for (int i = 0; i < ctx->c_file_count; i++) {
+        char file_path[4096];
+        snprintf(file_path, sizeof(file_path), "scripts/%s", ctx->c_files_path[i]);
+        get_file_content(&ctx->c_files_content[i], ctx->project, file_path);
+    }
 
+    char label[sizeof(ctx->project) + sizeof(ctx->path)];
+    snprintf(label, sizeof(label), "%s/%s", ctx->project, ctx->path);
+    return job_start(c, id, label, run_file_job, ctx, run_ctx_free);
 }
 
-int run(struct mg_connection *c, const cJSON *content, const char *type) {
+int run(struct mg_connection *c, struct mg_str content, const char *type, const char *id) {
     DEBUG("Type: %s", type);
 
     if (strcmp(type, "run_all_files") == 0) {
         DEBUG("Running all files");
-        // TODO
+        // TODO, until then the id is closed right away so the client does not wait for it
+        ws_response_id(c, id, WS_END, "Running all files is not supported yet");
+        return 0;
     } else if (strcmp(type, "run_file") == 0) {
-        return run_file(c, content);
+        return run_file(c, content, id);
     }
 
     struct mg_str response = mg_str("Hello from the websocket!");
-    mg_ws_send(c, response.buf, response.len, WEBSOCKET_OP_TEXT);
+    session_send(c, response.buf, response.len, WEBSOCKET_OP_TEXT);
 
     return 0;
 }
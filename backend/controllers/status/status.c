@@ -1,15 +1,140 @@
 #include "status.h"
 
-#include <cjson/cJSON.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../../../args.h"
 #include "../../utils/utils.h"
+#include "../../utils/json_writer.h"
+#include "../../utils/ws_deflate.h"
+#include "../../metrics/metrics.h"
+#include "../../jobs/jobs.h"
+#include "../../cache/content.h"
+#include "../../cache/tree.h"
+#include "../../cache/catalog.h"
+#include "../../cache/writeback.h"
+#include "../../fs/commit.h"
+
+static struct mg_iobuf status_body = {.align = 1024};
+static uint64_t status_built_ms = 0;
+static uint64_t started_ms = 0;
+
+static long rss_bytes(void) {
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%*s %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+static void cache_write(const char *name, cache_stats_t st, int last) {
+    unsigned long lookups = st.hits + st.misses;
+    mg_xprintf(mg_pfn_iobuf, &status_body,
+               "\"%s\":{\"hits\":%lu,\"misses\":%lu,\"hitRate\":%.3f,\"entries\":%d,\"bytes\":%lu}%s", name,
+               st.hits, st.misses, lookups ? (double) st.hits / (double) lookups : 0.0, st.entries,
+               (unsigned long) st.bytes, last ? "" : ",");
+}
+
+static void status_build(struct mg_mgr *mgr) {
+    uint64_t now = mg_millis();
+    loop_stats_t loop = metrics_loop_stats();
+    unsigned long http, ws;
+    uint64_t buffered;
+    metrics_connections(mgr, &http, &ws, &buffered);
+
+    status_body.len = 0;
+    mg_xprintf(mg_pfn_iobuf, &status_body, "{\"status\":\"ok\",\"uptimeSeconds\":%lu,",
+               (unsigned long) ((now - started_ms) / 1000));
+    mg_xprintf(mg_pfn_iobuf, &status_body, "\"build\":{\"version\":%m,\"mongoose\":%m,\"compiler\":%m,\"date\":%m},",
+               MG_ESC(CMDLINE_PARSER_VERSION), MG_ESC(MG_VERSION), MG_ESC(__VERSION__), MG_ESC(__DATE__ " " __TIME__));
+    mg_xprintf(mg_pfn_iobuf, &status_body,
+               "\"loop\":{\"lagMs\":%.3f,\"maxLagMs\":%.3f,\"stalls\":%lu,\"stallBudgetMs\":%d},",
+               (double) loop.last_lag_us / 1000, (double) loop.max_lag_us / 1000, (unsigned long) loop.stalls,
+               loop.budget_ms);
+    mg_xprintf(mg_pfn_iobuf, &status_body, "\"jobs\":{\"running\":%d,\"maxRunning\":%d},", jobs_running(),
+               JOBS_MAX_RUNNING);
+    mg_xprintf(mg_pfn_iobuf, &status_body,
+               "\"saves\":{\"durable\":%s,\"commitQueued\":%d,\"writebackPending\":%d},",
+               commit_enabled() ? "true" : "false", commit_queued(), writeback_pending());
+    mg_xprintf(mg_pfn_iobuf, &status_body, "\"caches\":{");
+    cache_write("files", content_stats(), 0);
+    cache_write("trees", tree_stats(), 0);
+    cache_write("projects", catalog_stats(), 1);
+    mg_xprintf(mg_pfn_iobuf, &status_body, "},");
+    mg_xprintf(mg_pfn_iobuf, &status_body,
+               "\"connections\":{\"http\":%lu,\"ws\":%lu,\"bufferedBytes\":%lu},\"rssBytes\":%ld}", http, ws,
+               (unsigned long) buffered, rss_bytes());
+    status_built_ms = now;
+}
+
+void status_init(void) {
+    started_ms = mg_millis();
+}
+
+void status_tick(struct mg_mgr *mgr) {
+    if (status_body.len == 0 || mg_millis() - status_built_ms >= STATUS_REFRESH_MS) {
+        status_build(mgr);
+    }
+}
+
+void status_free(void) {
+    mg_iobuf_free(&status_body);
+}
 
 void get_status(struct mg_connection *c, struct mg_http_message *hm) {
     (void) hm;
 
-    cJSON *response_json = cJSON_CreateObject();
-    cJSON_AddStringToObject(response_json, "status", "ok");
+    if (status_body.len == 0) {
+        status_build(c->mgr);
+    }
+    buffer_response(c, DEFAULT_JSON_HEADER, status_body.buf, status_body.len);
+}
+
+void get_stats(struct mg_connection *c, struct mg_http_message *hm) {
+    (void) hm;
+
+    json_writer_t w;
+    jw_begin(&w, c, 200, DEFAULT_JSON_HEADER, 0);
+    jw_object_open(&w, NULL);
+    jw_array_open(&w, "endpoints");
+    for (int i = 0; controllers[i].path != NULL; i++) {
+        const controller_stats_t *st = &controller_stats[i];
+        jw_object_open(&w, NULL);
+        jw_string(&w, "path", controllers[i].path);
+        jw_string(&w, "method", controllers[i].method == NORA_GET ? "GET" : "POST");
+        jw_int(&w, "requests", (long long) st->requests);
+        jw_int(&w, "arenaAllocations", (long long) st->arena_allocations);
+        jw_int(&w, "arenaBytes", (long long) st->arena_bytes);
+        jw_int(&w, "systemAllocations", (long long) st->system_allocations);
+        jw_object_close(&w);
+    }
+    jw_array_close(&w);
+
+    const ws_deflate_stats_t *ws = ws_deflate_stats();
+    jw_object_open(&w, "wsDeflate");
+    jw_int(&w, "connections", (long long) ws->connections);
+    jw_int(&w, "compressedMessages", (long long) ws->compressed);
+    jw_int(&w, "skippedMessages", (long long) ws->skipped);
+    jw_int(&w, "inflatedMessages", (long long) ws->inflated);
+    jw_int(&w, "rawBytes", (long long) ws->raw_bytes);
+    jw_int(&w, "compressedBytes", (long long) ws->compressed_bytes);
+    jw_number(&w, "ratio", ws->raw_bytes ? (double) ws->compressed_bytes / (double) ws->raw_bytes : 0);
+    jw_number(&w, "cpuMs", (double) ws->cpu_ns / 1e6);
+    jw_object_close(&w);
+
+    jw_object_close(&w);
+    jw_end(&w);
+}
+
+void get_metrics(struct mg_connection *c, struct mg_http_message *hm) {
+    (void) hm;
 
-    char* response = cJSON_Print(response_json);
-    cJSON_Delete(response_json);
-    mg_http_reply(c, 200, DEFAULT_JSON_HEADER, "%s", response);
-}
\ No newline at end of file
+    struct mg_iobuf out = {.align = 4096};
+    metrics_write(&out, c->mgr);
+    buffer_response(c, CORS "Content-Type: text/plain; version=0.0.4\r\n", out.buf, out.len);
+    mg_iobuf_free(&out);
+}
@@ -3,6 +3,19 @@
 
 #include "../../../lib/Mongoose/mongoose.h"
 
+/*
+ GET / answers health probes from a body rebuilt at most every STATUS_REFRESH_MS
+ in status_tick(), so probing often costs one copy into the send buffer.
+ */
+#define STATUS_REFRESH_MS 1000
+
+void status_init(void);
+// Called once per loop iteration
+void status_tick(struct mg_mgr *mgr);
+void status_free(void);
+
 void get_status(struct mg_connection *c, struct mg_http_message *hm);
+void get_stats(struct mg_connection *c, struct mg_http_message *hm);
+void get_metrics(struct mg_connection *c, struct mg_http_message *hm);
 
 #endif //NORA_C_STATUS_H
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "commit.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../webDriver/src/utils/utils.h"
+#include "../cache/content.h"
+#include "fs.h"
+
+typedef struct commit_job {
+    unsigned long conn_id;
+    char project[256];
+    char *path;
+    char *data;
+    size_t len;
+    fs_temp_t temp;
+    int status;
+    struct commit_job *next;
+} commit_job_t;
+
+static struct mg_mgr *commit_mgr = NULL;
+static pthread_t worker_tid;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static commit_job_t *queue_head = NULL, *queue_tail = NULL;
+static int queued = 0;
+static int running = 0;
+
+static void job_free(commit_job_t *job) {
+    free(job->path);
+    free(job->data);
+    free(job);
+}
+
+static int failure_status(void) {
+    return errno == ENOENT || errno == ENOTDIR ? 404 : 500;
+}
+
+static void commit_round(commit_job_t *batch) {
+    int count = 0, dirs = 0;
+    for (commit_job_t *job = batch; job; job = job->next, count++) {
+        job->status = fs_temp_write(job->project, job->path, job->data, job->len, &job->temp) == 0
+                      ? 200 : failure_status();
+    }
+
+    // the data has to be on disk before a rename can expose it; all of it is written
+    // before the first fsync, so the filesystem can flush the batch together
+    for (commit_job_t *job = batch; job; job = job->next) {
+        if (job->status == 200 && fs_temp_sync(&job->temp) != 0) {
+            job->status = 500;
+        }
+    }
+    for (commit_job_t *job = batch; job; job = job->next) {
+        if (job->status == 200 && fs_temp_rename(&job->temp) != 0) {
+            job->status = failure_status();
+        }
+    }
+
+    // one fsync per directory makes its renames durable
+    for (commit_job_t *job = batch; job; job = job->next) {
+        if (job->status != 200) {
+            continue;
+        }
+        commit_job_t *same = batch;
+        while (same != job && (same->status != 200 || !fs_temp_same_dir(&same->temp, &job->temp))) {
+            same = same->next;
+        }
+        if (same == job) {
+            dirs++;
+            if (fs_temp_sync_dir(&job->temp) != 0) {
+                for (commit_job_t *other = job; other; other = other->next) {
+                    if (other->status == 200 && (other == job || fs_temp_same_dir(&other->temp, &job->temp))) {
+                        other->status = 500;
+                    }
+                }
+            }
+        }
+    }
+    for (commit_job_t *job = batch; job; job = job->next) {
+        fs_temp_close(&job->temp);
+    }
+    DEBUG("Committed %d saves, synced %d directories", count, dirs);
+
+    while (batch) {
+        commit_job_t *next = batch->next;
+        commit_result_t result = {.status = batch->status, .hash = content_hash(batch->data, batch->len)};
+        mg_wakeup(commit_mgr, batch->conn_id, &result, sizeof(result));
+        job_free(batch);
+        batch = next;
+    }
+}
+
+static void *commit_worker(void *arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&lock);
+    while (running || queue_head) {
+        if (!queue_head) {
+            pthread_cond_wait(&cond, &lock);
+            continue;
+        }
+
+        // everything queued so far goes into this round
+        commit_job_t *batch = queue_head;
+        queue_head = queue_tail = NULL;
+        queued = 0;
+        pthread_mutex_unlock(&lock);
+
+        commit_round(batch);
+
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int commit_init(struct mg_mgr *mgr) {
+    commit_mgr = mgr;
+    running = 1;
+    if ((errno = pthread_create(&worker_tid, NULL, commit_worker, NULL)) != 0) {
+        running = 0;
+        return -1;
+    }
+    DEBUG("Durable saves enabled");
+    return 0;
+}
+
+void commit_free(void) {
+    if (!running) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    running = 0;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    pthread_join(worker_tid, NULL);
+}
+
+int commit_enabled(void) {
+    return running;
+}
+
+int commit_queued(void) {
+    pthread_mutex_lock(&lock);
+    int n = queued;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+int commit_submit(unsigned long conn_id, const char *project, const char *path, char *data, size_t len) {
+    commit_job_t *job = calloc(1, sizeof(commit_job_t));
+    char *path_copy = strdup(path);
+    if (!job || !path_copy) {
+        free(job);
+        free(path_copy);
+        free(data);
+        return -1;
+    }
+    job->conn_id = conn_id;
+    snprintf(job->project, sizeof(job->project), "%s", project);
+    job->path = path_copy;
+    job->data = data;
+    job->len = len;
+
+    pthread_mutex_lock(&lock);
+    if (queued >= COMMIT_MAX_PENDING) {
+        pthread_mutex_unlock(&lock);
+        job_free(job);
+        return -1;
+    }
+    if (queue_tail) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    queued++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef NORA_C_COMMIT_H
+#define NORA_C_COMMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+
+/*
+ Durable saves (--durable). A worker thread writes each save to a temp file and
+ the request is only answered once both the data and the rename are on disk.
+ Saves arriving while the worker is syncing queue up and are committed together
+ in the next round (group commit): all their temp files are written before the
+ first fsync, renamed once all are synced, and each directory involved is synced
+ once for all its renames. Only the saved files are flushed, not the filesystem.
+ The result reaches the connection as MG_EV_WAKEUP carrying a commit_result_t.
+ */
+
+#define COMMIT_MAX_PENDING 256
+
+typedef struct {
+    int status; // 200, or the HTTP status of the failure
+    uint64_t hash;
+} commit_result_t;
+
+int commit_init(struct mg_mgr *mgr);
+// Commits what is still queued, then stops the worker
+void commit_free(void);
+int commit_enabled(void);
+// Saves waiting for the next round
+int commit_queued(void);
+
+// Takes ownership of data (malloc'd), also on failure; -1 when the queue is full
+int commit_submit(unsigned long conn_id, const char *project, const char *path, char *data, size_t len);
+
+#endif //NORA_C_COMMIT_H
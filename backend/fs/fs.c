@@ -0,0 +1,495 @@
+#include "fs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+#include "../../webDriver/src/utils/utils.h"
+#include "../utils/utils.h"
+
+// Any thread may be using a project's fd when it is forgotten, so each user holds
+// a reference and the last one closes it; the number is never reused under them
+typedef struct {
+    char name[256];
+    int fd;
+    int refs;     // under lock
+    int detached; // not in the table, closed when refs drops to 0
+} project_dir_t;
+
+static char root_path[PATH_MAX];
+static int root_fd = -1;
+
+static project_dir_t *projects[FS_MAX_PROJECTS];
+static int projects_count = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile int use_openat2 = 1;
+
+int fs_init(const char *root) {
+    if (mkdir_p(root) != 0) {
+        return -1;
+    }
+    if (!realpath(root, root_path)) {
+        return -1;
+    }
+
+    root_fd = open(root_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        return -1;
+    }
+    DEBUG("Workspace root: %s", root_path);
+    return 0;
+}
+
+void fs_free(void) {
+    // every other thread has stopped by now
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < projects_count; i++) {
+        close(projects[i]->fd);
+        free(projects[i]);
+    }
+    projects_count = 0;
+    pthread_mutex_unlock(&lock);
+
+    if (root_fd >= 0) {
+        close(root_fd);
+        root_fd = -1;
+    }
+}
+
+const char *fs_root(void) {
+    return root_path;
+}
+
+int fs_valid_name(const char *name) {
+    return name && name[0] != '\0' && strlen(name) < sizeof(((project_dir_t *) 0)->name) && strchr(name, '/') == NULL &&
+           strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+int fs_valid_path(const char *path) {
+    if (!path) {
+        return 1;
+    }
+    if (strlen(path) >= PATH_MAX) {
+        return 0;
+    }
+
+    for (const char *p = path; *p;) {
+        const char *end = strchrnul(p, '/');
+        size_t len = end - p;
+        if ((len == 1 && p[0] == '.') || (len == 2 && p[0] == '.' && p[1] == '.')) {
+            return 0;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return 1;
+}
+
+// Paths are relative to the project, leading slashes are tolerated
+static const char *relative(const char *path) {
+    if (!path) {
+        return ".";
+    }
+    while (*path == '/') {
+        path++;
+    }
+    return *path ? path : ".";
+}
+
+// The project directory, referenced until project_dir_put(); a full table hands out a detached one
+static project_dir_t *project_dir_get(const char *project) {
+    if (!fs_valid_name(project) || root_fd < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < projects_count; i++) {
+        if (strcmp(projects[i]->name, project) == 0) {
+            project_dir_t *d = projects[i];
+            d->refs++;
+            pthread_mutex_unlock(&lock);
+            return d;
+        }
+    }
+
+    project_dir_t *d = calloc(1, sizeof(project_dir_t));
+    if (!d) {
+        pthread_mutex_unlock(&lock);
+        errno = ENOMEM;
+        return NULL;
+    }
+    d->fd = openat(root_fd, project, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (d->fd < 0) {
+        int saved = errno;
+        pthread_mutex_unlock(&lock);
+        free(d);
+        errno = saved;
+        return NULL;
+    }
+    snprintf(d->name, sizeof(d->name), "%s", project);
+    d->refs = 1;
+    if (projects_count < FS_MAX_PROJECTS) {
+        projects[projects_count++] = d;
+    } else {
+        d->detached = 1;
+    }
+    pthread_mutex_unlock(&lock);
+    return d;
+}
+
+static void project_dir_put(project_dir_t *d) {
+    int saved = errno;
+    pthread_mutex_lock(&lock);
+    int last = --d->refs == 0 && d->detached;
+    pthread_mutex_unlock(&lock);
+    if (last) {
+        close(d->fd);
+        free(d);
+    }
+    errno = saved;
+}
+
+static int open_beneath(int dir_fd, const char *path, int flags, mode_t mode) {
+#ifdef SYS_openat2
+    if (use_openat2) {
+        struct open_how how = {
+            .flags = flags | O_CLOEXEC,
+            .mode = (flags & (O_CREAT | O_TMPFILE)) ? mode : 0,
+            .resolve = RESOLVE_BENEATH,
+        };
+        int fd = syscall(SYS_openat2, dir_fd, path, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS) {
+            return fd;
+        }
+        use_openat2 = 0; // older kernel, the path checks have to do
+    }
+#endif
+    return openat(dir_fd, path, flags | O_CLOEXEC, mode);
+}
+
+int fs_open(const char *project, const char *path, int flags, mode_t mode) {
+    if (!fs_valid_path(path)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    project_dir_t *d = project_dir_get(project);
+    if (!d) {
+        return -1;
+    }
+
+    int fd = open_beneath(d->fd, relative(path), flags, mode);
+    project_dir_put(d);
+    return fd;
+}
+
+FILE *fs_fopen(const char *project, const char *path, const char *mode) {
+    int flags;
+    switch (mode[0]) {
+        case 'r':
+            flags = O_RDONLY;
+            break;
+        case 'w':
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        case 'a':
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            break;
+        default:
+            errno = EINVAL;
+            return NULL;
+    }
+    if (strchr(mode, '+')) {
+        flags = (flags & ~O_ACCMODE) | O_RDWR;
+    }
+
+    int fd = fs_open(project, path, flags, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    FILE *f = fdopen(fd, mode);
+    if (!f) {
+        close(fd);
+    }
+    return f;
+}
+
+DIR *fs_opendir(const char *project, const char *path) {
+    int fd = fs_open(project, path, O_RDONLY | O_DIRECTORY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+    }
+    return dir;
+}
+
+int fs_stat(const char *project, const char *path, struct stat *st) {
+    int fd = fs_open(project, path, O_PATH, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int rc = fstat(fd, st);
+    close(fd);
+    return rc;
+}
+
+// Creates every missing folder of path, each one relative to the one before
+int fs_mkdir(const char *project, const char *path) {
+    if (!fs_valid_path(path)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    project_dir_t *d = project_dir_get(project);
+    if (!d) {
+        return -1;
+    }
+    int dir_fd = d->fd;
+
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", relative(path));
+
+    int rc = 0;
+    int current = dir_fd;
+    char *save = NULL;
+    for (char *part = strtok_r(buf, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (strcmp(part, ".") == 0) {
+            continue;
+        }
+        if (mkdirat(current, part, 0755) != 0 && errno != EEXIST) {
+            rc = -1;
+            break;
+        }
+
+        int next = open_beneath(current, part, O_RDONLY | O_DIRECTORY, 0);
+        if (current != dir_fd) {
+            close(current);
+        }
+        current = next;
+        if (current < 0) {
+            rc = -1;
+            break;
+        }
+    }
+
+    int saved = errno;
+    if (current >= 0 && current != dir_fd) {
+        close(current);
+    }
+    errno = saved;
+    project_dir_put(d);
+    return rc;
+}
+
+// The parent folder of path opened relative to the project, with the last component copied to name
+static int open_parent(const char *project, const char *path, char *name, size_t name_len) {
+    if (!path || !fs_valid_path(path)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", relative(path));
+    size_t len = strlen(buf);
+    while (len > 1 && buf[len - 1] == '/') {
+        buf[--len] = '\0';
+    }
+    if (strcmp(buf, ".") == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char *slash = strrchr(buf, '/');
+    snprintf(name, name_len, "%s", slash ? slash + 1 : buf);
+    if (slash) {
+        *slash = '\0';
+    }
+    return fs_open(project, slash ? buf : NULL, O_RDONLY | O_DIRECTORY, 0);
+}
+
+// Removes a file or an empty folder, unlinked from its parent folder fd
+int fs_remove(const char *project, const char *path) {
+    char name[NAME_MAX + 1];
+    int parent = open_parent(project, path, name, sizeof(name));
+    if (parent < 0) {
+        return -1;
+    }
+
+    int rc = unlinkat(parent, name, 0);
+    if (rc != 0 && errno == EISDIR) {
+        rc = unlinkat(parent, name, AT_REMOVEDIR);
+    }
+
+    int saved = errno;
+    close(parent);
+    errno = saved;
+    return rc;
+}
+
+int fs_is_temp(const char *name) {
+    size_t len = strlen(name);
+    return strncmp(name, FS_TEMP_PREFIX, sizeof(FS_TEMP_PREFIX) - 1) == 0 && len >= sizeof(FS_TEMP_SUFFIX) - 1 &&
+           strcmp(name + len - (sizeof(FS_TEMP_SUFFIX) - 1), FS_TEMP_SUFFIX) == 0;
+}
+
+static void temp_close(fs_temp_t *t) {
+    int saved = errno;
+    if (t->fd >= 0) {
+        close(t->fd);
+        t->fd = -1;
+    }
+    close(t->dir_fd);
+    t->dir_fd = -1;
+    errno = saved;
+}
+
+// The temp file is complete once its fd is closed without error
+static int temp_finish(fs_temp_t *t) {
+    int fd = t->fd;
+    t->fd = -1;
+    return fd < 0 || close(fd) == 0 ? 0 : -1;
+}
+
+int fs_temp_write(const char *project, const char *path, const void *data, size_t len, fs_temp_t *t) {
+    static unsigned long counter = 0;
+
+    t->fd = -1;
+    t->dir_fd = open_parent(project, path, t->name, sizeof(t->name));
+    if (t->dir_fd < 0) {
+        return -1;
+    }
+
+    // the new file keeps the permissions of the one it replaces
+    struct stat st;
+    mode_t mode = fstatat(t->dir_fd, t->name, &st, 0) == 0 ? st.st_mode & 07777 : 0644;
+    snprintf(t->temp, sizeof(t->temp), FS_TEMP_PREFIX "%d-%lu" FS_TEMP_SUFFIX, (int) getpid(),
+             __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED));
+
+    t->fd = openat(t->dir_fd, t->temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (t->fd < 0) {
+        temp_close(t);
+        return -1;
+    }
+
+    // the fd stays open so a durable caller can fsync it
+    int rc = fchmod(t->fd, mode);
+    for (size_t pos = 0; rc == 0 && pos < len;) {
+        ssize_t n = write(t->fd, (const char *) data + pos, len - pos);
+        if (n < 0) {
+            rc = -1;
+            break;
+        }
+        pos += (size_t) n;
+    }
+
+    if (rc != 0) {
+        fs_temp_abort(t);
+    }
+    return rc;
+}
+
+int fs_temp_rename(fs_temp_t *t) {
+    if (temp_finish(t) != 0 || renameat(t->dir_fd, t->temp, t->dir_fd, t->name) != 0) {
+        fs_temp_abort(t);
+        return -1;
+    }
+    return 0;
+}
+
+int fs_temp_commit(fs_temp_t *t, struct stat *st) {
+    if (fs_temp_rename(t) != 0) {
+        return -1;
+    }
+
+    int rc = st ? fstatat(t->dir_fd, t->name, st, 0) : 0;
+    temp_close(t);
+    return rc;
+}
+
+int fs_temp_sync(fs_temp_t *t) {
+    if (fsync(t->fd) != 0) {
+        fs_temp_abort(t);
+        return -1;
+    }
+    return 0;
+}
+
+int fs_temp_sync_dir(const fs_temp_t *t) {
+    return fsync(t->dir_fd);
+}
+
+int fs_temp_same_dir(const fs_temp_t *a, const fs_temp_t *b) {
+    struct stat sa, sb;
+    return fstat(a->dir_fd, &sa) == 0 && fstat(b->dir_fd, &sb) == 0 && sa.st_dev == sb.st_dev &&
+           sa.st_ino == sb.st_ino;
+}
+
+void fs_temp_close(fs_temp_t *t) {
+    if (t->dir_fd >= 0) {
+        temp_close(t);
+    }
+}
+
+void fs_temp_abort(fs_temp_t *t) {
+    if (t->dir_fd < 0) {
+        return;
+    }
+    int saved = errno;
+    unlinkat(t->dir_fd, t->temp, 0);
+    errno = saved;
+    temp_close(t);
+}
+
+int fs_write_atomic(const char *project, const char *path, const void *data, size_t len, struct stat *st) {
+    fs_temp_t t;
+    if (fs_temp_write(project, path, data, len, &t) != 0) {
+        return -1;
+    }
+    return fs_temp_commit(&t, st);
+}
+
+int fs_create_project(const char *project) {
+    if (!fs_valid_name(project) || root_fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (mkdirat(root_fd, project, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+void fs_forget_project(const char *project) {
+    project_dir_t *d = NULL;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < projects_count; i++) {
+        if (strcmp(projects[i]->name, project) == 0) {
+            d = projects[i];
+            projects[i] = projects[--projects_count];
+            // whoever still holds it closes it
+            d->detached = 1;
+            d->refs++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    if (d) {
+        project_dir_put(d);
+    }
+}
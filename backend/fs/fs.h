@@ -0,0 +1,73 @@
+#ifndef NORA_C_FS_H
+#define NORA_C_FS_H
+
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define FS_MAX_PROJECTS 128
+#define FS_TEMP_PREFIX ".nora-"
+#define FS_TEMP_SUFFIX ".tmp"
+
+/*
+ Workspace access relative to directory fds. The workspace root (--root) is
+ resolved and opened once, every project directory is opened once on first
+ use, and files are opened relative to that fd, so the kernel does not walk
+ the full path again on each call.
+ Project names are single path components and paths inside a project may not
+ contain "." or ".." components; where the kernel has openat2, RESOLVE_BENEATH
+ also keeps symlinks from leading out of the project.
+ A path of "" (or NULL) is the project directory itself.
+ Safe to use from any thread.
+ */
+
+int fs_init(const char *root);
+void fs_free(void);
+const char *fs_root(void);
+
+int fs_valid_name(const char *name);
+int fs_valid_path(const char *path);
+
+int fs_open(const char *project, const char *path, int flags, mode_t mode);
+FILE *fs_fopen(const char *project, const char *path, const char *mode);
+DIR *fs_opendir(const char *project, const char *path);
+int fs_stat(const char *project, const char *path, struct stat *st);
+int fs_mkdir(const char *project, const char *path);
+int fs_remove(const char *project, const char *path);
+
+/*
+ Replacing a file: the new content goes to a temp file next to it, which is then
+ renamed over the target, so a crash leaves either the old or the new version.
+ Neither step syncs. Durable callers fs_temp_sync() the temp file before the
+ rename, then fs_temp_rename(), fs_temp_sync_dir() and fs_temp_close().
+ */
+typedef struct {
+    int dir_fd;
+    int fd; // the temp file, open between fs_temp_write and the rename
+    char name[256];
+    char temp[64];
+} fs_temp_t;
+
+int fs_temp_write(const char *project, const char *path, const void *data, size_t len, fs_temp_t *t);
+int fs_temp_commit(fs_temp_t *t, struct stat *st);
+void fs_temp_abort(fs_temp_t *t);
+int fs_write_atomic(const char *project, const char *path, const void *data, size_t len, struct stat *st);
+
+// fsync of the temp file's data; aborts the temp on failure
+int fs_temp_sync(fs_temp_t *t);
+// The rename of fs_temp_commit, keeping the directory open for fs_temp_sync_dir; aborts on failure
+int fs_temp_rename(fs_temp_t *t);
+// fsync of the directory holding the file, which makes the rename durable
+int fs_temp_sync_dir(const fs_temp_t *t);
+// True when both files are in the same directory, so one fs_temp_sync_dir covers them
+int fs_temp_same_dir(const fs_temp_t *a, const fs_temp_t *b);
+void fs_temp_close(fs_temp_t *t);
+
+// Leftover or in-flight temp files, hidden from listings
+int fs_is_temp(const char *name);
+
+int fs_create_project(const char *project);
+void fs_forget_project(const char *project);
+
+#endif //NORA_C_FS_H
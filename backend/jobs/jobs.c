@@ -0,0 +1,478 @@
+#include "jobs.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/utils.h"
+#include "../session/session.h"
+#include "../metrics/metrics.h"
+
+#define JOBS_FLUSH_BATCH 64
+
+typedef struct {
+    int refs; // __atomic, the ring holds one and each view being written another
+    ws_msg_type_t type;
+    char text[];
+} job_msg_t;
+
+struct job {
+    char name[JOB_ID_LEN];
+    char label[512];
+    job_fn_t fn;
+    void *ctx;
+    void (*ctx_free)(void *);
+    int cancelled; // __atomic
+
+    // under lock
+    job_msg_t *ring[JOB_RING_SIZE];
+    uint64_t head; // sequence number of the next message
+    int done;
+
+    // backend thread only
+    int viewers;
+    struct job *next;
+};
+
+struct job_view {
+    char id[JOB_ID_LEN]; // what this connection's messages of the run are tagged with
+    job_t *job;
+    uint64_t cursor;
+    struct job_view *next;
+};
+
+static struct mg_mgr *jobs_mgr = NULL;
+static unsigned long wakeup_id = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static int threads = 0; // under lock
+static int wake = 0; // __atomic, a wakeup is on its way
+
+// backend thread only
+static job_t *jobs = NULL; // newest first
+static int running_count = 0;
+static unsigned long next_run = 0;
+
+static void msg_unref(job_msg_t *m) {
+    if (m && __atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(m);
+    }
+}
+
+static void job_destroy(job_t *job) {
+    for (int i = 0; i < JOB_RING_SIZE; i++) {
+        msg_unref(job->ring[i]);
+    }
+    free(job);
+}
+
+static int job_done(job_t *job) {
+    pthread_mutex_lock(&lock);
+    int done = job->done;
+    pthread_mutex_unlock(&lock);
+    return done;
+}
+
+// A wakeup makes mg_mgr_poll() return, and jobs_tick() runs right after it.
+// Without the pipe connection the output waits for the poll timeout instead.
+static void wake_backend(void) {
+    if (wakeup_id != 0 && !__atomic_exchange_n(&wake, 1, __ATOMIC_ACQ_REL)) {
+        mg_wakeup(jobs_mgr, wakeup_id, "j", 1);
+    }
+}
+
+static void *job_thread(void *arg) {
+    job_t *job = (job_t *) arg;
+    uint64_t start = metrics_now_us();
+    job->fn(job, job->ctx);
+    metrics_run(metrics_now_us() - start);
+    if (job->ctx_free) {
+        job->ctx_free(job->ctx);
+    }
+
+    // once done is set the backend thread may free the job
+    pthread_mutex_lock(&lock);
+    job->done = 1;
+    pthread_mutex_unlock(&lock);
+    wake_backend();
+
+    pthread_mutex_lock(&lock);
+    if (--threads == 0) {
+        pthread_cond_broadcast(&idle);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+void jobs_init(struct mg_mgr *mgr, unsigned long pipe_id) {
+    jobs_mgr = mgr;
+    wakeup_id = pipe_id;
+}
+
+void jobs_free(void) {
+    for (job_t *job = jobs; job; job = job->next) {
+        __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&lock);
+    while (threads > 0) {
+        pthread_cond_wait(&idle, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    while (jobs) {
+        job_t *next = jobs->next;
+        job_destroy(jobs);
+        jobs = next;
+    }
+    running_count = 0;
+}
+
+static void send_run(struct mg_connection *c, const char *id, const char *type, job_t *job, const char *what) {
+    // what is one of the short verbs below
+    char message[32 + sizeof(job->name) + sizeof(job->label)];
+    snprintf(message, sizeof(message), "%s %s (%s)", what, job->name, job->label);
+
+    struct mg_iobuf json = {.align = 256};
+    mg_iobuf_add(&json, json.len, "{\"id\":", 6);
+    json_append_string(&json, id, strlen(id));
+    mg_xprintf(mg_pfn_iobuf, &json, ",\"type\":\"%s\",\"run\":", type);
+    json_append_string(&json, job->name, strlen(job->name));
+    mg_iobuf_add(&json, json.len, ",\"message\":", 11);
+    json_append_string(&json, message, strlen(message));
+    mg_iobuf_add(&json, json.len, "}", 1);
+    ws_send_json(c, (char *) json.buf, json.len);
+    mg_iobuf_free(&json);
+}
+
+static void view_free(ws_session_t *s, job_view_t *v) {
+    job_t *job = v->job;
+    if (--job->viewers == 0 && !job_done(job)) {
+        DEBUG("Run %s has no viewers left, cancelling it", job->name);
+        __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+    }
+    s->count--;
+    free(v);
+}
+
+void jobs_session_close(ws_session_t *s) {
+    while (s->views) {
+        job_view_t *next = s->views->next;
+        view_free(s, s->views);
+        s->views = next;
+    }
+}
+
+static job_view_t *view_find(ws_session_t *s, const char *id) {
+    for (job_view_t *v = s->views; v; v = v->next) {
+        if (strcmp(v->id, id) == 0) {
+            return v;
+        }
+    }
+    return NULL;
+}
+
+static job_t *run_find(const char *name) {
+    for (job_t *job = jobs; job; job = job->next) {
+        if (strcmp(job->name, name) == 0) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// NULL after replying with the reason when c can not take another view
+static job_view_t *view_new(struct mg_connection *c, const char *id) {
+    ws_session_t *s = (ws_session_t *) c->fn_data;
+    const char *error = NULL;
+    job_view_t *v = NULL;
+
+    if (!s) {
+        error = "Jobs are not available on this connection";
+    } else if (s->count >= JOBS_MAX_PER_SESSION) {
+        error = "Too many jobs on this connection";
+    } else if (id && *id && view_find(s, id)) {
+        error = "A job with this id is already running";
+    } else if (!(v = calloc(1, sizeof(job_view_t)))) {
+        error = "Failed to start the job";
+    }
+    if (error) {
+        ws_response_id(c, id, WS_ERROR, error);
+        return NULL;
+    }
+
+    if (id && *id) {
+        snprintf(v->id, sizeof(v->id), "%s", id);
+    } else {
+        snprintf(v->id, sizeof(v->id), "job-%lu", ++s->next_id);
+    }
+    return v;
+}
+
+static void view_link(struct mg_connection *c, job_view_t *v, job_t *job) {
+    ws_session_t *s = (ws_session_t *) c->fn_data;
+    v->job = job;
+    v->next = s->views;
+    s->views = v;
+    s->count++;
+    job->viewers++;
+}
+
+int job_start(struct mg_connection *c, const char *id, const char *label, job_fn_t fn, void *ctx,
+              void (*ctx_free)(void *)) {
+    job_view_t *v = view_new(c, id);
+    job_t *job = NULL;
+    if (v && running_count >= JOBS_MAX_RUNNING) {
+        ws_response_id(c, v->id, WS_ERROR, "Too many runs in progress, try again later");
+    } else if (v && !(job = calloc(1, sizeof(job_t)))) {
+        ws_response_id(c, v->id, WS_ERROR, "Failed to start the job");
+    }
+    if (!job) {
+        free(v);
+        if (ctx_free) {
+            ctx_free(ctx);
+        }
+        return -1;
+    }
+
+    snprintf(job->name, sizeof(job->name), "run-%lu", ++next_run);
+    snprintf(job->label, sizeof(job->label), "%s", label ? label : "");
+    job->fn = fn;
+    job->ctx = ctx;
+    job->ctx_free = ctx_free;
+
+    pthread_attr_t attr;
+    pthread_t tid;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_mutex_lock(&lock);
+    threads++;
+    int r = pthread_create(&tid, &attr, job_thread, job);
+    if (r != 0) {
+        threads--;
+    }
+    pthread_mutex_unlock(&lock);
+    pthread_attr_destroy(&attr);
+
+    if (r != 0) {
+        WARNING("Failed to create a job thread: %s", strerror(r));
+        ws_response_id(c, v->id, WS_ERROR, "Failed to start the job");
+        free(v);
+        if (ctx_free) {
+            ctx_free(ctx);
+        }
+        job_destroy(job);
+        return -1;
+    }
+
+    job->next = jobs;
+    jobs = job;
+    running_count++;
+    view_link(c, v, job);
+    send_run(c, v->id, "started", job, "Started");
+    DEBUG("Started %s (%s) as %s on connection %lu", job->name, job->label, v->id, c->id);
+    return 0;
+}
+
+int job_attach(struct mg_connection *c, const char *id, struct mg_str content) {
+    char name[JOB_ID_LEN];
+    if (json_get_str(content, "$.run", name, sizeof(name)) <= 0) {
+        ws_response_id(c, id, WS_ERROR, "Missing or invalid 'run' field");
+        return -1;
+    }
+    job_t *job = run_find(name);
+    if (!job) {
+        ws_response_id(c, id, WS_ERROR, "No run with this name");
+        return -1;
+    }
+
+    job_view_t *v = view_new(c, id);
+    if (!v) {
+        return -1;
+    }
+    // the backlog starts at the oldest message still in the ring
+    pthread_mutex_lock(&lock);
+    v->cursor = job->head > JOB_RING_SIZE ? job->head - JOB_RING_SIZE : 0;
+    pthread_mutex_unlock(&lock);
+    view_link(c, v, job);
+    send_run(c, v->id, "attached", job, "Attached to");
+    DEBUG("Connection %lu attached to %s as %s", c->id, job->name, v->id);
+    return 0;
+}
+
+int job_detach(struct mg_connection *c, const char *id) {
+    ws_session_t *s = (ws_session_t *) c->fn_data;
+    for (job_view_t **link = s ? &s->views : NULL; link && *link; link = &(*link)->next) {
+        if (strcmp((*link)->id, id) == 0) {
+            job_view_t *v = *link;
+            *link = v->next;
+            view_free(s, v);
+            ws_response_id(c, id, WS_END, "Detached");
+            return 0;
+        }
+    }
+    ws_response_id(c, id, WS_ERROR, "No running job with this id");
+    return -1;
+}
+
+int job_cancel(struct mg_connection *c, const char *id) {
+    ws_session_t *s = (ws_session_t *) c->fn_data;
+    job_view_t *v = s && id ? view_find(s, id) : NULL;
+    if (!v) {
+        ws_response_id(c, id, WS_ERROR, "No running job with this id");
+        return -1;
+    }
+
+    __atomic_store_n(&v->job->cancelled, 1, __ATOMIC_RELAXED);
+    ws_response_id(c, id, WS_SYSTEM, "Cancelling");
+    return 0;
+}
+
+void jobs_list(struct mg_connection *c, const char *id) {
+    struct mg_iobuf json = {.align = 1024};
+    mg_iobuf_add(&json, json.len, "{", 1);
+    if (id && *id) {
+        mg_iobuf_add(&json, json.len, "\"id\":", 5);
+        json_append_string(&json, id, strlen(id));
+        mg_iobuf_add(&json, json.len, ",", 1);
+    }
+    mg_iobuf_add(&json, json.len, "\"type\":\"runs\",\"runs\":[", 22);
+    for (job_t *job = jobs; job; job = job->next) {
+        mg_iobuf_add(&json, json.len, "{\"run\":", 7);
+        json_append_string(&json, job->name, strlen(job->name));
+        mg_iobuf_add(&json, json.len, ",\"label\":", 9);
+        json_append_string(&json, job->label, strlen(job->label));
+        mg_xprintf(mg_pfn_iobuf, &json, ",\"running\":%s,\"viewers\":%d}%s", job_done(job) ? "false" : "true",
+                   job->viewers, job->next ? "," : "");
+    }
+    mg_iobuf_add(&json, json.len, "]}", 2);
+    ws_send_json(c, (char *) json.buf, json.len);
+    mg_iobuf_free(&json);
+}
+
+int jobs_running(void) {
+    return running_count;
+}
+
+// 1 once the view has everything and the run is over
+static int view_flush(struct mg_connection *c, job_view_t *v) {
+    job_t *job = v->job;
+    job_msg_t *batch[JOBS_FLUSH_BATCH];
+    int done = 0;
+
+    while (!done && c->send.len < JOBS_VIEWER_MAX_BUFFERED) {
+        int n = 0;
+        uint64_t skipped = 0;
+
+        pthread_mutex_lock(&lock);
+        uint64_t oldest = job->head > JOB_RING_SIZE ? job->head - JOB_RING_SIZE : 0;
+        if (v->cursor < oldest) {
+            skipped = oldest - v->cursor;
+            v->cursor = oldest;
+        }
+        while (v->cursor < job->head && n < JOBS_FLUSH_BATCH) {
+            job_msg_t *m = job->ring[v->cursor++ % JOB_RING_SIZE];
+            __atomic_add_fetch(&m->refs, 1, __ATOMIC_RELAXED);
+            batch[n++] = m;
+        }
+        done = job->done && v->cursor == job->head;
+        pthread_mutex_unlock(&lock);
+
+        if (skipped > 0) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "%" PRIu64 " messages were skipped, this viewer fell behind", skipped);
+            ws_response_id(c, v->id, WS_WARNING, msg);
+        }
+        for (int i = 0; i < n; i++) {
+            ws_response_id(c, v->id, batch[i]->type, batch[i]->text);
+            msg_unref(batch[i]);
+        }
+        if (n == 0) {
+            break;
+        }
+    }
+    return done;
+}
+
+static void session_flush(struct mg_connection *c, ws_session_t *s) {
+    job_view_t **link = &s->views;
+    while (*link) {
+        job_view_t *v = *link;
+        if (!view_flush(c, v)) {
+            link = &v->next;
+            continue;
+        }
+
+        ws_response_id(c, v->id, WS_END, job_cancelled(v->job) ? "Cancelled" : "Finished");
+        DEBUG("View %s of %s on connection %lu ended", v->id, v->job->name, c->id);
+        *link = v->next;
+        view_free(s, v);
+    }
+}
+
+// Finished runs nobody watches are kept for late joiners, up to JOBS_MAX_FINISHED
+static void jobs_collect(void) {
+    int finished = 0, running = 0;
+    job_t **link = &jobs;
+    while (*link) {
+        job_t *job = *link;
+        if (!job_done(job)) {
+            running++;
+        } else if (++finished > JOBS_MAX_FINISHED && job->viewers == 0) {
+            *link = job->next;
+            job_destroy(job);
+            continue;
+        }
+        link = &job->next;
+    }
+    running_count = running;
+}
+
+void jobs_tick(void) {
+    __atomic_store_n(&wake, 0, __ATOMIC_RELEASE);
+    if (!jobs) {
+        return;
+    }
+
+    for (struct mg_connection *c = jobs_mgr ? jobs_mgr->conns : NULL; c; c = c->next) {
+        ws_session_t *s = (ws_session_t *) c->fn_data;
+        if (c->is_websocket && s && s->views && !c->is_closing) {
+            session_flush(c, s);
+        }
+    }
+    jobs_collect();
+}
+
+void job_send(job_t *job, ws_msg_type_t type, const char *message) {
+    message = message ? message : "";
+    size_t len = strlen(message);
+    job_msg_t *m = malloc(sizeof(job_msg_t) + len + 1);
+    if (!m) {
+        return;
+    }
+    m->refs = 1;
+    m->type = type;
+    memcpy(m->text, message, len + 1);
+
+    // the oldest message makes room, whoever has not read it yet skips it
+    pthread_mutex_lock(&lock);
+    job_msg_t **slot = &job->ring[job->head % JOB_RING_SIZE];
+    job_msg_t *old = *slot;
+    *slot = m;
+    job->head++;
+    pthread_mutex_unlock(&lock);
+
+    msg_unref(old);
+    wake_backend();
+}
+
+int job_cancelled(job_t *job) {
+    return __atomic_load_n(&job->cancelled, __ATOMIC_RELAXED);
+}
+
+const char *job_name(job_t *job) {
+    return job->name;
+}
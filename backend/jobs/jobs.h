@@ -0,0 +1,66 @@
+#ifndef NORA_C_JOBS_H
+#define NORA_C_JOBS_H
+
+#include "../../lib/Mongoose/mongoose.h"
+#include "../backend.h"
+#include "../session/session.h"
+
+/*
+ Concurrent jobs over /ws. Every inbound message may carry an "id"; the
+ replies to it, and everything a job started by it sends, carry the same
+ "id", so one socket can hold several runs, cancellations and subscriptions
+ at once. A request without an id gets "job-N".
+
+ Each job runs on its own thread as a shared run named "run-N". What it sends
+ with job_send() is kept once, in the run's ring of the last JOB_RING_SIZE
+ messages, and never waits for a reader. Connections watch runs through views
+ (the starter gets one, others {"type":"attach","run":...}); a view replays
+ the ring from where it is and then follows the live tail. The backend thread
+ writes to each view in jobs_tick(), holding back while that connection has
+ JOBS_VIEWER_MAX_BUFFERED unsent, so a slow viewer skips ahead instead of
+ holding anyone up. When the run is over, an "end" message closes each view.
+ A run whose last viewer leaves is cancelled; finished runs stay attachable
+ until JOBS_MAX_FINISHED newer ones have ended.
+
+ Views belong to the connection's session (session/session.h), so they outlive
+ a dropped socket until the session is resumed or given up.
+ */
+
+#define JOBS_MAX_PER_SESSION 8
+#define JOBS_MAX_RUNNING 16
+#define JOBS_MAX_FINISHED 8
+#define JOB_RING_SIZE 1024
+#define JOBS_VIEWER_MAX_BUFFERED (256 * 1024)
+#define JOB_ID_LEN 64
+
+typedef struct job job_t;
+typedef void (*job_fn_t)(job_t *job, void *ctx);
+
+// pipe_id is the connection of mg_wakeup_init()'s pipe, woken when there is output; 0 if there is none
+void jobs_init(struct mg_mgr *mgr, unsigned long pipe_id);
+// Cancels every job and waits for their threads, after session_free_all() and before the manager is freed
+void jobs_free(void);
+
+// Drops the views of a session that ends
+void jobs_session_close(ws_session_t *s);
+
+// Runs fn(job, ctx) on a new thread, ctx_free(ctx) afterwards; replies with an error and returns -1 if it can not
+int job_start(struct mg_connection *c, const char *id, const char *label, job_fn_t fn, void *ctx,
+              void (*ctx_free)(void *));
+int job_attach(struct mg_connection *c, const char *id, struct mg_str content);
+int job_detach(struct mg_connection *c, const char *id);
+int job_cancel(struct mg_connection *c, const char *id);
+// Replies {"type":"runs","runs":[{"run","label","running","viewers"}]}
+void jobs_list(struct mg_connection *c, const char *id);
+
+int jobs_running(void);
+
+// Writes what the views are missing, once per loop iteration
+void jobs_tick(void);
+
+// Job side, safe from the job's thread
+void job_send(job_t *job, ws_msg_type_t type, const char *message);
+int job_cancelled(job_t *job);
+const char *job_name(job_t *job);
+
+#endif //NORA_C_JOBS_H
@@ -0,0 +1,226 @@
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../../webDriver/src/utils/utils.h"
+#include "../backend.h"
+#include "../jobs/jobs.h"
+
+// Upper bounds of each kind's buckets, in its base unit, 0 terminated
+static const uint64_t bounds[METRICS_KINDS][METRICS_MAX_BUCKETS + 1] = {
+    [METRICS_DURATION] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+                          1000000, 2500000, 0},
+    [METRICS_SIZE] = {64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216, 0},
+    [METRICS_RUN] = {1000, 10000, 100000, 500000, 1000000, 5000000, 10000000, 30000000, 60000000, 300000000,
+                     600000000, 0},
+};
+
+static histogram_t request_latency[METRICS_MAX_CONTROLLERS] = {[0 ... METRICS_MAX_CONTROLLERS - 1] = {.kind = METRICS_DURATION}};
+static histogram_t response_size[METRICS_MAX_CONTROLLERS] = {[0 ... METRICS_MAX_CONTROLLERS - 1] = {.kind = METRICS_SIZE}};
+static uint64_t ws_messages[2], ws_bytes[2]; // in, out
+static histogram_t run_duration = {.kind = METRICS_RUN};
+static histogram_t step_duration = {.kind = METRICS_RUN};
+static histogram_t loop_iteration = {.kind = METRICS_DURATION};
+static histogram_t loop_lag = {.kind = METRICS_DURATION};
+static uint64_t stall_budget_us, stalls, last_lag_us, max_lag_us;
+
+static void add(uint64_t *counter, uint64_t v) {
+    __atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+static uint64_t load(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+void histogram_observe(histogram_t *h, uint64_t v) {
+    const uint64_t *b = bounds[h->kind];
+    int i = 0;
+    while (b[i] != 0 && v > b[i]) {
+        i++;
+    }
+    add(&h->buckets[i], 1);
+    add(&h->count, 1);
+    add(&h->sum, v);
+}
+
+void metrics_request(int i, uint64_t us, size_t bytes) {
+    if (i < 0 || i >= METRICS_MAX_CONTROLLERS) {
+        return;
+    }
+    histogram_observe(&request_latency[i], us);
+    histogram_observe(&response_size[i], bytes);
+}
+
+void metrics_ws_in(size_t bytes) {
+    add(&ws_messages[0], 1);
+    add(&ws_bytes[0], bytes);
+}
+
+void metrics_ws_out(size_t bytes) {
+    add(&ws_messages[1], 1);
+    add(&ws_bytes[1], bytes);
+}
+
+void metrics_run(uint64_t us) {
+    histogram_observe(&run_duration, us);
+}
+
+void metrics_run_step(uint64_t us) {
+    histogram_observe(&step_duration, us);
+}
+
+void metrics_set_stall_budget(int ms) {
+    stall_budget_us = ms > 0 ? (uint64_t) ms * 1000 : 0;
+}
+
+void metrics_call(uint64_t us, struct mg_str method, struct mg_str uri, const char *handler) {
+    if (stall_budget_us == 0 || us <= stall_budget_us) {
+        return;
+    }
+    add(&stalls, 1);
+    WARNING("Slow handler: %.*s %.*s (%s) took %" PRIu64 " ms, the loop waited for it", (int) method.len,
+            method.buf, (int) uri.len, uri.buf, handler, us / 1000);
+}
+
+void metrics_loop(uint64_t us, uint64_t busy_us) {
+    uint64_t lag = busy_us < us ? busy_us : us;
+    histogram_observe(&loop_iteration, us);
+    histogram_observe(&loop_lag, lag);
+    __atomic_store_n(&last_lag_us, lag, __ATOMIC_RELAXED);
+    if (lag > load(&max_lag_us)) {
+        __atomic_store_n(&max_lag_us, lag, __ATOMIC_RELAXED);
+    }
+    if (stall_budget_us != 0 && lag > stall_budget_us) {
+        add(&stalls, 1);
+        WARNING("Event loop stalled: an iteration was busy for %" PRIu64 " ms", lag / 1000);
+    }
+}
+
+loop_stats_t metrics_loop_stats(void) {
+    return (loop_stats_t) {
+        .budget_ms = (int) (stall_budget_us / 1000),
+        .stalls = load(&stalls),
+        .last_lag_us = load(&last_lag_us),
+        .max_lag_us = load(&max_lag_us),
+    };
+}
+
+static void header(struct mg_iobuf *out, const char *name, const char *type, const char *help) {
+    mg_xprintf(mg_pfn_iobuf, out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Seconds for the microsecond kinds, the value itself for sizes
+static void format_value(char *buf, size_t len, metrics_kind_t kind, uint64_t v) {
+    if (kind == METRICS_SIZE) {
+        snprintf(buf, len, "%" PRIu64, v);
+    } else {
+        snprintf(buf, len, "%" PRIu64 ".%06" PRIu64, v / 1000000, v % 1000000);
+    }
+}
+
+static void histogram_write(struct mg_iobuf *out, const char *name, const char *labels, const histogram_t *h) {
+    const uint64_t *b = bounds[h->kind];
+    const char *sep = *labels ? "," : "";
+    char value[32];
+    uint64_t cumulative = 0;
+    int i = 0;
+    for (; b[i] != 0; i++) {
+        cumulative += load(&h->buckets[i]);
+        if (h->kind == METRICS_SIZE) {
+            snprintf(value, sizeof(value), "%" PRIu64, b[i]);
+        } else {
+            snprintf(value, sizeof(value), "%g", (double) b[i] / 1e6);
+        }
+        mg_xprintf(mg_pfn_iobuf, out, "%s_bucket{%s%sle=\"%s\"} %" PRIu64 "\n", name, labels, sep, value, cumulative);
+    }
+    cumulative += load(&h->buckets[i]);
+    mg_xprintf(mg_pfn_iobuf, out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, sep, cumulative);
+
+    format_value(value, sizeof(value), h->kind, load(&h->sum));
+    const char *open = *labels ? "{" : "", *close = *labels ? "}" : "";
+    mg_xprintf(mg_pfn_iobuf, out, "%s_sum%s%s%s %s\n", name, open, labels, close, value);
+    mg_xprintf(mg_pfn_iobuf, out, "%s_count%s%s%s %" PRIu64 "\n", name, open, labels, close, load(&h->count));
+}
+
+static void controller_labels(char *buf, size_t len, int i) {
+    mg_snprintf(buf, len, "path=\"%s\",method=\"%s\"", controllers[i].path,
+                controllers[i].method == NORA_GET ? "GET" : "POST");
+}
+
+void metrics_connections(struct mg_mgr *mgr, unsigned long *http, unsigned long *ws, uint64_t *buffered) {
+    *http = *ws = 0;
+    *buffered = 0;
+    for (struct mg_connection *c = mgr->conns; c; c = c->next) {
+        if (!c->is_accepted) {
+            continue;
+        }
+        if (c->is_websocket) {
+            (*ws)++;
+        } else {
+            (*http)++;
+        }
+        *buffered += c->send.len;
+    }
+}
+
+void metrics_write(struct mg_iobuf *out, struct mg_mgr *mgr) {
+    char labels[256];
+
+    header(out, "nora_http_requests_total", "counter", "HTTP requests answered, by route");
+    for (int i = 0; i < METRICS_MAX_CONTROLLERS && controllers[i].path != NULL; i++) {
+        controller_labels(labels, sizeof(labels), i);
+        mg_xprintf(mg_pfn_iobuf, out, "nora_http_requests_total{%s} %" PRIu64 "\n", labels,
+                   load(&request_latency[i].count));
+    }
+
+    header(out, "nora_http_request_duration_seconds", "histogram",
+           "Time spent in the route handler (durable saves are answered later and not included)");
+    for (int i = 0; i < METRICS_MAX_CONTROLLERS && controllers[i].path != NULL; i++) {
+        controller_labels(labels, sizeof(labels), i);
+        histogram_write(out, "nora_http_request_duration_seconds", labels, &request_latency[i]);
+    }
+
+    header(out, "nora_http_response_size_bytes", "histogram", "Bytes queued by the route handler, headers included");
+    for (int i = 0; i < METRICS_MAX_CONTROLLERS && controllers[i].path != NULL; i++) {
+        controller_labels(labels, sizeof(labels), i);
+        histogram_write(out, "nora_http_response_size_bytes", labels, &response_size[i]);
+    }
+
+    unsigned long http, ws;
+    uint64_t buffered;
+    metrics_connections(mgr, &http, &ws, &buffered);
+    header(out, "nora_connections", "gauge", "Open client connections");
+    mg_xprintf(mg_pfn_iobuf, out, "nora_connections{protocol=\"http\"} %lu\n", http);
+    mg_xprintf(mg_pfn_iobuf, out, "nora_connections{protocol=\"ws\"} %lu\n", ws);
+    header(out, "nora_send_buffered_bytes", "gauge", "Bytes waiting in connection send buffers");
+    mg_xprintf(mg_pfn_iobuf, out, "nora_send_buffered_bytes %" PRIu64 "\n", buffered);
+
+    header(out, "nora_ws_messages_total", "counter", "WebSocket messages");
+    mg_xprintf(mg_pfn_iobuf, out, "nora_ws_messages_total{direction=\"in\"} %" PRIu64 "\n", load(&ws_messages[0]));
+    mg_xprintf(mg_pfn_iobuf, out, "nora_ws_messages_total{direction=\"out\"} %" PRIu64 "\n", load(&ws_messages[1]));
+    header(out, "nora_ws_message_bytes_total", "counter", "WebSocket message payload bytes, before compression");
+    mg_xprintf(mg_pfn_iobuf, out, "nora_ws_message_bytes_total{direction=\"in\"} %" PRIu64 "\n", load(&ws_bytes[0]));
+    mg_xprintf(mg_pfn_iobuf, out, "nora_ws_message_bytes_total{direction=\"out\"} %" PRIu64 "\n", load(&ws_bytes[1]));
+
+    header(out, "nora_runs_running", "gauge", "Runs in progress, the run queue depth");
+    mg_xprintf(mg_pfn_iobuf, out, "nora_runs_running %d\n", jobs_running());
+    header(out, "nora_run_duration_seconds", "histogram", "Run durations, from start to end or cancel");
+    histogram_write(out, "nora_run_duration_seconds", "", &run_duration);
+    header(out, "nora_run_step_duration_seconds", "histogram", "Time to match one C file against the scene");
+    histogram_write(out, "nora_run_step_duration_seconds", "", &step_duration);
+
+    header(out, "nora_loop_iteration_seconds", "histogram", "Backend loop iterations, poll wait included");
+    histogram_write(out, "nora_loop_iteration_seconds", "", &loop_iteration);
+    header(out, "nora_loop_lag_seconds", "histogram", "Time each loop iteration spent after its poll wait, in handlers and ticks");
+    histogram_write(out, "nora_loop_lag_seconds", "", &loop_lag);
+    header(out, "nora_loop_stalls_total", "counter", "Handler calls and loop iterations over the stall budget");
+    mg_xprintf(mg_pfn_iobuf, out, "nora_loop_stalls_total %" PRIu64 "\n", load(&stalls));
+}
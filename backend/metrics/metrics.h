@@ -0,0 +1,72 @@
+#ifndef NORA_C_METRICS_H
+#define NORA_C_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+
+/*
+ Counters and histograms behind GET /metrics (Prometheus text format). Recording
+ is a few relaxed atomic adds, so it is safe and cheap from any thread, job
+ threads included; the scrape reads them without stopping anyone, so a sample
+ may be a moment out of step with its neighbours. Durations are kept in
+ microseconds and sizes in bytes, and exported in seconds and bytes.
+ */
+
+#define METRICS_MAX_CONTROLLERS 32
+
+typedef enum {
+    METRICS_DURATION, // request latency, microseconds
+    METRICS_SIZE,     // bytes
+    METRICS_RUN,      // run and step durations, microseconds
+    METRICS_KINDS
+} metrics_kind_t;
+
+#define METRICS_MAX_BUCKETS 16
+
+typedef struct {
+    metrics_kind_t kind;
+    uint64_t buckets[METRICS_MAX_BUCKETS + 1]; // per bucket, not cumulative; the last one is +Inf
+    uint64_t count;
+    uint64_t sum;
+} histogram_t;
+
+uint64_t metrics_now_us(void);
+void histogram_observe(histogram_t *h, uint64_t v);
+
+// Controller i answered a request in us microseconds with bytes of response
+void metrics_request(int i, uint64_t us, size_t bytes);
+void metrics_ws_in(size_t bytes);
+void metrics_ws_out(size_t bytes);
+void metrics_run(uint64_t us);
+void metrics_run_step(uint64_t us);
+
+/*
+ Stall monitor. Handlers run inline on the backend thread, so a slow one holds
+ up every client. Each loop iteration is timed; its lag is the time it spent
+ after the poll wait ended, in handlers and ticks, during which nothing new is
+ picked up. Handler calls and iterations whose lag is over the stall budget
+ (--stall, 0 turns the logging off) are logged and counted.
+ */
+typedef struct {
+    int budget_ms;
+    uint64_t stalls;
+    uint64_t last_lag_us;
+    uint64_t max_lag_us;
+} loop_stats_t;
+
+void metrics_set_stall_budget(int ms);
+// A handler call on the backend thread, logged with its method, URI and handler when over budget
+void metrics_call(uint64_t us, struct mg_str method, struct mg_str uri, const char *handler);
+// One loop iteration that took us, of which busy_us after the poll wait
+void metrics_loop(uint64_t us, uint64_t busy_us);
+loop_stats_t metrics_loop_stats(void);
+
+// Open client connections of mgr, and the bytes waiting in their send buffers
+void metrics_connections(struct mg_mgr *mgr, unsigned long *http, unsigned long *ws, uint64_t *buffered);
+
+// Appends every metric in the text exposition format, with the connection gauges of mgr
+void metrics_write(struct mg_iobuf *out, struct mg_mgr *mgr);
+
+#endif //NORA_C_METRICS_H
@@ -0,0 +1,244 @@
+#include "session.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../webDriver/src/utils/utils.h"
+#include "../utils/utils.h"
+#include "../utils/msgpack.h"
+#include "../utils/ws_deflate.h"
+#include "../jobs/jobs.h"
+
+struct session_msg {
+    int op;
+    size_t len;
+    char data[];
+};
+
+static ws_session_t *sessions = NULL;
+
+static session_msg_t **replay_slot(ws_session_t *s, uint64_t seq) {
+    return &s->replay[seq % SESSION_REPLAY_MESSAGES];
+}
+
+static void replay_drop_oldest(ws_session_t *s) {
+    session_msg_t **slot = replay_slot(s, s->first);
+    if (*slot) {
+        s->replay_bytes -= (*slot)->len;
+        free(*slot);
+        *slot = NULL;
+    }
+    s->first++;
+}
+
+static void replay_keep(ws_session_t *s, const void *buf, size_t len, int op) {
+    if (len > SESSION_REPLAY_BYTES) {
+        // too big to keep, a resume past it reports the gap
+        while (s->first <= s->seq) {
+            replay_drop_oldest(s);
+        }
+        return;
+    }
+    while (s->first <= s->seq && (s->seq - s->first >= SESSION_REPLAY_MESSAGES ||
+                                  s->replay_bytes + len > SESSION_REPLAY_BYTES)) {
+        replay_drop_oldest(s);
+    }
+
+    session_msg_t *m = malloc(sizeof(session_msg_t) + len);
+    if (!m) {
+        while (s->first <= s->seq) {
+            replay_drop_oldest(s);
+        }
+        return;
+    }
+    m->op = op;
+    m->len = len;
+    memcpy(m->data, buf, len);
+    *replay_slot(s, s->seq) = m;
+    s->replay_bytes += len;
+}
+
+static void session_free(ws_session_t *s) {
+    jobs_session_close(s);
+    while (s->first <= s->seq) {
+        replay_drop_oldest(s);
+    }
+    for (ws_session_t **link = &sessions; *link; link = &(*link)->next) {
+        if (*link == s) {
+            *link = s->next;
+            break;
+        }
+    }
+    free(s);
+}
+
+void session_open(struct mg_connection *c) {
+    ws_session_t *s = calloc(1, sizeof(ws_session_t));
+    if (!s) {
+        WARNING("Failed to allocate the WebSocket session, jobs are refused");
+        return;
+    }
+
+    unsigned char random[(SESSION_TOKEN_LEN - 1) / 2];
+    mg_random(random, sizeof(random));
+    for (size_t i = 0; i < sizeof(random); i++) {
+        snprintf(s->token + 2 * i, 3, "%02x", random[i]);
+    }
+    s->protocol = c->data[WS_DATA_PROTOCOL];
+    s->c = c;
+    s->first = 1;
+    s->next = sessions;
+    sessions = s;
+    c->fn_data = s;
+}
+
+void session_close(struct mg_connection *c) {
+    ws_session_t *s = (ws_session_t *) c->fn_data;
+    if (!c->is_websocket || !s) {
+        return;
+    }
+    s->c = NULL;
+    s->detached_ms = mg_millis();
+    c->fn_data = NULL;
+    DEBUG("Session %s waits %d ms to be resumed", s->token, SESSION_RESUME_MS);
+}
+
+static ws_session_t *session_find(const char *token) {
+    for (ws_session_t *s = sessions; s; s = s->next) {
+        if (strcmp(s->token, token) == 0) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// Control messages are not numbered, they describe the numbering itself
+static void send_unnumbered(struct mg_connection *c, struct mg_iobuf *json) {
+    if (ws_is_binary(c)) {
+        struct mg_iobuf packed = {.align = 256};
+        if (mp_from_json(mg_str_n((char *) json->buf, json->len), &packed) == 0) {
+            ws_send(c, packed.buf, packed.len, WEBSOCKET_OP_BINARY);
+        }
+        mg_iobuf_free(&packed);
+        return;
+    }
+    ws_send(c, json->buf, json->len, WEBSOCKET_OP_TEXT);
+}
+
+static void send_session(struct mg_connection *c, const char *id, ws_session_t *s, int resumed) {
+    struct mg_iobuf json = {.align = 256};
+    mg_iobuf_add(&json, json.len, "{", 1);
+    if (id && *id) {
+        mg_iobuf_add(&json, json.len, "\"id\":", 5);
+        json_append_string(&json, id, strlen(id));
+        mg_iobuf_add(&json, json.len, ",", 1);
+    }
+    mg_xprintf(mg_pfn_iobuf, &json, "\"type\":\"session\",\"session\":\"%s\",\"resumed\":%s}", s->token,
+               resumed ? "true" : "false");
+    send_unnumbered(c, &json);
+    mg_iobuf_free(&json);
+}
+
+int session_resume(struct mg_connection *c, const char *id, struct mg_str content) {
+    ws_session_t *current = (ws_session_t *) c->fn_data;
+    if (!current) {
+        ws_response_id(c, id, WS_ERROR, "Sessions are not available on this connection");
+        return -1;
+    }
+
+    char token[SESSION_TOKEN_LEN];
+    ws_session_t *s = json_get_str(content, "$.session", token, sizeof(token)) > 0 ? session_find(token) : NULL;
+    long last = mg_json_get_long(content, "$.seq", 0);
+
+    // only a fresh connection can take a session over, and only in the protocol its copies are in
+    if (!s || s == current || s->protocol != current->protocol || current->views || current->seq > 0 ||
+        last < 0 || (uint64_t) last > s->seq) {
+        send_session(c, id, current, s == current);
+        return s == current ? 0 : -1;
+    }
+
+    if (s->c) {
+        // the old socket may not have noticed the drop yet
+        s->c->fn_data = NULL;
+        s->c->is_closing = 1;
+    }
+    session_free(current);
+    s->c = c;
+    c->fn_data = s;
+    send_session(c, id, s, 1);
+
+    uint64_t from = (uint64_t) last + 1;
+    if (from < s->first) {
+        struct mg_iobuf json = {.align = 256};
+        mg_xprintf(mg_pfn_iobuf, &json,
+                   "{\"type\":\"warning\",\"message\":\"%" PRIu64 " messages could not be replayed\"}",
+                   s->first - from);
+        send_unnumbered(c, &json);
+        mg_iobuf_free(&json);
+        from = s->first;
+    }
+    for (uint64_t seq = from; seq <= s->seq; seq++) {
+        session_msg_t *m = *replay_slot(s, seq);
+        if (m) {
+            ws_send(c, m->data, m->len, m->op);
+        }
+    }
+    DEBUG("Session %s resumed on connection %lu, replayed from %" PRIu64 " to %" PRIu64,
+          s->token, c->id, from, s->seq);
+    return 0;
+}
+
+void session_send(struct mg_connection *c, const void *buf, size_t len, int op) {
+    ws_session_t *s = (ws_session_t *) c->fn_data;
+    const char *p = (const char *) buf;
+    struct mg_iobuf numbered = {.align = 256};
+    int ok;
+
+    if (!s) {
+        ws_send(c, buf, len, op);
+        return;
+    }
+    if (op == WEBSOCKET_OP_BINARY) {
+        ok = mp_map_prepend_int(mg_str_n(p, len), "seq", (int64_t) s->seq + 1, &numbered) == 0;
+    } else {
+        ok = len >= 2 && p[0] == '{';
+        if (ok) {
+            mg_xprintf(mg_pfn_iobuf, &numbered, "{\"seq\":%" PRIu64 "%s", s->seq + 1, p[1] == '}' ? "" : ",");
+            mg_iobuf_add(&numbered, numbered.len, p + 1, len - 1);
+        }
+    }
+    if (!ok) {
+        mg_iobuf_free(&numbered);
+        ws_send(c, buf, len, op);
+        return;
+    }
+
+    s->seq++;
+    replay_keep(s, numbered.buf, numbered.len, op);
+    ws_send(c, numbered.buf, numbered.len, op);
+    mg_iobuf_free(&numbered);
+}
+
+void session_tick(void) {
+    uint64_t now = mg_millis();
+    ws_session_t *s = sessions;
+    while (s) {
+        ws_session_t *next = s->next;
+        if (!s->c && now - s->detached_ms >= SESSION_RESUME_MS) {
+            DEBUG("Session %s was not resumed, ending it", s->token);
+            session_free(s);
+        }
+        s = next;
+    }
+}
+
+void session_free_all(void) {
+    while (sessions) {
+        if (sessions->c) {
+            sessions->c->fn_data = NULL;
+        }
+        session_free(sessions);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef NORA_C_SESSION_H
+#define NORA_C_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+
+/*
+ Resumable /ws sessions. Every JSON object or MessagePack map sent over /ws
+ through session_send() gets a "seq", counting up from 1 per session, and a
+ copy is kept in the session's replay buffer (the last SESSION_REPLAY_MESSAGES,
+ at most SESSION_REPLAY_BYTES). When the socket drops, the session, with its
+ jobs, waits SESSION_RESUME_MS for the client to come back.
+
+ A client sends {"type":"resume","session":token,"seq":last} first thing on a
+ new socket. The answer is {"type":"session","session":token,"resumed":bool}
+ without a seq. If resumed, the messages after last follow, with their original
+ numbers. Otherwise the token is a fresh session's and numbering starts over.
+
+ The session lives in c->fn_data while its connection is open. Only touched
+ from the backend thread.
+ */
+
+#define SESSION_REPLAY_MESSAGES 512
+#define SESSION_REPLAY_BYTES (1024 * 1024)
+#define SESSION_RESUME_MS 30000
+#define SESSION_TOKEN_LEN 33
+
+typedef struct job_view job_view_t;
+typedef struct session_msg session_msg_t;
+
+typedef struct ws_session {
+    char token[SESSION_TOKEN_LEN];
+    char protocol; // c->data[WS_DATA_PROTOCOL] of the connection that opened it
+    struct mg_connection *c; // NULL while waiting to be resumed
+    uint64_t detached_ms;
+
+    uint64_t seq;   // last number given
+    uint64_t first; // oldest number still in the replay buffer
+    session_msg_t *replay[SESSION_REPLAY_MESSAGES];
+    size_t replay_bytes;
+
+    // jobs.c
+    unsigned long next_id;
+    int count;
+    job_view_t *views;
+
+    struct ws_session *next;
+} ws_session_t;
+
+void session_open(struct mg_connection *c);
+// Keeps the session for a resume; its jobs go on
+void session_close(struct mg_connection *c);
+int session_resume(struct mg_connection *c, const char *id, struct mg_str content);
+
+// ws_send for /ws messages, numbering and keeping the ones that are objects
+void session_send(struct mg_connection *c, const void *buf, size_t len, int op);
+
+// Ends the sessions that were not resumed in time
+void session_tick(void);
+void session_free_all(void);
+
+#endif //NORA_C_SESSION_H
@@ -0,0 +1,93 @@
+#include "arena.h"
+
+#include <cjson/cJSON.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static _Thread_local arena_t *current = NULL;
+
+static int arena_owns(const arena_t *a, const void *ptr) {
+    const unsigned char *p = ptr;
+    for (const arena_block_t *b = a->blocks; b != NULL; b = b->next) {
+        if (p >= b->data && p < b->data + b->size) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *arena_take(arena_t *a, size_t size) {
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+    arena_block_t *b = a->blocks;
+    for (; b != NULL; b = b->next) {
+        if (b->size - b->used >= size) {
+            break;
+        }
+    }
+
+    if (!b) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(arena_block_t) + block_size);
+        if (!b) {
+            return NULL;
+        }
+        b->size = block_size;
+        b->used = 0;
+        b->next = a->blocks;
+        a->blocks = b;
+        a->system_allocations++;
+    }
+
+    void *ptr = b->data + b->used;
+    b->used += size;
+    a->allocations++;
+    a->bytes += size;
+    return ptr;
+}
+
+void *arena_alloc(size_t size) {
+    if (!current) {
+        return malloc(size);
+    }
+    return arena_take(current, size);
+}
+
+void arena_free(void *ptr) {
+    if (!ptr || (current && arena_owns(current, ptr))) {
+        return;
+    }
+    free(ptr);
+}
+
+void arena_init_hooks(void) {
+    cJSON_Hooks hooks = {.malloc_fn = arena_alloc, .free_fn = arena_free};
+    cJSON_InitHooks(&hooks);
+}
+
+void arena_begin(arena_t *a) {
+    a->allocations = 0;
+    a->bytes = 0;
+    a->system_allocations = 0;
+    current = a;
+}
+
+void arena_end(arena_t *a) {
+    current = NULL;
+
+    // keep the default blocks for the next request, give back oversized ones
+    size_t retained = 0;
+    arena_block_t **link = &a->blocks;
+    while (*link) {
+        arena_block_t *b = *link;
+        if (b->size > ARENA_BLOCK_SIZE || retained + b->size > ARENA_RETAIN) {
+            *link = b->next;
+            free(b);
+            continue;
+        }
+        b->used = 0;
+        retained += b->size;
+        link = &b->next;
+    }
+}
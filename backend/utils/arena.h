@@ -0,0 +1,39 @@
+#ifndef NORA_C_ARENA_H
+#define NORA_C_ARENA_H
+
+#include <stddef.h>
+
+/*
+ Per-request bump allocator. While an arena is active on a thread, cJSON and
+ arena_alloc take memory from it and frees are no-ops; arena_end resets it in
+ one go. Blocks are kept between requests (up to ARENA_RETAIN bytes), so a warm
+ request path does not call the system allocator at all.
+ Nothing allocated from an arena may outlive the handler.
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_RETAIN (4 * 1024 * 1024)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *blocks;
+    size_t allocations;        // arena_alloc calls since arena_begin
+    size_t bytes;              // bytes handed out since arena_begin
+    size_t system_allocations; // malloc calls made to grow the arena since arena_begin
+} arena_t;
+
+void arena_init_hooks(void);
+void arena_begin(arena_t *a);
+void arena_end(arena_t *a);
+
+// fall back to malloc/free when no arena is active on the calling thread
+void *arena_alloc(size_t size);
+void arena_free(void *ptr);
+
+#endif //NORA_C_ARENA_H
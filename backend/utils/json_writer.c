@@ -0,0 +1,255 @@
+#include "json_writer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utils.h"
+
+// mongoose keeps its table private, these are the codes our controllers answer with
+static const char *status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 207: return "Multi-Status";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "";
+    }
+}
+
+static void chunk_open(json_writer_t *w) {
+    w->length_pos = w->c->send.len;
+    mg_send(w->c, "00000000\r\n", 10);
+    w->body_start = w->c->send.len;
+}
+
+static void chunk_close(json_writer_t *w) {
+    struct mg_iobuf *io = &w->c->send;
+    size_t len = io->len - w->body_start;
+    if (len == 0) {
+        // nothing written since the chunk was opened, drop its size line
+        io->len = w->length_pos;
+        return;
+    }
+
+    // put() cuts writes into pieces, so a chunk stays under 2 * JW_CHUNK_SIZE and fits the 8 digits
+    char size[9];
+    snprintf(size, sizeof(size), "%08x", (unsigned) len);
+    memcpy(io->buf + w->length_pos, size, 8);
+    mg_send(w->c, "\r\n", 2);
+}
+
+static void put(json_writer_t *w, const char *buf, size_t len) {
+    if (w->failed) {
+        return;
+    }
+    if (!w->chunked) {
+        mg_send(w->c, buf, len);
+        return;
+    }
+    while (len > 0) {
+        size_t n = len < JW_CHUNK_SIZE ? len : JW_CHUNK_SIZE;
+        mg_send(w->c, buf, n);
+        buf += n;
+        len -= n;
+        if (w->c->send.len - w->body_start >= JW_CHUNK_SIZE) {
+            chunk_close(w);
+            chunk_open(w);
+        }
+    }
+}
+
+void jw_escape(const char *buf, size_t len, jw_out_t out, void *ctx) {
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char) buf[i];
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+
+        if (i > run) {
+            out(ctx, buf + run, i - run);
+        }
+        run = i + 1;
+
+        char esc[8];
+        switch (ch) {
+            case '"': out(ctx, "\\\"", 2); break;
+            case '\\': out(ctx, "\\\\", 2); break;
+            case '\n': out(ctx, "\\n", 2); break;
+            case '\r': out(ctx, "\\r", 2); break;
+            case '\t': out(ctx, "\\t", 2); break;
+            case '\b': out(ctx, "\\b", 2); break;
+            case '\f': out(ctx, "\\f", 2); break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", ch);
+                out(ctx, esc, 6);
+                break;
+        }
+    }
+    if (len > run) {
+        out(ctx, buf + run, len - run);
+    }
+}
+
+static void put_out(void *ctx, const char *buf, size_t len) {
+    put(ctx, buf, len);
+}
+
+static void put_escaped(json_writer_t *w, const char *buf, size_t len) {
+    jw_escape(buf, len, put_out, w);
+}
+
+// comma and key for the next value at the current depth
+static void prefix(json_writer_t *w, const char *key) {
+    if (w->failed) {
+        return;
+    }
+    uint64_t bit = 1ULL << w->depth;
+    if (w->has_items & bit) {
+        put(w, ",", 1);
+    }
+    w->has_items |= bit;
+
+    if (key) {
+        put(w, "\"", 1);
+        put_escaped(w, key, strlen(key));
+        put(w, "\":", 2);
+    }
+}
+
+void jw_begin(json_writer_t *w, struct mg_connection *c, int status, const char *headers, int chunked) {
+    memset(w, 0, sizeof(*w));
+    w->c = c;
+    w->chunked = chunked;
+    w->start = c->send.len;
+
+    mg_printf(c, "HTTP/1.1 %d %s\r\n%s", status, status_text(status), headers ? headers : "");
+    if (chunked) {
+        mg_printf(c, "Transfer-Encoding: chunked\r\n\r\n");
+        chunk_open(w);
+    } else {
+        // same trick as mg_http_reply: reserve the digits, patch them in jw_end
+        mg_printf(c, "Content-Length:           \r\n\r\n");
+        w->length_pos = c->send.len - 14;
+        w->body_start = c->send.len;
+    }
+}
+
+void jw_end(json_writer_t *w) {
+    struct mg_iobuf *io = &w->c->send;
+    if (w->failed) {
+        // nothing has left the send buffer yet, the whole response is replaced
+        io->len = w->start;
+        error_response(w->c, 500, "Response nested too deeply");
+    } else if (w->chunked) {
+        chunk_close(w);
+        mg_send(w->c, "0\r\n\r\n", 5);
+    } else if (io->len >= w->body_start) {
+        char len[12];
+        int n = snprintf(len, sizeof(len), "%-10lu", (unsigned long) (io->len - w->body_start));
+        memcpy(io->buf + w->length_pos, len, (size_t) n);
+    }
+    w->c->is_resp = 0;
+}
+
+static void open_level(json_writer_t *w, const char *key, const char *bracket) {
+    prefix(w, key);
+    put(w, bracket, 1);
+    w->depth++;
+    if (w->depth >= JW_MAX_DEPTH) {
+        w->failed = 1;
+        return;
+    }
+    w->has_items &= ~(1ULL << w->depth);
+}
+
+static void close_level(json_writer_t *w, const char *bracket) {
+    w->depth--;
+    put(w, bracket, 1);
+}
+
+void jw_object_open(json_writer_t *w, const char *key) {
+    open_level(w, key, "{");
+}
+
+void jw_object_close(json_writer_t *w) {
+    close_level(w, "}");
+}
+
+void jw_array_open(json_writer_t *w, const char *key) {
+    open_level(w, key, "[");
+}
+
+void jw_array_close(json_writer_t *w) {
+    close_level(w, "]");
+}
+
+void jw_string(json_writer_t *w, const char *key, const char *value) {
+    if (!value) {
+        jw_null(w, key);
+        return;
+    }
+    jw_string_n(w, key, value, strlen(value));
+}
+
+void jw_string_n(json_writer_t *w, const char *key, const char *value, size_t len) {
+    jw_string_begin(w, key);
+    jw_string_append(w, value, len);
+    jw_string_end(w);
+}
+
+void jw_number(json_writer_t *w, const char *key, double value) {
+    if (!isfinite(value)) {
+        jw_null(w, key); // JSON has no nan or inf
+        return;
+    }
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.17g", value);
+    prefix(w, key);
+    put(w, buf, (size_t) n);
+}
+
+void jw_int(json_writer_t *w, const char *key, long long value) {
+    char buf[24];
+    int n = snprintf(buf, sizeof(buf), "%lld", value);
+    prefix(w, key);
+    put(w, buf, (size_t) n);
+}
+
+void jw_bool(json_writer_t *w, const char *key, int value) {
+    prefix(w, key);
+    if (value) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+void jw_null(json_writer_t *w, const char *key) {
+    prefix(w, key);
+    put(w, "null", 4);
+}
+
+void jw_raw(json_writer_t *w, const char *key, const char *json, size_t len) {
+    prefix(w, key);
+    put(w, json, len);
+}
+
+void jw_string_begin(json_writer_t *w, const char *key) {
+    prefix(w, key);
+    put(w, "\"", 1);
+}
+
+void jw_string_append(json_writer_t *w, const char *buf, size_t len) {
+    put_escaped(w, buf, len);
+}
+
+void jw_string_end(json_writer_t *w) {
+    put(w, "\"", 1);
+}
@@ -0,0 +1,54 @@
+#ifndef NORA_C_JSON_WRITER_H
+#define NORA_C_JSON_WRITER_H
+
+#include <stdint.h>
+#include "../../lib/Mongoose/mongoose.h"
+
+/*
+ Streaming JSON emitter that writes a response straight into c->send.
+ Fixed responses patch Content-Length in place at the end, like mg_http_reply does.
+ Chunked responses are cut into JW_CHUNK_SIZE chunks whose size field is patched
+ when the chunk is closed. Keys are NULL for array elements and for the root value.
+ Nesting JW_MAX_DEPTH levels or deeper fails the writer, and jw_end() answers 500 instead.
+ */
+
+#define JW_CHUNK_SIZE 16384
+#define JW_MAX_DEPTH 64
+
+typedef struct {
+    struct mg_connection *c;
+    int chunked;
+    size_t length_pos; // Content-Length or chunk size placeholder, offset in c->send
+    size_t body_start; // start of the body, or of the open chunk, offset in c->send
+    int depth;
+    uint64_t has_items; // bit per depth, set once the level got its first element
+    size_t start;       // offset in c->send where the response began
+    int failed;         // nested too deeply, everything after is dropped
+} json_writer_t;
+
+void jw_begin(json_writer_t *w, struct mg_connection *c, int status, const char *headers, int chunked);
+void jw_end(json_writer_t *w);
+
+void jw_object_open(json_writer_t *w, const char *key);
+void jw_object_close(json_writer_t *w);
+void jw_array_open(json_writer_t *w, const char *key);
+void jw_array_close(json_writer_t *w);
+
+void jw_string(json_writer_t *w, const char *key, const char *value);
+void jw_string_n(json_writer_t *w, const char *key, const char *value, size_t len);
+void jw_number(json_writer_t *w, const char *key, double value);
+void jw_int(json_writer_t *w, const char *key, long long value);
+void jw_bool(json_writer_t *w, const char *key, int value);
+void jw_null(json_writer_t *w, const char *key);
+void jw_raw(json_writer_t *w, const char *key, const char *json, size_t len);
+
+// JSON string escaping without the quotes, handed to out in runs; shared with json_append_string
+typedef void (*jw_out_t)(void *ctx, const char *buf, size_t len);
+void jw_escape(const char *buf, size_t len, jw_out_t out, void *ctx);
+
+// string values written in pieces, e.g. file contents read block by block
+void jw_string_begin(json_writer_t *w, const char *key);
+void jw_string_append(json_writer_t *w, const char *buf, size_t len);
+void jw_string_end(json_writer_t *w);
+
+#endif //NORA_C_JSON_WRITER_H
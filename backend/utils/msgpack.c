@@ -0,0 +1,356 @@
+#include "msgpack.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+static void put(struct mg_iobuf *io, const void *data, size_t len) {
+    mg_iobuf_add(io, io->len, data, len);
+}
+
+// A type byte followed by n big-endian bytes of v
+static void put_be(struct mg_iobuf *io, uint8_t type, uint64_t v, int n) {
+    uint8_t buf[9];
+    buf[0] = type;
+    for (int i = 0; i < n; i++) {
+        buf[n - i] = (uint8_t) (v >> (8 * i));
+    }
+    put(io, buf, (size_t) n + 1);
+}
+
+static uint64_t get_be(const uint8_t *p, int n) {
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+void mp_map(struct mg_iobuf *io, uint32_t n) {
+    if (n < 16) {
+        put_be(io, (uint8_t) (0x80 | n), 0, 0);
+    } else if (n <= 0xffff) {
+        put_be(io, 0xde, n, 2);
+    } else {
+        put_be(io, 0xdf, n, 4);
+    }
+}
+
+int mp_map_prepend_int(struct mg_str map, const char *key, int64_t v, struct mg_iobuf *out) {
+    const uint8_t *p = (const uint8_t *) map.buf;
+    uint64_t n;
+    size_t header;
+    if (map.len >= 1 && (p[0] & 0xf0) == 0x80) {
+        n = p[0] & 0x0f, header = 1;
+    } else if (map.len >= 3 && p[0] == 0xde) {
+        n = get_be(p + 1, 2), header = 3;
+    } else if (map.len >= 5 && p[0] == 0xdf && get_be(p + 1, 4) < 0xffffffff) {
+        n = get_be(p + 1, 4), header = 5;
+    } else {
+        return -1;
+    }
+
+    mp_map(out, (uint32_t) n + 1);
+    mp_str(out, key, strlen(key));
+    mp_int(out, v);
+    put(out, p + header, map.len - header);
+    return 0;
+}
+
+void mp_array(struct mg_iobuf *io, uint32_t n) {
+    if (n < 16) {
+        put_be(io, (uint8_t) (0x90 | n), 0, 0);
+    } else if (n <= 0xffff) {
+        put_be(io, 0xdc, n, 2);
+    } else {
+        put_be(io, 0xdd, n, 4);
+    }
+}
+
+void mp_str(struct mg_iobuf *io, const char *s, size_t len) {
+    if (len < 32) {
+        put_be(io, (uint8_t) (0xa0 | len), 0, 0);
+    } else if (len <= 0xff) {
+        put_be(io, 0xd9, len, 1);
+    } else if (len <= 0xffff) {
+        put_be(io, 0xda, len, 2);
+    } else {
+        put_be(io, 0xdb, len, 4);
+    }
+    put(io, s, len);
+}
+
+void mp_int(struct mg_iobuf *io, int64_t v) {
+    if (v >= 0 && v < 128) {
+        put_be(io, (uint8_t) v, 0, 0);
+    } else if (v < 0 && v >= -32) {
+        put_be(io, (uint8_t) (int8_t) v, 0, 0);
+    } else if (v >= 0) {
+        if (v <= 0xff) {
+            put_be(io, 0xcc, (uint64_t) v, 1);
+        } else if (v <= 0xffff) {
+            put_be(io, 0xcd, (uint64_t) v, 2);
+        } else if (v <= 0xffffffff) {
+            put_be(io, 0xce, (uint64_t) v, 4);
+        } else {
+            put_be(io, 0xcf, (uint64_t) v, 8);
+        }
+    } else if (v >= INT8_MIN) {
+        put_be(io, 0xd0, (uint64_t) v, 1);
+    } else if (v >= INT16_MIN) {
+        put_be(io, 0xd1, (uint64_t) v, 2);
+    } else if (v >= INT32_MIN) {
+        put_be(io, 0xd2, (uint64_t) v, 4);
+    } else {
+        put_be(io, 0xd3, (uint64_t) v, 8);
+    }
+}
+
+void mp_double(struct mg_iobuf *io, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_be(io, 0xcb, bits, 8);
+}
+
+void mp_bool(struct mg_iobuf *io, int v) {
+    put_be(io, v ? 0xc3 : 0xc2, 0, 0);
+}
+
+void mp_nil(struct mg_iobuf *io) {
+    put_be(io, 0xc0, 0, 0);
+}
+
+static int from_json_string(struct mg_str tok, struct mg_iobuf *out) {
+    if (tok.len < 2 || tok.buf[0] != '"') {
+        return -1;
+    }
+    char stack_buf[256];
+    char *buf = tok.len <= sizeof(stack_buf) ? stack_buf : malloc(tok.len);
+    if (!buf) {
+        return -1;
+    }
+
+    int n = json_unescape(tok.buf + 1, tok.len - 2, buf);
+    if (n >= 0) {
+        mp_str(out, buf, (size_t) n);
+    }
+    if (buf != stack_buf) {
+        free(buf);
+    }
+    return n >= 0 ? 0 : -1;
+}
+
+static int from_json_number(struct mg_str tok, struct mg_iobuf *out) {
+    char buf[64];
+    if (tok.len == 0 || tok.len >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, tok.buf, tok.len);
+    buf[tok.len] = '\0';
+
+    char *end;
+    if (strpbrk(buf, ".eE") == NULL) {
+        errno = 0;
+        long long v = strtoll(buf, &end, 10);
+        if (*end == '\0' && errno == 0) {
+            mp_int(out, v);
+            return 0;
+        }
+    }
+    double d = strtod(buf, &end);
+    if (*end != '\0') {
+        return -1;
+    }
+    mp_double(out, d);
+    return 0;
+}
+
+static int from_json(struct mg_str tok, struct mg_iobuf *out, int depth) {
+    if (tok.len == 0 || depth > MP_MAX_DEPTH) {
+        return -1;
+    }
+
+    struct mg_str key, val;
+    size_t ofs;
+    uint32_t n = 0;
+    switch (tok.buf[0]) {
+        case '{':
+        case '[':
+            // counts come first in MessagePack, so the members are walked twice
+            for (ofs = 0; (ofs = mg_json_next(tok, ofs, NULL, NULL)) > 0;) {
+                n++;
+            }
+            if (tok.buf[0] == '{') {
+                mp_map(out, n);
+            } else {
+                mp_array(out, n);
+            }
+            for (ofs = 0; (ofs = mg_json_next(tok, ofs, &key, &val)) > 0;) {
+                if ((tok.buf[0] == '{' && from_json_string(key, out) != 0) || from_json(val, out, depth + 1) != 0) {
+                    return -1;
+                }
+            }
+            return 0;
+        case '"':
+            return from_json_string(tok, out);
+        case 't':
+            mp_bool(out, 1);
+            return 0;
+        case 'f':
+            mp_bool(out, 0);
+            return 0;
+        case 'n':
+            mp_nil(out);
+            return 0;
+        default:
+            return from_json_number(tok, out);
+    }
+}
+
+int mp_from_json(struct mg_str json, struct mg_iobuf *out) {
+    int len = 0, ofs = mg_json_get(json, "$", &len);
+    if (ofs < 0) {
+        return -1;
+    }
+    return from_json(mg_str_n(json.buf + ofs, (size_t) len), out, 0);
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} reader_t;
+
+static int need(reader_t *r, size_t n) {
+    return (size_t) (r->end - r->p) >= n ? 0 : -1;
+}
+
+static int to_json(reader_t *r, struct mg_iobuf *out, int depth, int want_string);
+
+static int to_json_items(reader_t *r, struct mg_iobuf *out, int depth, uint64_t n, int map) {
+    put(out, map ? "{" : "[", 1);
+    for (uint64_t i = 0; i < n; i++) {
+        if (i > 0) {
+            put(out, ",", 1);
+        }
+        if (map) {
+            if (to_json(r, out, depth + 1, 1) != 0) {
+                return -1;
+            }
+            put(out, ":", 1);
+        }
+        if (to_json(r, out, depth + 1, 0) != 0) {
+            return -1;
+        }
+    }
+    put(out, map ? "}" : "]", 1);
+    return 0;
+}
+
+static int to_json(reader_t *r, struct mg_iobuf *out, int depth, int want_string) {
+    if (depth > MP_MAX_DEPTH || need(r, 1) != 0) {
+        return -1;
+    }
+
+    uint8_t type = *r->p++;
+    uint64_t n;
+    int size;
+    if ((type & 0xe0) == 0xa0 || (type >= 0xd9 && type <= 0xdb)) {
+        size = type < 0xd9 ? 0 : 1 << (type - 0xd9);
+        if (need(r, (size_t) size) != 0) {
+            return -1;
+        }
+        n = size ? get_be(r->p, size) : (uint64_t) (type & 0x1f);
+        r->p += size;
+        if (need(r, n) != 0) {
+            return -1;
+        }
+        json_append_string(out, (const char *) r->p, n);
+        r->p += n;
+        return 0;
+    }
+    if (want_string) {
+        return -1; // JSON only has string keys
+    }
+
+    char buf[32];
+    if (type < 0x80 || type >= 0xe0) {
+        put(out, buf, (size_t) snprintf(buf, sizeof(buf), "%d", (int) (int8_t) type));
+        return 0;
+    }
+    if ((type & 0xf0) == 0x80 || (type & 0xf0) == 0x90) {
+        return to_json_items(r, out, depth, type & 0x0f, (type & 0xf0) == 0x80);
+    }
+
+    switch (type) {
+        case 0xc0:
+            put(out, "null", 4);
+            return 0;
+        case 0xc2:
+            put(out, "false", 5);
+            return 0;
+        case 0xc3:
+            put(out, "true", 4);
+            return 0;
+        case 0xdc: case 0xdd: case 0xde: case 0xdf:
+            size = type & 1 ? 4 : 2;
+            if (need(r, (size_t) size) != 0) {
+                return -1;
+            }
+            n = get_be(r->p, size);
+            r->p += size;
+            return to_json_items(r, out, depth, n, type >= 0xde);
+        case 0xca: case 0xcb: {
+            size = type == 0xca ? 4 : 8;
+            if (need(r, (size_t) size) != 0) {
+                return -1;
+            }
+            uint64_t bits = get_be(r->p, size);
+            r->p += size;
+            double d;
+            if (size == 4) {
+                uint32_t b32 = (uint32_t) bits;
+                float f;
+                memcpy(&f, &b32, sizeof(f));
+                d = f;
+            } else {
+                memcpy(&d, &bits, sizeof(d));
+            }
+            if (!isfinite(d)) {
+                put(out, "null", 4);
+            } else {
+                put(out, buf, (size_t) snprintf(buf, sizeof(buf), "%.17g", d));
+            }
+            return 0;
+        }
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+            size = 1 << (type & 3);
+            if (need(r, (size_t) size) != 0) {
+                return -1;
+            }
+            n = get_be(r->p, size);
+            r->p += size;
+            if (type <= 0xcf) {
+                put(out, buf, (size_t) snprintf(buf, sizeof(buf), "%llu", (unsigned long long) n));
+            } else {
+                long long v = size == 1 ? (int8_t) n : size == 2 ? (int16_t) n : size == 4 ? (int32_t) n : (int64_t) n;
+                put(out, buf, (size_t) snprintf(buf, sizeof(buf), "%lld", v));
+            }
+            return 0;
+        }
+        default:
+            return -1; // bin and ext have no JSON form
+    }
+}
+
+int mp_to_json(struct mg_str data, struct mg_iobuf *out) {
+    reader_t r = {(const uint8_t *) data.buf, (const uint8_t *) data.buf + data.len};
+    if (to_json(&r, out, 0, 0) != 0) {
+        return -1;
+    }
+    return r.p == r.end ? 0 : -1;
+}
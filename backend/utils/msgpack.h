@@ -0,0 +1,35 @@
+#ifndef NORA_C_MSGPACK_H
+#define NORA_C_MSGPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+
+/*
+ MessagePack for the binary WebSocket protocol (WS_PROTOCOL_MSGPACK). Values are
+ appended to an mg_iobuf. The two transcoders let messages that only exist as
+ JSON text (tree events, incoming commands) cross a binary connection, so the
+ handlers behind them stay written against JSON.
+ */
+
+#define MP_MAX_DEPTH 32
+
+void mp_map(struct mg_iobuf *io, uint32_t n);
+void mp_array(struct mg_iobuf *io, uint32_t n);
+void mp_str(struct mg_iobuf *io, const char *s, size_t len);
+void mp_int(struct mg_iobuf *io, int64_t v);
+void mp_double(struct mg_iobuf *io, double v);
+void mp_bool(struct mg_iobuf *io, int v);
+void mp_nil(struct mg_iobuf *io);
+
+// Copies the map with key: v in front of its members, -1 if map does not start with a map header
+int mp_map_prepend_int(struct mg_str map, const char *key, int64_t v, struct mg_iobuf *out);
+
+// -1 if json is not valid JSON; out may hold part of the value then
+int mp_from_json(struct mg_str json, struct mg_iobuf *out);
+
+// -1 unless data is exactly one value with string map keys and no bin/ext types
+int mp_to_json(struct mg_str data, struct mg_iobuf *out);
+
+#endif //NORA_C_MSGPACK_H
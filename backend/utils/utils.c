@@ -1,11 +1,16 @@
 #include "utils.h"
+#include "json_writer.h"
+#include "arena.h"
+#include "msgpack.h"
+#include "ws_deflate.h"
+#include "../session/session.h"
 #include "../../webDriver/src/utils/utils.h"
 
-#include <cjson/cJSON.h>
 #include <sys/stat.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 int mkdir_p(const char *path) {
     char tmp[1024];
@@ -46,42 +51,126 @@ int mkdir_p(const char *path) {
 }
 
 void error_response(struct mg_connection *c, int status_code, const char *message) {
-    cJSON *response_json = cJSON_CreateObject();
-    cJSON_AddNumberToObject(response_json, "status", status_code);
-    cJSON_AddStringToObject(response_json, "error", message);
+    json_writer_t w;
+    jw_begin(&w, c, status_code, DEFAULT_JSON_HEADER, 0);
+    jw_object_open(&w, NULL);
+    jw_int(&w, "status", status_code);
+    jw_string(&w, "error", message);
+    jw_object_close(&w);
+    jw_end(&w);
+}
 
-    char* response = cJSON_Print(response_json);
-    cJSON_Delete(response_json);
-    mg_http_reply(c, status_code, DEFAULT_JSON_HEADER, "%s", response);
-    free(response);
+static void iobuf_out(void *ctx, const char *buf, size_t len) {
+    struct mg_iobuf *out = ctx;
+    mg_iobuf_add(out, out->len, buf, len);
 }
 
-void ws_response(struct mg_connection *c, ws_msg_type_t type, const char *message) {
-    char *response = NULL;
+void json_append_string(struct mg_iobuf *out, const char *s, size_t len) {
+    mg_iobuf_add(out, out->len, "\"", 1);
+    jw_escape(s, len, iobuf_out, out);
+    mg_iobuf_add(out, out->len, "\"", 1);
+}
+
+void ws_upgrade(struct mg_connection *c, struct mg_http_message *hm) {
+    c->data[WS_DATA_PROTOCOL] = WS_TEXT;
+
+    struct mg_str *offered = mg_http_get_header(hm, "Sec-WebSocket-Protocol");
+    if (offered) {
+        // mongoose echoes the header as is, so it is cut down to the first protocol we speak
+        struct mg_str item, rest = *offered;
+        while (mg_span(rest, &item, &rest, ',')) {
+            while (item.len > 0 && item.buf[0] == ' ') {
+                item.buf++, item.len--;
+            }
+            while (item.len > 0 && item.buf[item.len - 1] == ' ') {
+                item.len--;
+            }
+            int msgpack = mg_strcmp(item, mg_str(WS_PROTOCOL_MSGPACK)) == 0;
+            if (msgpack || mg_strcmp(item, mg_str(WS_PROTOCOL_JSON)) == 0) {
+                c->data[WS_DATA_PROTOCOL] = msgpack ? WS_MSGPACK : WS_TEXT;
+                *offered = item;
+                break;
+            }
+        }
+    }
+
+    char extensions[128];
+    ws_deflate_negotiate(c, hm, extensions, sizeof(extensions));
+    mg_ws_upgrade(c, hm, "%s", extensions);
+}
+
+int ws_is_binary(struct mg_connection *c) {
+    return c->data[WS_DATA_PROTOCOL] == WS_MSGPACK;
+}
+
+void ws_send_json(struct mg_connection *c, const char *json, size_t len) {
+    if (ws_is_binary(c)) {
+        struct mg_iobuf packed = {.align = 256};
+        if (mp_from_json(mg_str_n(json, len), &packed) == 0) {
+            session_send(c, packed.buf, packed.len, WEBSOCKET_OP_BINARY);
+            mg_iobuf_free(&packed);
+            return;
+        }
+        mg_iobuf_free(&packed);
+    }
+    session_send(c, json, len, WEBSOCKET_OP_TEXT);
+}
+
+static const char *ws_type_name(ws_msg_type_t type) {
+    return type == WS_SYSTEM ? "system" :
+           type == WS_INFO ? "info" :
+           type == WS_SUCCESS ? "success" :
+           type == WS_WARNING ? "warning" :
+           type == WS_ERROR ? "error" :
+           type == WS_CODE ? "code" :
+           type == WS_CODE_ERROR ? "code_error" :
+           type == WS_END ? "end" : "unknown";
+}
+
+void ws_response_id(struct mg_connection *c, const char *id, ws_msg_type_t type, const char *message) {
+    message = message ? message : "";
+    id = id && *id ? id : NULL;
+
+    if (ws_is_binary(c)) {
+        struct mg_iobuf packed = {.align = 256};
+        if (type == WS_NO_FORMAT) {
+            mp_str(&packed, message, strlen(message));
+        } else {
+            mp_map(&packed, id ? 3 : 2);
+            if (id) {
+                mp_str(&packed, "id", 2);
+                mp_str(&packed, id, strlen(id));
+            }
+            mp_str(&packed, "type", 4);
+            mp_str(&packed, ws_type_name(type), strlen(ws_type_name(type)));
+            mp_str(&packed, "message", 7);
+            mp_str(&packed, message, strlen(message));
+        }
+        session_send(c, packed.buf, packed.len, WEBSOCKET_OP_BINARY);
+        mg_iobuf_free(&packed);
+        return;
+    }
+
     if (type == WS_NO_FORMAT) {
-        response = strdup(message ? message : "");
-    } else {
-        cJSON *response_json = cJSON_CreateObject();
-        cJSON_AddStringToObject(response_json, "type",
-                                type == WS_SYSTEM ? "system" :
-                                type == WS_INFO ? "info" :
-                                type == WS_SUCCESS ? "success" :
-                                type == WS_WARNING ? "warning" :
-                                type == WS_ERROR ? "error" :
-                                type == WS_CODE ? "code" :
-                                type == WS_CODE_ERROR ? "code_error" :
-                                type == WS_END ? "end" : "unknown");
-        cJSON_AddStringToObject(response_json, "message", message ? message : "");
-        response = cJSON_PrintUnformatted(response_json);
-        cJSON_Delete(response_json);
-    }
-
-    if (!response) {
-        response = strdup("");
-    }
-    struct mg_str response_str = mg_str(response);
-    mg_ws_send(c, response_str.buf, response_str.len, WEBSOCKET_OP_TEXT);
-    free(response);
+        session_send(c, message, strlen(message), WEBSOCKET_OP_TEXT);
+        return;
+    }
+    struct mg_iobuf json = {.align = 256};
+    mg_iobuf_add(&json, json.len, "{", 1);
+    if (id) {
+        mg_iobuf_add(&json, json.len, "\"id\":", 5);
+        json_append_string(&json, id, strlen(id));
+        mg_iobuf_add(&json, json.len, ",", 1);
+    }
+    mg_xprintf(mg_pfn_iobuf, &json, "\"type\":\"%s\",\"message\":", ws_type_name(type));
+    json_append_string(&json, message, strlen(message));
+    mg_iobuf_add(&json, json.len, "}", 1);
+    session_send(c, json.buf, json.len, WEBSOCKET_OP_TEXT);
+    mg_iobuf_free(&json);
+}
+
+void ws_response(struct mg_connection *c, ws_msg_type_t type, const char *message) {
+    ws_response_id(c, NULL, type, message);
 }
 
 void trim(char *str) {
@@ -103,4 +192,186 @@ void trim(char *str) {
     if (start != str) {
         memmove(str, start, strlen(start) + 1);
     }
-}
\ No newline at end of file
+}
+
+static int hex4(const char *p, unsigned *out) {
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++) {
+        char ch = p[i];
+        v <<= 4;
+        if (ch >= '0' && ch <= '9') v |= (unsigned) (ch - '0');
+        else if (ch >= 'a' && ch <= 'f') v |= (unsigned) (ch - 'a' + 10);
+        else if (ch >= 'A' && ch <= 'F') v |= (unsigned) (ch - 'A' + 10);
+        else return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+// Unescapes a JSON string token body into buf (UTF-8 output is never longer than the input)
+int json_unescape(const char *s, size_t n, char *buf) {
+    size_t j = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] != '\\') {
+            buf[j++] = s[i];
+            continue;
+        }
+        if (++i >= n) {
+            return -1;
+        }
+        switch (s[i]) {
+            case '"': buf[j++] = '"'; break;
+            case '\\': buf[j++] = '\\'; break;
+            case '/': buf[j++] = '/'; break;
+            case 'b': buf[j++] = '\b'; break;
+            case 'f': buf[j++] = '\f'; break;
+            case 'n': buf[j++] = '\n'; break;
+            case 'r': buf[j++] = '\r'; break;
+            case 't': buf[j++] = '\t'; break;
+            case 'u': {
+                unsigned cp;
+                if (i + 4 >= n || hex4(s + i + 1, &cp) != 0) {
+                    return -1;
+                }
+                i += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 < n && s[i + 1] == '\\' && s[i + 2] == 'u') {
+                    unsigned lo;
+                    if (hex4(s + i + 3, &lo) == 0 && lo >= 0xDC00 && lo <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        i += 6;
+                    }
+                }
+                if (cp < 0x80) {
+                    buf[j++] = (char) cp;
+                } else if (cp < 0x800) {
+                    buf[j++] = (char) (0xC0 | (cp >> 6));
+                    buf[j++] = (char) (0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    buf[j++] = (char) (0xE0 | (cp >> 12));
+                    buf[j++] = (char) (0x80 | ((cp >> 6) & 0x3F));
+                    buf[j++] = (char) (0x80 | (cp & 0x3F));
+                } else {
+                    buf[j++] = (char) (0xF0 | (cp >> 18));
+                    buf[j++] = (char) (0x80 | ((cp >> 12) & 0x3F));
+                    buf[j++] = (char) (0x80 | ((cp >> 6) & 0x3F));
+                    buf[j++] = (char) (0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    buf[j] = '\0';
+    return (int) j;
+}
+
+/*
+ Reads a string field straight out of the request body, no DOM and no heap.
+ Returns the unescaped length, -1 when the field is missing or not a string,
+ -2 when it does not fit in buf.
+ */
+int json_get_str(struct mg_str json, const char *path, char *buf, size_t len) {
+    int toklen = 0;
+    int off = mg_json_get(json, path, &toklen);
+    if (off < 0 || toklen < 2 || json.buf[off] != '"') {
+        return -1;
+    }
+    if ((size_t) toklen - 2 >= len) {
+        return -2;
+    }
+    return json_unescape(json.buf + off + 1, (size_t) toklen - 2, buf);
+}
+
+// Same, for fields of any size: the copy comes from the request arena
+char *json_get_str_arena(struct mg_str json, const char *path, size_t *len) {
+    int toklen = 0;
+    int off = mg_json_get(json, path, &toklen);
+    if (off < 0 || toklen < 2 || json.buf[off] != '"') {
+        return NULL;
+    }
+
+    char *buf = arena_alloc((size_t) toklen - 1);
+    if (!buf) {
+        return NULL;
+    }
+
+    int n = json_unescape(json.buf + off + 1, (size_t) toklen - 2, buf);
+    if (n < 0) {
+        arena_free(buf);
+        return NULL;
+    }
+    if (len) {
+        *len = (size_t) n;
+    }
+    return buf;
+}
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void stat_etag(const struct stat *st, char *buf, size_t len) {
+    snprintf(buf, len, "\"%lx-%llx-%lx-%llx\"", (unsigned long) st->st_ino,
+             (unsigned long long) st->st_mtim.tv_sec, (unsigned long) st->st_mtim.tv_nsec,
+             (unsigned long long) st->st_size);
+}
+
+void http_date(time_t t, char *buf, size_t len) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// If-None-Match wins over If-Modified-Since, as RFC 9110 asks
+int http_not_modified(struct mg_http_message *hm, const char *etag, time_t last_modified) {
+    struct mg_str *inm = mg_http_get_header(hm, "If-None-Match");
+    if (inm) {
+        if (etag == NULL) {
+            return 0;
+        }
+        if (mg_match(*inm, mg_str("*"), NULL)) {
+            return 1;
+        }
+        return memmem(inm->buf, inm->len, etag, strlen(etag)) != NULL;
+    }
+
+    struct mg_str *ims = mg_http_get_header(hm, "If-Modified-Since");
+    if (ims && last_modified > 0) {
+        char date[64];
+        struct tm tm = {0};
+        snprintf(date, sizeof(date), "%.*s", (int) ims->len, ims->buf);
+        if (strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm) != NULL) {
+            return last_modified <= timegm(&tm);
+        }
+    }
+
+    return 0;
+}
+
+void validator_headers(char *buf, size_t len, const char *base, const char *etag, time_t last_modified) {
+    char date[64];
+    http_date(last_modified, date, sizeof(date));
+    snprintf(buf, len, "%s" REVALIDATE_HEADER "ETag: %s\r\nLast-Modified: %s\r\n", base, etag, date);
+}
+
+void not_modified_response(struct mg_connection *c, const char *etag, time_t last_modified) {
+    char date[64] = "";
+    if (last_modified > 0) {
+        http_date(last_modified, date, sizeof(date));
+    }
+    mg_printf(c, "HTTP/1.1 304 Not Modified\r\n" CORS REVALIDATE_HEADER "%s%s%s%s%s%s\r\n",
+              etag ? "ETag: " : "", etag ? etag : "", etag ? "\r\n" : "",
+              date[0] ? "Last-Modified: " : "", date, date[0] ? "\r\n" : "");
+}
+
+// 200 reply for an already serialized body, copied once into the send buffer
+void buffer_response(struct mg_connection *c, const char *headers, const void *body, size_t len) {
+    mg_printf(c, "HTTP/1.1 200 OK\r\n%sContent-Length: %lu\r\n\r\n", headers, (unsigned long) len);
+    mg_send(c, body, len);
+}
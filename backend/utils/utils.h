@@ -4,13 +4,51 @@
 #include "../../lib/Mongoose/mongoose.h"
 #include "../backend.h"
 
-#define CORS "Access-Control-Allow-Origin: *\r\n"
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define CORS "Access-Control-Allow-Origin: *\r\nAccess-Control-Expose-Headers: ETag, Last-Modified, Content-Range, Accept-Ranges\r\n"
 #define DEFAULT_JSON_HEADER CORS "Content-Type: application/json\r\n"
 #define DEFAULT_TEXT_HEADER CORS "Content-Type: text/plain\r\n"
+#define REVALIDATE_HEADER "Cache-Control: no-cache\r\n"
+
+#define FNV1A_INIT 14695981039346656037ULL
 
 int mkdir_p(const char *path);
 void error_response(struct mg_connection *c, int status_code, const char *message);
+/*
+ /ws speaks JSON text by default. A client offering WS_PROTOCOL_MSGPACK in
+ Sec-WebSocket-Protocol gets MessagePack in binary frames instead, both ways.
+ The choice is kept in c->data[WS_DATA_PROTOCOL].
+ */
+#define WS_PROTOCOL_JSON "nora.json"
+#define WS_PROTOCOL_MSGPACK "nora.msgpack"
+#define WS_DATA_PROTOCOL 0
+#define WS_TEXT 't'
+#define WS_MSGPACK 'm'
+
+void ws_upgrade(struct mg_connection *c, struct mg_http_message *hm);
+int ws_is_binary(struct mg_connection *c);
+// Sends a JSON message, transcoded for binary connections
+void ws_send_json(struct mg_connection *c, const char *json, size_t len);
 void ws_response(struct mg_connection *c, ws_msg_type_t type, const char *message);
+// Same, tagged with the id of the request or job it answers (none when id is NULL or empty)
+void ws_response_id(struct mg_connection *c, const char *id, ws_msg_type_t type, const char *message);
 void trim(char *str);
 
+// Unescapes a JSON string token body (without quotes) into buf, which needs n bytes; -1 if invalid
+int json_unescape(const char *s, size_t n, char *buf);
+// Appends s as a quoted JSON string
+void json_append_string(struct mg_iobuf *out, const char *s, size_t len);
+int json_get_str(struct mg_str json, const char *path, char *buf, size_t len);
+char *json_get_str_arena(struct mg_str json, const char *path, size_t *len);
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len);
+void stat_etag(const struct stat *st, char *buf, size_t len);
+void http_date(time_t t, char *buf, size_t len);
+int http_not_modified(struct mg_http_message *hm, const char *etag, time_t last_modified);
+void validator_headers(char *buf, size_t len, const char *base, const char *etag, time_t last_modified);
+void not_modified_response(struct mg_connection *c, const char *etag, time_t last_modified);
+void buffer_response(struct mg_connection *c, const char *headers, const void *body, size_t len);
+
 #endif //NORA_C_UTILS_H
\ No newline at end of file
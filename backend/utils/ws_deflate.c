@@ -0,0 +1,248 @@
+#include "ws_deflate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "../metrics/metrics.h"
+
+typedef struct {
+    z_stream deflate;
+    z_stream inflate;
+    int no_context_takeover; // server_no_context_takeover was negotiated
+} ws_deflate_t;
+
+static ws_deflate_stats_t stats;
+// compressed output, reused for every message
+static struct mg_iobuf scratch = {.align = 4096};
+
+static const uint8_t flush_tail[4] = {0x00, 0x00, 0xff, 0xff};
+
+static ws_deflate_t *state_of(struct mg_connection *c) {
+    ws_deflate_t *st;
+    memcpy(&st, c->data + WS_DATA_DEFLATE, sizeof(st));
+    return st;
+}
+
+static void set_state(struct mg_connection *c, ws_deflate_t *st) {
+    memcpy(c->data + WS_DATA_DEFLATE, &st, sizeof(st));
+}
+
+static uint64_t cpu_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static struct mg_str str_trim(struct mg_str s) {
+    while (s.len > 0 && (s.buf[0] == ' ' || s.buf[0] == '\t')) {
+        s.buf++, s.len--;
+    }
+    while (s.len > 0 && (s.buf[s.len - 1] == ' ' || s.buf[s.len - 1] == '\t')) {
+        s.len--;
+    }
+    return s;
+}
+
+// window_bits of server_max_window_bits, 0 when the offer can not be accepted
+static int parse_offer(struct mg_str offer, int *no_context_takeover) {
+    struct mg_str param, rest = offer;
+    if (!mg_span(rest, &param, &rest, ';') || mg_strcmp(str_trim(param), mg_str("permessage-deflate")) != 0) {
+        return 0;
+    }
+
+    int window_bits = 15;
+    *no_context_takeover = 0;
+    while (mg_span(rest, &param, &rest, ';')) {
+        struct mg_str name = mg_str(""), value = mg_str("");
+        mg_span(str_trim(param), &name, &value, '=');
+        name = str_trim(name);
+        if (name.len == 0) {
+            continue;
+        }
+        value = str_trim(value);
+        if (value.len >= 2 && value.buf[0] == '"') {
+            value.buf++, value.len -= 2;
+        }
+
+        if (mg_strcmp(name, mg_str("server_no_context_takeover")) == 0) {
+            *no_context_takeover = 1;
+        } else if (mg_strcmp(name, mg_str("server_max_window_bits")) == 0) {
+            // zlib can not produce a raw stream with a 256 byte window
+            long bits = value.len > 0 ? strtol(value.buf, NULL, 10) : 0;
+            if (bits < 9 || bits > 15) {
+                return 0;
+            }
+            window_bits = (int) bits;
+        } else if (mg_strcmp(name, mg_str("client_no_context_takeover")) != 0 &&
+                   mg_strcmp(name, mg_str("client_max_window_bits")) != 0) {
+            return 0; // unknown parameter, the offer has to be declined
+        }
+    }
+    return window_bits;
+}
+
+void ws_deflate_negotiate(struct mg_connection *c, struct mg_http_message *hm, char *header, size_t len) {
+    header[0] = '\0';
+    set_state(c, NULL);
+
+    struct mg_str *offers = mg_http_get_header(hm, "Sec-WebSocket-Extensions");
+    if (!offers) {
+        return;
+    }
+
+    // offers are in the client's order of preference, the first usable one wins
+    struct mg_str offer, rest = *offers;
+    int window_bits = 0, no_context_takeover = 0;
+    while (window_bits == 0 && mg_span(rest, &offer, &rest, ',')) {
+        window_bits = parse_offer(offer, &no_context_takeover);
+    }
+    if (window_bits == 0) {
+        return;
+    }
+
+    ws_deflate_t *st = calloc(1, sizeof(ws_deflate_t));
+    if (!st) {
+        return;
+    }
+    // negative window bits select raw deflate, without zlib header and trailer
+    if (deflateInit2(&st->deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(st);
+        return;
+    }
+    if (inflateInit2(&st->inflate, -15) != Z_OK) {
+        deflateEnd(&st->deflate);
+        free(st);
+        return;
+    }
+    st->no_context_takeover = no_context_takeover;
+    set_state(c, st);
+    stats.connections++;
+
+    snprintf(header, len, "Sec-WebSocket-Extensions: permessage-deflate%s", no_context_takeover ? "; server_no_context_takeover" : "");
+    if (window_bits != 15) {
+        size_t n = strlen(header);
+        snprintf(header + n, len - n, "; server_max_window_bits=%d", window_bits);
+    }
+    size_t n = strlen(header);
+    snprintf(header + n, len - n, "\r\n");
+}
+
+void ws_send(struct mg_connection *c, const void *buf, size_t len, int op) {
+    metrics_ws_out(len);
+    ws_deflate_t *st = state_of(c);
+    if (!st) {
+        mg_ws_send(c, buf, len, op);
+        return;
+    }
+    if (len < WS_DEFLATE_MIN_SIZE) {
+        stats.skipped++;
+        mg_ws_send(c, buf, len, op);
+        return;
+    }
+
+    uint64_t started = cpu_now_ns();
+    scratch.len = 0;
+    st->deflate.next_in = (Bytef *) buf;
+    st->deflate.avail_in = (uInt) len;
+    int rc;
+    do {
+        if (scratch.size - scratch.len < 1024) {
+            mg_iobuf_resize(&scratch, scratch.size + (len / 2 > 4096 ? len / 2 : 4096));
+            if (scratch.size - scratch.len < 1024) {
+                break;
+            }
+        }
+        st->deflate.next_out = scratch.buf + scratch.len;
+        st->deflate.avail_out = (uInt) (scratch.size - scratch.len);
+        rc = deflate(&st->deflate, Z_SYNC_FLUSH);
+        scratch.len = scratch.size - st->deflate.avail_out;
+    } while (rc == Z_OK && (st->deflate.avail_in > 0 || st->deflate.avail_out == 0));
+    if (st->no_context_takeover) {
+        deflateReset(&st->deflate);
+    }
+    stats.cpu_ns += cpu_now_ns() - started;
+
+    // a sync flush always ends in 00 00 ff ff, which the frame leaves out
+    if (st->deflate.avail_in > 0 || scratch.len < 4 || memcmp(scratch.buf + scratch.len - 4, flush_tail, 4) != 0) {
+        // the window already holds this message, so the stream can not go on
+        mg_error(c, "permessage-deflate failed");
+        return;
+    }
+    scratch.len -= 4;
+
+    stats.compressed++;
+    stats.raw_bytes += len;
+    stats.compressed_bytes += scratch.len;
+    mg_ws_send(c, scratch.buf, scratch.len, op | WS_RSV1);
+}
+
+int ws_inflate(struct mg_connection *c, struct mg_str in, struct mg_iobuf *out) {
+    ws_deflate_t *st = state_of(c);
+    if (!st) {
+        return -1;
+    }
+
+    uint64_t started = cpu_now_ns();
+    int rc = Z_OK, finished = 0;
+    // the message is inflated, then the tail the sender stripped
+    for (int part = 0; part < 2 && rc == Z_OK && !finished; part++) {
+        st->inflate.next_in = part == 0 ? (Bytef *) in.buf : (Bytef *) flush_tail;
+        st->inflate.avail_in = part == 0 ? (uInt) in.len : sizeof(flush_tail);
+        while (st->inflate.avail_in > 0) {
+            if (out->size - out->len < 1024) {
+                if (out->size >= WS_DEFLATE_MAX_MESSAGE) {
+                    rc = Z_MEM_ERROR;
+                    break;
+                }
+                mg_iobuf_resize(out, out->size + 4096 + out->size / 2);
+                if (out->size - out->len < 1024) {
+                    rc = Z_MEM_ERROR;
+                    break;
+                }
+            }
+            st->inflate.next_out = out->buf + out->len;
+            st->inflate.avail_out = (uInt) (out->size - out->len);
+            rc = inflate(&st->inflate, Z_SYNC_FLUSH);
+            out->len = out->size - st->inflate.avail_out;
+            if (rc == Z_STREAM_END) {
+                // a final block: the client started a new stream for its next message
+                inflateReset(&st->inflate);
+                rc = Z_OK;
+                finished = 1;
+                break;
+            }
+            if (rc == Z_BUF_ERROR && st->inflate.avail_out > 0) {
+                rc = Z_OK; // no progress left to make with this input
+                break;
+            }
+            if (rc != Z_OK) {
+                break;
+            }
+        }
+    }
+    stats.cpu_ns += cpu_now_ns() - started;
+    if (rc != Z_OK) {
+        return -1;
+    }
+
+    stats.inflated++;
+    return 0;
+}
+
+void ws_deflate_close(struct mg_connection *c) {
+    ws_deflate_t *st = state_of(c);
+    if (!st) {
+        return;
+    }
+    deflateEnd(&st->deflate);
+    inflateEnd(&st->inflate);
+    free(st);
+    set_state(c, NULL);
+}
+
+const ws_deflate_stats_t *ws_deflate_stats(void) {
+    return &stats;
+}
@@ -0,0 +1,47 @@
+#ifndef NORA_C_WS_DEFLATE_H
+#define NORA_C_WS_DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+
+/*
+ permessage-deflate (RFC 7692) for /ws. When the client offers it, the
+ connection keeps a deflate and an inflate stream for its whole life, so each
+ message is compressed against the ones before it (the sliding window) unless
+ the client asks for server_no_context_takeover. Messages shorter than
+ WS_DEFLATE_MIN_SIZE go out uncompressed; they never enter the window, so both
+ ends stay in step. The stream pointer lives in c->data[WS_DATA_DEFLATE].
+ Only touched from the backend thread.
+ */
+
+#define WS_DEFLATE_MIN_SIZE 256
+#define WS_DEFLATE_MAX_MESSAGE (16 * 1024 * 1024)
+#define WS_DATA_DEFLATE 8
+#define WS_RSV1 0x40
+
+typedef struct {
+    unsigned long connections;
+    unsigned long compressed;   // messages sent compressed
+    unsigned long skipped;      // messages under WS_DEFLATE_MIN_SIZE sent as they are
+    unsigned long inflated;     // compressed messages received
+    unsigned long long raw_bytes;        // before compression
+    unsigned long long compressed_bytes; // on the wire
+    unsigned long long cpu_ns;           // thread CPU time spent in zlib
+} ws_deflate_stats_t;
+
+// Reads Sec-WebSocket-Extensions; if an offer is accepted, sets up c and writes the
+// response header line into header (otherwise header is ""). Call before the upgrade.
+void ws_deflate_negotiate(struct mg_connection *c, struct mg_http_message *hm, char *header, size_t len);
+
+// mg_ws_send for data frames, compressing them when the connection negotiated it
+void ws_send(struct mg_connection *c, const void *buf, size_t len, int op);
+
+// Decompresses a message that arrived with WS_RSV1 set, -1 if it can not be
+int ws_inflate(struct mg_connection *c, struct mg_str in, struct mg_iobuf *out);
+
+void ws_deflate_close(struct mg_connection *c);
+const ws_deflate_stats_t *ws_deflate_stats(void);
+
+#endif //NORA_C_WS_DEFLATE_H
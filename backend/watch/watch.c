@@ -0,0 +1,151 @@
+#include "watch.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../webDriver/src/utils/utils.h"
+
+typedef struct {
+    int wd;
+    uint32_t mask;
+    watch_cb_t cb;
+    void *ctx;
+} subscriber_t;
+
+static int inotify_fd = -1;
+static subscriber_t *subscribers = NULL;
+static int subscribers_count = 0;
+static int subscribers_capacity = 0;
+static int dispatching = 0;
+
+int watch_init(void) {
+    if (inotify_fd >= 0) {
+        return 0;
+    }
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        DEBUG("inotify_init1 failed: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void watch_free(void) {
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    free(subscribers);
+    subscribers = NULL;
+    subscribers_count = subscribers_capacity = 0;
+}
+
+int watch_add(const char *path, uint32_t mask, watch_cb_t cb, void *ctx) {
+    if (inotify_fd < 0) {
+        return -1;
+    }
+
+    int wd = inotify_add_watch(inotify_fd, path, mask | IN_MASK_ADD);
+    if (wd < 0) {
+        DEBUG("inotify_add_watch(%s) failed: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (subscribers_count == subscribers_capacity) {
+        int capacity = subscribers_capacity ? subscribers_capacity * 2 : 64;
+        subscriber_t *tmp = realloc(subscribers, capacity * sizeof(subscriber_t));
+        if (!tmp) {
+            return -1;
+        }
+        subscribers = tmp;
+        subscribers_capacity = capacity;
+    }
+
+    subscribers[subscribers_count++] = (subscriber_t) {.wd = wd, .mask = mask, .cb = cb, .ctx = ctx};
+    return wd;
+}
+
+static void compact(void) {
+    int j = 0;
+    for (int i = 0; i < subscribers_count; i++) {
+        if (subscribers[i].cb != NULL) {
+            subscribers[j++] = subscribers[i];
+        }
+    }
+    subscribers_count = j;
+}
+
+void watch_remove(int wd, watch_cb_t cb, void *ctx) {
+    int remaining = 0;
+    for (int i = 0; i < subscribers_count; i++) {
+        if (subscribers[i].wd != wd || subscribers[i].cb == NULL) {
+            continue;
+        }
+        if (subscribers[i].cb == cb && subscribers[i].ctx == ctx) {
+            subscribers[i].cb = NULL; // compacted once dispatch is over
+        } else {
+            remaining++;
+        }
+    }
+
+    if (remaining == 0 && inotify_fd >= 0) {
+        inotify_rm_watch(inotify_fd, wd);
+    }
+    if (!dispatching) {
+        compact();
+    }
+}
+
+int watch_count(void) {
+    return subscribers_count;
+}
+
+static void dispatch(const struct inotify_event *ev) {
+    // callbacks may add or remove subscribers, so re-read the count every time
+    for (int i = 0; i < subscribers_count; i++) {
+        subscriber_t s = subscribers[i];
+        if (s.cb == NULL) {
+            continue;
+        }
+        if (ev->mask & IN_Q_OVERFLOW) {
+            s.cb(ev, s.ctx);
+        } else if (s.wd == ev->wd && (ev->mask & (s.mask | IN_IGNORED))) {
+            s.cb(ev, s.ctx);
+        }
+    }
+
+    // the kernel dropped the watch (directory gone), forget its subscribers
+    if (ev->mask & IN_IGNORED) {
+        for (int i = 0; i < subscribers_count; i++) {
+            if (subscribers[i].wd == ev->wd) {
+                subscribers[i].cb = NULL;
+            }
+        }
+    }
+}
+
+void watch_poll(void) {
+    if (inotify_fd < 0) {
+        return;
+    }
+
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    dispatching = 1;
+    for (;;) {
+        ssize_t n = read(inotify_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *) p;
+            dispatch(ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    dispatching = 0;
+    compact();
+}
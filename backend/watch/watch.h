@@ -0,0 +1,26 @@
+#ifndef NORA_C_WATCH_H
+#define NORA_C_WATCH_H
+
+#include <stdint.h>
+#include <sys/inotify.h>
+
+/*
+ Single inotify instance shared by the backend caches. Several subscribers
+ can watch the same directory; their masks are merged with IN_MASK_ADD.
+ watch_poll() is called from the backend loop after every mg_mgr_poll, so
+ callbacks always run on the backend thread.
+ An IN_Q_OVERFLOW event (wd == -1) is delivered to every subscriber.
+ */
+
+typedef void (*watch_cb_t)(const struct inotify_event *ev, void *ctx);
+
+int watch_init(void);
+void watch_free(void);
+
+int watch_add(const char *path, uint32_t mask, watch_cb_t cb, void *ctx);
+void watch_remove(int wd, watch_cb_t cb, void *ctx);
+int watch_count(void);
+
+void watch_poll(void);
+
+#endif //NORA_C_WATCH_H
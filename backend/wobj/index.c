@@ -0,0 +1,427 @@
+#include "index.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../lib/Mongoose/mongoose.h"
+#include "../../webDriver/src/utils/utils.h"
+#include "../cache/tree.h"
+#include "../cache/writeback.h"
+#include "../fs/fs.h"
+#include "../utils/utils.h"
+
+#define OBJECTS_ROOT "objects"
+#define WOBJ_SUFFIX ".wobj"
+
+/*
+ File layout, in host byte order:
+ header | uint32 buckets[bucket_count] | object_rec_t[object_count] | selector_rec_t[selector_count] | strings
+ A bucket holds an object index + 1 (0 for empty), probed linearly from hash & (bucket_count - 1).
+ Names, labels and values are offsets of NUL-terminated strings.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t object_count;
+    uint32_t selector_count;
+    uint32_t bucket_count; // power of two
+    uint32_t strings_len;
+    uint32_t reserved;
+} header_t;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t name;
+    uint32_t first; // first selector
+    uint32_t count;
+    uint32_t reserved;
+    // source file when it was compiled, all 0 when it came from a pending save
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} object_rec_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t label;
+    uint32_t value;
+} selector_rec_t;
+
+struct wobj_index {
+    char project[256];
+    char *data; // file image, NULL for a free slot
+    size_t len;
+    const header_t *header;
+    const uint32_t *buckets;
+    const object_rec_t *objects;
+    const selector_rec_t *selectors;
+    const char *strings;
+    unsigned long used;
+};
+
+typedef struct {
+    const char *project;
+    const wobj_index_t *old; // NULL when there is no usable table yet
+    struct mg_iobuf objects;
+    struct mg_iobuf selectors;
+    struct mg_iobuf strings;
+    int reused;
+    int compiled;
+    int failed; // out of memory, the table is not replaced
+} builder_t;
+
+static wobj_index_t indexes[WOBJ_INDEX_MAX_PROJECTS];
+static unsigned long tick = 0;
+
+static uint64_t name_hash(const char *name) {
+    return fnv1a(FNV1A_INIT, name, strlen(name));
+}
+
+static void index_clear(wobj_index_t *idx) {
+    free(idx->data);
+    memset(idx, 0, sizeof(*idx));
+}
+
+// Points idx at data (malloc'd, owned) after checking every offset in it; -1 leaves idx untouched
+static int index_attach(wobj_index_t *idx, char *data, size_t len) {
+    if (len < sizeof(header_t)) {
+        return -1;
+    }
+    const header_t *h = (const header_t *) data;
+    if (memcmp(h->magic, WOBJ_INDEX_MAGIC, sizeof(h->magic)) != 0 || h->version != WOBJ_INDEX_VERSION ||
+        h->bucket_count == 0 || (h->bucket_count & (h->bucket_count - 1)) != 0 ||
+        h->object_count >= h->bucket_count || h->strings_len == 0) {
+        return -1;
+    }
+
+    uint64_t expected = sizeof(header_t) + (uint64_t) h->bucket_count * sizeof(uint32_t) +
+                        (uint64_t) h->object_count * sizeof(object_rec_t) +
+                        (uint64_t) h->selector_count * sizeof(selector_rec_t) + h->strings_len;
+    if (expected != len) {
+        return -1;
+    }
+
+    const uint32_t *buckets = (const uint32_t *) (h + 1);
+    const object_rec_t *objects = (const object_rec_t *) (buckets + h->bucket_count);
+    const selector_rec_t *selectors = (const selector_rec_t *) (objects + h->object_count);
+    const char *strings = (const char *) (selectors + h->selector_count);
+    if (strings[h->strings_len - 1] != '\0') {
+        return -1;
+    }
+    for (uint32_t i = 0; i < h->bucket_count; i++) {
+        if (buckets[i] > h->object_count) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < h->object_count; i++) {
+        const object_rec_t *o = &objects[i];
+        if (o->name >= h->strings_len || o->first > h->selector_count || o->count > h->selector_count - o->first) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < h->selector_count; i++) {
+        const selector_rec_t *sel = &selectors[i];
+        if (sel->type >= WOBJ_TYPES || sel->label >= h->strings_len || sel->value >= h->strings_len) {
+            return -1;
+        }
+    }
+
+    free(idx->data);
+    idx->data = data;
+    idx->len = len;
+    idx->header = h;
+    idx->buckets = buckets;
+    idx->objects = objects;
+    idx->selectors = selectors;
+    idx->strings = strings;
+    return 0;
+}
+
+static const object_rec_t *index_find(const wobj_index_t *idx, const char *name) {
+    uint64_t hash = name_hash(name);
+    uint32_t mask = idx->header->bucket_count - 1;
+    for (uint32_t i = (uint32_t) hash & mask, n = 0; n <= mask; i = (i + 1) & mask, n++) {
+        uint32_t slot = idx->buckets[i];
+        if (slot == 0) {
+            return NULL;
+        }
+        const object_rec_t *o = &idx->objects[slot - 1];
+        if (o->hash == hash && strcmp(idx->strings + o->name, name) == 0) {
+            return o;
+        }
+    }
+    return NULL;
+}
+
+static char *read_file(const char *project, const char *path, size_t *len) {
+    FILE *f = fs_fopen(project, path, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fileno(f), &st) == 0 && (data = malloc((size_t) st.st_size + 1)) != NULL) {
+        *len = fread(data, 1, (size_t) st.st_size, f);
+        data[*len] = '\0';
+    }
+    fclose(f);
+    return data;
+}
+
+static void append(builder_t *b, struct mg_iobuf *io, const void *data, size_t len) {
+    size_t before = io->len;
+    mg_iobuf_add(io, io->len, data, len);
+    if (io->len != before + len) {
+        b->failed = 1;
+    }
+}
+
+// Adds a NUL-terminated string to the string table, returns its offset
+static uint32_t add_string(builder_t *b, const char *s, size_t len) {
+    uint32_t offset = (uint32_t) b->strings.len;
+    append(b, &b->strings, s, len);
+    append(b, &b->strings, "", 1);
+    return offset;
+}
+
+static void add_selector(builder_t *b, wobj_type_t type, const char *label, size_t label_len, const char *value,
+                         size_t value_len) {
+    selector_rec_t rec = {.type = (uint32_t) type};
+    rec.label = add_string(b, label, label_len);
+    rec.value = add_string(b, value, value_len);
+    append(b, &b->selectors, &rec, sizeof(rec));
+}
+
+static void on_selector(const wobj_selector_t *selector, void *ctx) {
+    builder_t *b = ctx;
+    // unescaping never makes a string longer
+    char *buf = malloc(selector->label_len + selector->value_len + 1);
+    if (!buf) {
+        b->failed = 1;
+        return;
+    }
+
+    size_t label_len = wobj_unescape(selector->label, selector->label_len, buf);
+    size_t value_len = wobj_unescape(selector->value, selector->value_len, buf + label_len);
+    add_selector(b, selector->type, buf, label_len, buf + label_len, value_len);
+    free(buf);
+}
+
+static void add_object(builder_t *b, const char *path, const char *name, const struct stat *st) {
+    object_rec_t rec = {.hash = name_hash(name), .first = (uint32_t) (b->selectors.len / sizeof(selector_rec_t))};
+    if (st) {
+        rec.ino = (uint64_t) st->st_ino;
+        rec.size = (int64_t) st->st_size;
+        rec.mtime_sec = (int64_t) st->st_mtim.tv_sec;
+        rec.mtime_nsec = (int64_t) st->st_mtim.tv_nsec;
+    }
+
+    // a save still waiting in the write-behind buffer is newer than the file
+    const content_t *pending = writeback_get(b->project, path, NULL);
+
+    // unchanged since the last compile, its selectors are copied over
+    const object_rec_t *old = b->old && st && !pending ? index_find(b->old, name) : NULL;
+    if (old && old->ino == rec.ino && old->size == rec.size && old->mtime_sec == rec.mtime_sec &&
+        old->mtime_nsec == rec.mtime_nsec) {
+        for (uint32_t i = 0; i < old->count; i++) {
+            const selector_rec_t *sel = &b->old->selectors[old->first + i];
+            const char *label = b->old->strings + sel->label, *value = b->old->strings + sel->value;
+            add_selector(b, (wobj_type_t) sel->type, label, strlen(label), value, strlen(value));
+        }
+        b->reused++;
+    } else {
+        size_t len = 0;
+        char *data = pending ? NULL : read_file(b->project, path, &len);
+        if (!pending && !data) {
+            return;
+        }
+
+        wobj_error_t err;
+        size_t mark = b->selectors.len;
+        int r = wobj_parse(pending ? pending->data : data, pending ? pending->len : len, on_selector, b, &err);
+        free(data);
+        if (r != 0) {
+            WARNING("Skipping %s/%s, invalid at byte %zu: %s", b->project, path, err.offset, err.message);
+            b->selectors.len = mark;
+            return;
+        }
+        if (pending) {
+            rec.ino = 0;
+            rec.size = 0;
+            rec.mtime_sec = 0;
+            rec.mtime_nsec = 0;
+        }
+        b->compiled++;
+    }
+
+    rec.count = (uint32_t) (b->selectors.len / sizeof(selector_rec_t)) - rec.first;
+    rec.name = add_string(b, name, strlen(name));
+    append(b, &b->objects, &rec, sizeof(rec));
+}
+
+// path is relative to the project, name to the objects folder
+static void scan_dir(builder_t *b, const char *path, const char *name, int depth) {
+    DIR *dir = fs_opendir(b->project, path);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || fs_is_temp(entry->d_name)) {
+            continue;
+        }
+
+        char sub_path[4096], sub_name[4096];
+        snprintf(sub_path, sizeof(sub_path), "%s/%s", path, entry->d_name);
+        snprintf(sub_name, sizeof(sub_name), "%s%s%s", name, *name ? "/" : "", entry->d_name);
+
+        struct stat st;
+        if (fs_stat(b->project, sub_path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (depth < TREE_MAX_DEPTH) {
+                scan_dir(b, sub_path, sub_name, depth + 1);
+            }
+            continue;
+        }
+
+        size_t n = strlen(sub_name), suffix = strlen(WOBJ_SUFFIX);
+        if (S_ISREG(st.st_mode) && n > suffix && strcmp(sub_name + n - suffix, WOBJ_SUFFIX) == 0) {
+            sub_name[n - suffix] = '\0';
+            add_object(b, sub_path, sub_name, &st);
+        }
+    }
+    closedir(dir);
+}
+
+// The file image of everything the builder collected
+static char *builder_image(builder_t *b, size_t *len) {
+    uint32_t object_count = (uint32_t) (b->objects.len / sizeof(object_rec_t));
+    uint32_t bucket_count = 8;
+    while (bucket_count < object_count * 2) {
+        bucket_count *= 2;
+    }
+    if (b->strings.len == 0) {
+        add_string(b, "", 0);
+    }
+
+    *len = sizeof(header_t) + bucket_count * sizeof(uint32_t) + b->objects.len + b->selectors.len + b->strings.len;
+    char *data = calloc(1, *len);
+    if (!data) {
+        return NULL;
+    }
+
+    header_t *h = (header_t *) data;
+    memcpy(h->magic, WOBJ_INDEX_MAGIC, sizeof(h->magic));
+    h->version = WOBJ_INDEX_VERSION;
+    h->object_count = object_count;
+    h->selector_count = (uint32_t) (b->selectors.len / sizeof(selector_rec_t));
+    h->bucket_count = bucket_count;
+    h->strings_len = (uint32_t) b->strings.len;
+
+    uint32_t *buckets = (uint32_t *) (h + 1);
+    const object_rec_t *objects = (const object_rec_t *) b->objects.buf;
+    for (uint32_t i = 0; i < object_count; i++) {
+        uint32_t slot = (uint32_t) objects[i].hash & (bucket_count - 1);
+        while (buckets[slot] != 0) {
+            slot = (slot + 1) & (bucket_count - 1);
+        }
+        buckets[slot] = i + 1;
+    }
+
+    char *p = (char *) (buckets + bucket_count);
+    memcpy(p, b->objects.buf, b->objects.len);
+    p += b->objects.len;
+    memcpy(p, b->selectors.buf, b->selectors.len);
+    p += b->selectors.len;
+    memcpy(p, b->strings.buf, b->strings.len);
+    return data;
+}
+
+static wobj_index_t *index_slot(const char *project) {
+    wobj_index_t *free_slot = NULL, *oldest = NULL;
+    for (int i = 0; i < WOBJ_INDEX_MAX_PROJECTS; i++) {
+        wobj_index_t *idx = &indexes[i];
+        if (idx->data && strcmp(idx->project, project) == 0) {
+            return idx;
+        }
+        if (!idx->data) {
+            free_slot = free_slot ? free_slot : idx;
+        } else if (!oldest || idx->used < oldest->used) {
+            oldest = idx;
+        }
+    }
+
+    wobj_index_t *idx = free_slot ? free_slot : oldest;
+    index_clear(idx);
+    snprintf(idx->project, sizeof(idx->project), "%s", project);
+
+    // the table left on disk by an earlier run
+    size_t len = 0;
+    char *data = read_file(project, WOBJ_INDEX_FILE, &len);
+    if (data && index_attach(idx, data, len) != 0) {
+        DEBUG("Ignoring the unreadable object index of %s", project);
+        free(data);
+    }
+    return idx;
+}
+
+const wobj_index_t *wobj_index_get(const char *project) {
+    struct stat st;
+    if (fs_stat(project, OBJECTS_ROOT, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+
+    wobj_index_t *idx = index_slot(project);
+    idx->used = ++tick;
+
+    builder_t b = {
+        .project = project,
+        .old = idx->data ? idx : NULL,
+        .objects = {.align = 4096},
+        .selectors = {.align = 4096},
+        .strings = {.align = 4096},
+    };
+    scan_dir(&b, OBJECTS_ROOT, "", 0);
+
+    int objects = (int) (b.objects.len / sizeof(object_rec_t));
+    if (!b.failed && (b.compiled > 0 || !b.old || objects != (int) idx->header->object_count)) {
+        size_t len;
+        char *data = builder_image(&b, &len);
+        if (data && index_attach(idx, data, len) == 0) {
+            if (fs_write_atomic(project, WOBJ_INDEX_FILE, idx->data, idx->len, NULL) != 0) {
+                WARNING("Failed to store the object index of %s", project);
+            }
+            DEBUG("Object index of %s: %d compiled, %d unchanged", project, b.compiled, b.reused);
+        } else {
+            free(data);
+        }
+    }
+
+    mg_iobuf_free(&b.objects);
+    mg_iobuf_free(&b.selectors);
+    mg_iobuf_free(&b.strings);
+    return idx->data ? idx : NULL;
+}
+
+void wobj_index_forget(const char *project) {
+    for (int i = 0; i < WOBJ_INDEX_MAX_PROJECTS; i++) {
+        if (indexes[i].data && strcmp(indexes[i].project, project) == 0) {
+            index_clear(&indexes[i]);
+        }
+    }
+}
+
+void wobj_index_free(void) {
+    for (int i = 0; i < WOBJ_INDEX_MAX_PROJECTS; i++) {
+        index_clear(&indexes[i]);
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef NORA_C_WOBJ_INDEX_H
+#define NORA_C_WOBJ_INDEX_H
+
+#include "wobj.h"
+
+/*
+ Compiled object repository of a project. Every objects/NAME.wobj is compiled
+ into one binary table, object name (e.g. "login/button") to its selectors in
+ fallback order, so a running scene resolves an object with a hash probe and
+ no JSON parsing. The table is kept in memory for the recently used projects
+ and stored as WOBJ_INDEX_FILE in the project directory, which the listings
+ never show. Each source file is recorded with its inode, size and mtime, and
+ wobj_index_get() only recompiles the files that changed since the table was
+ written. Invalid .wobj files are left out with a warning. Runs do not build it
+ yet, they do not execute steps; lookups come with step execution.
+ Only touched from the backend thread.
+ */
+
+#define WOBJ_INDEX_FILE ".objects.idx"
+#define WOBJ_INDEX_MAGIC "NORAWOBJ"
+#define WOBJ_INDEX_VERSION 1
+#define WOBJ_INDEX_MAX_PROJECTS 8
+
+typedef struct wobj_index wobj_index_t;
+
+// Brings the table of project up to date; NULL if its objects folder can not be read.
+// Valid until the next wobj_index_get(), wobj_index_forget() or wobj_index_free().
+const wobj_index_t *wobj_index_get(const char *project);
+
+// Drops the table of a project that went away
+void wobj_index_forget(const char *project);
+void wobj_index_free(void);
+
+#endif //NORA_C_WOBJ_INDEX_H
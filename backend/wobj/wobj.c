@@ -0,0 +1,496 @@
+#include "wobj.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct {
+    const char *start;
+    const char *p;
+    const char *end;
+    const char *error; // where the first problem was found
+    const char *message;
+    wobj_selector_cb_t cb;
+    void *ctx;
+} scanner_t;
+
+// members every selector must have, as bits of the seen mask
+#define MEMBER_TYPE 1
+#define MEMBER_LABEL 2
+#define MEMBER_VALUE 4
+#define MEMBER_ALL (MEMBER_TYPE | MEMBER_LABEL | MEMBER_VALUE)
+
+static const char *const selector_types[WOBJ_TYPES] = {
+    "CSS_SELECTOR", "LINK_TEXT_SELECTOR", "PARTIAL_LINK_TEXT_SELECTOR", "TAG_NAME", "XPATH_SELECTOR",
+};
+
+static int fail(scanner_t *s, const char *at, const char *message) {
+    if (!s->error) {
+        s->error = at;
+        s->message = message;
+    }
+    return -1;
+}
+
+static int is_ws(char ch) {
+    return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t';
+}
+
+static void skip_ws(scanner_t *s) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' '), nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r'), tab = _mm_set1_epi8('\t');
+    while (s->end - s->p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) s->p);
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, nl)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, tab)));
+        unsigned mask = ~(unsigned) _mm_movemask_epi8(ws) & 0xffff;
+        if (mask) {
+            s->p += __builtin_ctz(mask);
+            return;
+        }
+        s->p += 16;
+    }
+#endif
+    while (s->p < s->end && is_ws(*s->p)) {
+        s->p++;
+    }
+}
+
+// Advances to the next '"', '\\' or control character inside a string
+static void skip_string_run(scanner_t *s) {
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    while (s->end - s->p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) s->p);
+        // unsigned v <= 0x1f
+        __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, control), v);
+        __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)), low);
+        unsigned mask = (unsigned) _mm_movemask_epi8(stop);
+        if (mask) {
+            s->p += __builtin_ctz(mask);
+            return;
+        }
+        s->p += 16;
+    }
+#endif
+    while (s->p < s->end && *s->p != '"' && *s->p != '\\' && (unsigned char) *s->p >= 0x20) {
+        s->p++;
+    }
+}
+
+static int is_hex(char ch) {
+    return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+// Scans a string starting at its opening quote; body/body_len get the raw text between the quotes
+static int scan_string(scanner_t *s, const char **body, size_t *body_len) {
+    const char *open = s->p++;
+    for (;;) {
+        skip_string_run(s);
+        if (s->p >= s->end) {
+            return fail(s, open, "Unterminated string");
+        }
+
+        char ch = *s->p;
+        if (ch == '"') {
+            break;
+        }
+        if (ch != '\\') {
+            return fail(s, s->p, "Control character in string");
+        }
+        if (s->end - s->p < 2) {
+            return fail(s, s->p, "Unterminated string");
+        }
+
+        switch (s->p[1]) {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                s->p += 2;
+                break;
+            case 'u':
+                if (s->end - s->p < 6 || !is_hex(s->p[2]) || !is_hex(s->p[3]) || !is_hex(s->p[4]) ||
+                    !is_hex(s->p[5])) {
+                    return fail(s, s->p, "Invalid \\u escape");
+                }
+                s->p += 6;
+                break;
+            default:
+                return fail(s, s->p, "Invalid escape");
+        }
+    }
+
+    if (body) {
+        *body = open + 1;
+        *body_len = (size_t) (s->p - open - 1);
+    }
+    s->p++;
+    return 0;
+}
+
+static int scan_digits(scanner_t *s) {
+    const char *from = s->p;
+    while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+        s->p++;
+    }
+    return s->p > from ? 0 : fail(s, s->p, "Invalid number");
+}
+
+static int scan_number(scanner_t *s) {
+    if (*s->p == '-') {
+        s->p++;
+    }
+    if (s->p < s->end && *s->p == '0') {
+        s->p++;
+    } else if (scan_digits(s) != 0) {
+        return -1;
+    }
+    if (s->p < s->end && *s->p == '.') {
+        s->p++;
+        if (scan_digits(s) != 0) {
+            return -1;
+        }
+    }
+    if (s->p < s->end && (*s->p == 'e' || *s->p == 'E')) {
+        s->p++;
+        if (s->p < s->end && (*s->p == '+' || *s->p == '-')) {
+            s->p++;
+        }
+        if (scan_digits(s) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int scan_literal(scanner_t *s, const char *word) {
+    size_t n = strlen(word);
+    if ((size_t) (s->end - s->p) < n || memcmp(s->p, word, n) != 0) {
+        return fail(s, s->p, "Unexpected character");
+    }
+    s->p += n;
+    return 0;
+}
+
+static int scan_value(scanner_t *s, int depth);
+
+static int scan_object(scanner_t *s, int depth) {
+    s->p++;
+    skip_ws(s);
+    if (s->p < s->end && *s->p == '}') {
+        s->p++;
+        return 0;
+    }
+
+    for (;;) {
+        skip_ws(s);
+        if (s->p >= s->end || *s->p != '"') {
+            return fail(s, s->p, "Expected a member name");
+        }
+        if (scan_string(s, NULL, NULL) != 0) {
+            return -1;
+        }
+        skip_ws(s);
+        if (s->p >= s->end || *s->p != ':') {
+            return fail(s, s->p, "Expected ':'");
+        }
+        s->p++;
+        skip_ws(s);
+        if (scan_value(s, depth) != 0) {
+            return -1;
+        }
+        skip_ws(s);
+        if (s->p < s->end && *s->p == ',') {
+            s->p++;
+            continue;
+        }
+        if (s->p < s->end && *s->p == '}') {
+            s->p++;
+            return 0;
+        }
+        return fail(s, s->p, "Expected ',' or '}'");
+    }
+}
+
+static int scan_array(scanner_t *s, int depth) {
+    s->p++;
+    skip_ws(s);
+    if (s->p < s->end && *s->p == ']') {
+        s->p++;
+        return 0;
+    }
+
+    for (;;) {
+        skip_ws(s);
+        if (scan_value(s, depth) != 0) {
+            return -1;
+        }
+        skip_ws(s);
+        if (s->p < s->end && *s->p == ',') {
+            s->p++;
+            continue;
+        }
+        if (s->p < s->end && *s->p == ']') {
+            s->p++;
+            return 0;
+        }
+        return fail(s, s->p, "Expected ',' or ']'");
+    }
+}
+
+// Any JSON value, for the members the schema does not look into
+static int scan_value(scanner_t *s, int depth) {
+    if (s->p >= s->end) {
+        return fail(s, s->p, "Unexpected end of file");
+    }
+    if (depth >= WOBJ_MAX_DEPTH) {
+        return fail(s, s->p, "Nested too deeply");
+    }
+
+    switch (*s->p) {
+        case '{':
+            return scan_object(s, depth + 1);
+        case '[':
+            return scan_array(s, depth + 1);
+        case '"':
+            return scan_string(s, NULL, NULL);
+        case 't':
+            return scan_literal(s, "true");
+        case 'f':
+            return scan_literal(s, "false");
+        case 'n':
+            return scan_literal(s, "null");
+        default:
+            if (*s->p == '-' || (*s->p >= '0' && *s->p <= '9')) {
+                return scan_number(s);
+            }
+            return fail(s, s->p, "Unexpected character");
+    }
+}
+
+static int str_equals(const char *body, size_t len, const char *word) {
+    return strlen(word) == len && memcmp(body, word, len) == 0;
+}
+
+// -1 for a name that is not a selector type
+static int find_type(const char *body, size_t len) {
+    for (int i = 0; i < WOBJ_TYPES; i++) {
+        if (str_equals(body, len, selector_types[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// One selector: {"type": ..., "label": ..., "value": ...}
+static int scan_selector(scanner_t *s) {
+    const char *open = s->p;
+    if (s->p >= s->end || *s->p != '{') {
+        return fail(s, s->p, "Expected a selector object");
+    }
+    s->p++;
+
+    int seen = 0;
+    wobj_selector_t selector = {0};
+    skip_ws(s);
+    while (s->p < s->end && *s->p != '}') {
+        const char *name_at = s->p, *name;
+        size_t name_len;
+        if (*s->p != '"') {
+            return fail(s, s->p, "Expected a member name");
+        }
+        if (scan_string(s, &name, &name_len) != 0) {
+            return -1;
+        }
+        skip_ws(s);
+        if (s->p >= s->end || *s->p != ':') {
+            return fail(s, s->p, "Expected ':'");
+        }
+        s->p++;
+        skip_ws(s);
+
+        int member = str_equals(name, name_len, "type") ? MEMBER_TYPE
+                     : str_equals(name, name_len, "label") ? MEMBER_LABEL
+                     : str_equals(name, name_len, "value") ? MEMBER_VALUE : 0;
+        if (member & seen) {
+            return fail(s, name_at, "Duplicate selector member");
+        }
+        seen |= member;
+
+        if (member) {
+            const char *value_at = s->p, *value;
+            size_t value_len;
+            if (s->p >= s->end || *s->p != '"') {
+                return fail(s, s->p, "Selector 'type', 'label' and 'value' must be strings");
+            }
+            if (scan_string(s, &value, &value_len) != 0) {
+                return -1;
+            }
+            if (member == MEMBER_TYPE) {
+                int type = find_type(value, value_len);
+                if (type < 0) {
+                    return fail(s, value_at, "Unknown selector type, expected one of " WOBJ_SELECTOR_TYPES);
+                }
+                selector.type = (wobj_type_t) type;
+            } else if (member == MEMBER_LABEL) {
+                selector.label = value;
+                selector.label_len = value_len;
+            } else {
+                selector.value = value;
+                selector.value_len = value_len;
+            }
+        } else if (scan_value(s, 2) != 0) {
+            return -1;
+        }
+
+        skip_ws(s);
+        if (s->p < s->end && *s->p == ',') {
+            s->p++;
+            skip_ws(s);
+            if (s->p < s->end && *s->p == '}') {
+                return fail(s, s->p, "Expected a member name");
+            }
+        } else if (s->p >= s->end || *s->p != '}') {
+            return fail(s, s->p, "Expected ',' or '}'");
+        }
+    }
+    if (s->p >= s->end) {
+        return fail(s, s->p, "Unexpected end of file");
+    }
+    if (seen != MEMBER_ALL) {
+        return fail(s, open, "Selector needs string 'type', 'label' and 'value' members");
+    }
+    s->p++;
+    if (s->cb) {
+        s->cb(&selector, s->ctx);
+    }
+    return 0;
+}
+
+static int scan_file(scanner_t *s) {
+    skip_ws(s);
+    if (s->p >= s->end || *s->p != '[') {
+        return fail(s, s->p, "Expected an array of selectors");
+    }
+    s->p++;
+
+    skip_ws(s);
+    if (s->p < s->end && *s->p == ']') {
+        s->p++;
+    } else {
+        for (;;) {
+            skip_ws(s);
+            if (scan_selector(s) != 0) {
+                return -1;
+            }
+            skip_ws(s);
+            if (s->p < s->end && *s->p == ',') {
+                s->p++;
+                continue;
+            }
+            if (s->p < s->end && *s->p == ']') {
+                s->p++;
+                break;
+            }
+            return fail(s, s->p, "Expected ',' or ']'");
+        }
+    }
+
+    skip_ws(s);
+    return s->p == s->end ? 0 : fail(s, s->p, "Unexpected data after the selectors");
+}
+
+int wobj_validate(const char *data, size_t len, wobj_error_t *err) {
+    return wobj_parse(data, len, NULL, NULL, err);
+}
+
+int wobj_parse(const char *data, size_t len, wobj_selector_cb_t cb, void *ctx, wobj_error_t *err) {
+    scanner_t s = {.start = data, .p = data, .end = data + len, .cb = cb, .ctx = ctx};
+    if (scan_file(&s) == 0) {
+        return 0;
+    }
+    if (err) {
+        err->offset = (size_t) (s.error - s.start);
+        err->message = s.message;
+    }
+    return -1;
+}
+
+static unsigned hex_value(const char *p) {
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++) {
+        char ch = p[i];
+        v = v * 16 + (unsigned) (ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10);
+    }
+    return v;
+}
+
+static size_t put_utf8(unsigned cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char) cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char) (0xc0 | cp >> 6);
+        out[1] = (char) (0x80 | (cp & 0x3f));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char) (0xe0 | cp >> 12);
+        out[1] = (char) (0x80 | (cp >> 6 & 0x3f));
+        out[2] = (char) (0x80 | (cp & 0x3f));
+        return 3;
+    }
+    out[0] = (char) (0xf0 | cp >> 18);
+    out[1] = (char) (0x80 | (cp >> 12 & 0x3f));
+    out[2] = (char) (0x80 | (cp >> 6 & 0x3f));
+    out[3] = (char) (0x80 | (cp & 0x3f));
+    return 4;
+}
+
+size_t wobj_unescape(const char *raw, size_t len, char *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len;) {
+        if (raw[i] != '\\') {
+            out[n++] = raw[i++];
+            continue;
+        }
+
+        char ch = raw[i + 1];
+        i += 2;
+        switch (ch) {
+            case 'b': out[n++] = '\b'; break;
+            case 'f': out[n++] = '\f'; break;
+            case 'n': out[n++] = '\n'; break;
+            case 'r': out[n++] = '\r'; break;
+            case 't': out[n++] = '\t'; break;
+            case 'u': {
+                unsigned cp = hex_value(raw + i);
+                i += 4;
+                // a surrogate pair is one code point, a lone surrogate becomes U+FFFD
+                if (cp >= 0xd800 && cp < 0xdc00 && i + 6 <= len && raw[i] == '\\' && raw[i + 1] == 'u') {
+                    unsigned low = hex_value(raw + i + 2);
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        i += 6;
+                    }
+                }
+                if (cp >= 0xd800 && cp < 0xe000) {
+                    cp = 0xfffd;
+                }
+                n += put_utf8(cp, out + n);
+                break;
+            }
+            default:
+                out[n++] = ch; // '"', '\\' and '/'
+        }
+    }
+    return n;
+}
+
+const char *wobj_type_name(wobj_type_t type) {
+    return type < WOBJ_TYPES ? selector_types[type] : NULL;
+}
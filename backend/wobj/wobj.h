@@ -0,0 +1,54 @@
+#ifndef NORA_C_WOBJ_H
+#define NORA_C_WOBJ_H
+
+#include <stddef.h>
+
+/*
+ Validator for .wobj saves. One pass over the text checks the JSON grammar and
+ the object schema together, without allocating: the file is an array of
+ selectors, each an object with string "type", "label" and "value" members,
+ where "type" is one of the names below. Other members are allowed and only
+ checked for being valid JSON. Strings and whitespace are skipped 16 bytes at a
+ time with SSE2 where available.
+ */
+
+#define WOBJ_MAX_DEPTH 64
+#define WOBJ_SELECTOR_TYPES "CSS_SELECTOR, LINK_TEXT_SELECTOR, PARTIAL_LINK_TEXT_SELECTOR, TAG_NAME, XPATH_SELECTOR"
+
+typedef enum {
+    WOBJ_CSS_SELECTOR,
+    WOBJ_LINK_TEXT_SELECTOR,
+    WOBJ_PARTIAL_LINK_TEXT_SELECTOR,
+    WOBJ_TAG_NAME,
+    WOBJ_XPATH_SELECTOR,
+    WOBJ_TYPES
+} wobj_type_t;
+
+typedef struct {
+    size_t offset; // byte where the problem was found
+    const char *message;
+} wobj_error_t;
+
+// One selector as found in the text; label and value are still JSON-escaped
+typedef struct {
+    wobj_type_t type;
+    const char *label;
+    size_t label_len;
+    const char *value;
+    size_t value_len;
+} wobj_selector_t;
+
+typedef void (*wobj_selector_cb_t)(const wobj_selector_t *selector, void *ctx);
+
+// 0 if data is a valid .wobj file, otherwise -1 with err filled in (err may be NULL)
+int wobj_validate(const char *data, size_t len, wobj_error_t *err);
+
+// wobj_validate, calling cb for every selector in file order; a failure can follow some calls
+int wobj_parse(const char *data, size_t len, wobj_selector_cb_t cb, void *ctx, wobj_error_t *err);
+
+// Decodes the escapes of a validated string body into out (len bytes are always enough), returns the length
+size_t wobj_unescape(const char *raw, size_t len, char *out);
+
+const char *wobj_type_name(wobj_type_t type);
+
+#endif //NORA_C_WOBJ_H
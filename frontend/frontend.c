@@ -1,10 +1,121 @@
 #include "frontend.h"
+#include "packed.h"
+
+#define IMMUTABLE_CACHE "Cache-Control: public, max-age=31536000, immutable\r\n"
+#define REVALIDATE_CACHE "Cache-Control: no-cache\r\n"
+
+static char backend_hosts[600];
+
+static int compare_packed(const void *key, const void *file) {
+    const struct mg_str *uri = (const struct mg_str *) key;
+    const char *path = ((const packed_file_t *) file)->path;
+    size_t len = strlen(path);
+    int r = strncmp(uri->buf, path, uri->len < len ? uri->len : len);
+    if (r == 0) {
+        r = uri->len < len ? -1 : uri->len > len ? 1 : 0;
+    }
+    return r;
+}
+
+static const packed_file_t *find_packed(struct mg_str uri) {
+    if (uri.len == 1 && uri.buf[0] == '/') {
+        uri = mg_str("/index.html");
+    }
+    return bsearch(&uri, packed_files, packed_files_count, sizeof(packed_file_t), compare_packed);
+}
+
+// Accept-Encoding token check, honouring an explicit "q=0" refusal
+static int accepts_encoding(struct mg_http_message *hm, const char *encoding) {
+    struct mg_str *ae = mg_http_get_header(hm, "Accept-Encoding");
+    if (!ae) {
+        return 0;
+    }
+
+    struct mg_str s = *ae, entry, token, params;
+    while (mg_span(s, &entry, &s, ',')) {
+        if (!mg_span(entry, &token, &params, ';')) {
+            token = entry;
+            params = mg_str("");
+        }
+        while (token.len > 0 && token.buf[0] == ' ') {
+            token.buf++;
+            token.len--;
+        }
+        while (token.len > 0 && token.buf[token.len - 1] == ' ') {
+            token.len--;
+        }
+        if (mg_strcasecmp(token, mg_str(encoding)) == 0) {
+            return !mg_match(params, mg_str("*q=0"), NULL) && !mg_match(params, mg_str("*q=0.0*"), NULL);
+        }
+    }
+    return 0;
+}
+
+static void serve_packed(struct mg_connection *c, struct mg_http_message *hm, const packed_file_t *f) {
+    const unsigned char *body = f->data;
+    size_t size = f->size;
+    const char *encoding = NULL;
+
+    if (f->br && accepts_encoding(hm, "br")) {
+        body = f->br;
+        size = f->br_size;
+        encoding = "br";
+    } else if (f->gzip && accepts_encoding(hm, "gzip")) {
+        body = f->gzip;
+        size = f->gzip_size;
+        encoding = "gzip";
+    }
+
+    // each encoding is its own representation, so it gets its own strong ETag
+    char etag[40];
+    snprintf(etag, sizeof(etag), "\"%s%s%s\"", f->etag, encoding ? "-" : "", encoding ? encoding : "");
+    const char *cache = f->immutable ? IMMUTABLE_CACHE : REVALIDATE_CACHE;
+
+    struct mg_str *inm = mg_http_get_header(hm, "If-None-Match");
+    if (inm && memmem(inm->buf, inm->len, etag, strlen(etag)) != NULL) {
+        mg_printf(c, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%sVary: Accept-Encoding\r\n\r\n", etag, cache);
+        return;
+    }
+
+    mg_printf(c,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: %s\r\n"
+              "Content-Length: %lu\r\n"
+              "ETag: %s\r\n"
+              "%s"
+              "Vary: Accept-Encoding\r\n"
+              "%s%s%s"
+              "\r\n",
+              f->mime, (unsigned long) size, etag, cache,
+              encoding ? "Content-Encoding: " : "", encoding ? encoding : "", encoding ? "\r\n" : "");
+
+    if (!mg_match(hm->method, mg_str("HEAD"), NULL)) {
+        mg_send(c, body, size);
+    }
+}
 
 static void ev_handler(struct mg_connection *c, int ev, void *ev_data) {
     if (ev == MG_EV_HTTP_MSG) {
         struct mg_http_message *hm = (struct mg_http_message *) ev_data;
-        struct mg_http_serve_opts opts = {.root_dir = "./frontend/web/dist"};
-        mg_http_serve_dir(c, hm, &opts);
+
+        if (mg_match(hm->uri, mg_str("/backend.txt"), NULL)) {
+            mg_http_reply(c, 200, "Content-Type: text/plain\r\n" REVALIDATE_CACHE, "%s", backend_hosts);
+            return;
+        }
+
+        // no UI embedded (e.g. built without a dist), serve it from disk
+        if (packed_files_count == 0) {
+            struct mg_http_serve_opts opts = {.root_dir = "./frontend/web/dist"};
+            mg_http_serve_dir(c, hm, &opts);
+            return;
+        }
+
+        const packed_file_t *f = find_packed(hm->uri);
+        if (f) {
+            serve_packed(c, hm, f);
+        } else {
+            mg_http_reply(c, 404, "Content-Type: text/plain\r\n", "Not found\n");
+        }
     }
 }
 
@@ -15,22 +126,15 @@ int save_backend_hosts(threads_args_t *args) {
     char ws_listen_addr[256];
     snprintf(ws_listen_addr, sizeof(ws_listen_addr), "ws://%s:%d", args->server_host, args->ws_port);
 
-    FILE *file = fopen("frontend/web/dist/backend.txt", "w");
-    if (file == NULL) {
-        return 1;
-    }
-
-    fprintf(file, "%s\n%s\n", listen_addr, ws_listen_addr);
-    fclose(file);
+    snprintf(backend_hosts, sizeof(backend_hosts), "%s\n%s\n", listen_addr, ws_listen_addr);
 
-    file = fopen("frontend/web/public/backend.txt", "w");
-    if (file == NULL) {
-        return 1;
+    // the vite dev server still reads it from public/, only there when running from the repo
+    FILE *file = fopen("frontend/web/public/backend.txt", "w");
+    if (file != NULL) {
+        fprintf(file, "%s", backend_hosts);
+        fclose(file);
     }
 
-    fprintf(file, "%s\n%s\n", listen_addr, ws_listen_addr);
-    fclose(file);
-
     return 0;
 }
 
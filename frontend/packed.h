@@ -0,0 +1,28 @@
+#ifndef NORA_C_PACKED_H
+#define NORA_C_PACKED_H
+
+#include <stddef.h>
+
+/*
+ Web UI assets embedded into the binary at build time (see tools/pack.c).
+ The table is sorted by path so it can be searched with bsearch. etag is the
+ hex hash of the original content. gzip/br are NULL when the precompressed
+ variant was not smaller.
+ */
+typedef struct {
+    const char *path;
+    const char *mime;
+    const char *etag;
+    int immutable;
+    const unsigned char *data;
+    size_t size;
+    const unsigned char *gzip;
+    size_t gzip_size;
+    const unsigned char *br;
+    size_t br_size;
+} packed_file_t;
+
+extern const packed_file_t packed_files[];
+extern const size_t packed_files_count;
+
+#endif //NORA_C_PACKED_H
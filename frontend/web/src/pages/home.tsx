@@ -116,7 +116,7 @@ export function Home({project, canRunCurrentFile}: HomeProps) {
         try {
             setIsGlobalLoading?.(true);
             await socket.connect(wsURL);
-            await socket.send({type: 'run_all', projectName: project.name, ts: Date.now()});
+            await socket.runAllFiles(project.name);
         } catch (err: any) {
             showError && showError(err?.message || "Failed to start run-all.");
         } finally {
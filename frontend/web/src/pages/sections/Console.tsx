@@ -107,6 +107,8 @@ export function Console({consoleHeight, scrollbarClasses, setIsConsoleOpen}: Con
             }
             if (msg && msg.type === "pong") {
                 // ignore or show heartbeat
+            } else if (msg && (msg.type === "fs" || msg.type === "subscribed" || msg.type === "runs")) {
+                // file-system events are handled by the explorer, run lists by the socket
             } else {
                 const line = toConsoleLine(msg);
                 if (line.type === "end") {
@@ -119,7 +121,13 @@ export function Console({consoleHeight, scrollbarClasses, setIsConsoleOpen}: Con
 
         // small status refresher: if ws URL exists, show connected/disconnected
         if (wsURL) {
-            socket.connect(wsURL).then(() => setStatus("connected")).catch(() => setStatus("disconnected"));
+            socket.connect(wsURL)
+                .then(() => {
+                    setStatus("connected");
+                    // runs started in another tab or machine show up here too
+                    socket.attachRunning().catch(() => {});
+                })
+                .catch(() => setStatus("disconnected"));
         }
 
         return () => unsub();
@@ -5,6 +5,7 @@ import {Project} from "../../components/openProjetcModal";
 import {LoadingElement} from "../../components/LoadingElement";
 import {useAppContext} from "../../AppContext";
 import {ObjectEditor} from "../../components/ObjectEditor";
+import {diffEdit} from "../../utils/textPatch";
 
 monaco.editor.defineTheme("dark-neutral", {
     base: "vs-dark",
@@ -39,6 +40,9 @@ export function Editor({isSavedCallBack, file, project}: MonacoEditorProps) {
     const fileRef = useRef(file);
     const projectRef = useRef(project);
     const isSavedRef = useRef(true);
+    // last content known to be on disk and its hash, the base autosave patches are made against
+    const baseContentRef = useRef<string | null>(null);
+    const baseHashRef = useRef<string | null>(null);
 
     const isSavedCallBackRef = useRef(isSavedCallBack);
 
@@ -90,16 +94,23 @@ export function Editor({isSavedCallBack, file, project}: MonacoEditorProps) {
 
         if (!currentFile || !currentProject) return;
 
+        const post = (body: object) => fetch(`${backendURL}/files/update`, {
+            method: 'POST',
+            headers: {'Content-Type': 'application/json'},
+            body: JSON.stringify({projectName: currentProject.name, path: currentFile, ...body}),
+        });
+
         try {
-            const response = await fetch(`${backendURL}/files/update`, {
-                method: 'POST',
-                headers: {'Content-Type': 'application/json'},
-                body: JSON.stringify({
-                    content: contentToSave,
-                    projectName: currentProject.name,
-                    path: currentFile,
-                }),
-            });
+            const base = baseContentRef.current;
+            const edit = base !== null && baseHashRef.current ? diffEdit(base, contentToSave) : undefined;
+
+            // only the changed range goes over the wire; a stale base (409) falls back to the whole file
+            let response = edit !== undefined
+                ? await post({baseHash: baseHashRef.current, edits: edit ? [edit] : []})
+                : await post({content: contentToSave});
+            if (response.status === 409 && edit !== undefined) {
+                response = await post({content: contentToSave});
+            }
 
             if (!response.ok) {
                 const err = await response.json().catch(() => ({}));
@@ -107,6 +118,12 @@ export function Editor({isSavedCallBack, file, project}: MonacoEditorProps) {
                 return;
             }
 
+            const data = await response.json().catch(() => ({}));
+            if (fileRef.current === currentFile) {
+                baseContentRef.current = contentToSave;
+                baseHashRef.current = data.hash ?? null;
+            }
+
             setSaveState(true);
         } catch (err: any) {
             showError(err.message || 'Error saving file content');
@@ -135,6 +152,9 @@ export function Editor({isSavedCallBack, file, project}: MonacoEditorProps) {
 
                 const data = await response.json();
 
+                baseContentRef.current = data.content;
+                baseHashRef.current = data.hash ?? null;
+
                 if (editorInstance.current) {
                     editorInstance.current.setValue(data.content);
                     isSavedRef.current = true;
@@ -2,10 +2,11 @@ import {
     FolderTree, FolderX, RefreshCw,
 } from 'lucide-preact';
 import {Project} from "../../components/openProjetcModal";
-import {useEffect, useState} from "preact/hooks";
+import {useEffect, useRef, useState} from "preact/hooks";
 import {useAppContext} from "../../AppContext";
 import {ProjectTreeView} from "../../components/ProjectTree";
 import {LoadingElement} from "../../components/LoadingElement";
+import socket from "../../utils/socket";
 
 interface ExplorerProps {
     explorerWidth: number;
@@ -25,10 +26,70 @@ export interface ProjectTree {
     [key: string]: ProjectFile[];
 }
 
+interface FsEvent {
+    op: 'added' | 'removed' | 'renamed' | 'modified' | 'reset';
+    path?: string;
+    from?: string;
+    isFolder?: boolean;
+}
+
+// Applies pushed file-system events to a copy of the tree; null means the tree has to be refetched
+function applyFsEvents(tree: ProjectTree, events: FsEvent[]): ProjectTree | null {
+    const next: ProjectTree = JSON.parse(JSON.stringify(tree));
+
+    const locate = (path: string) => {
+        const parts = path.split('/');
+        let list = next[parts[0]];
+        if (!list || parts.length < 2) return null;
+        for (const part of parts.slice(1, -1)) {
+            const dir = list.find(f => f.isFolder && f.name === part);
+            if (!dir) return null;
+            if (!dir.children) dir.children = [];
+            list = dir.children;
+        }
+        return {list, name: parts[parts.length - 1], parent: parts[parts.length - 2]};
+    };
+
+    const detach = (path: string) => {
+        const at = locate(path);
+        const i = at ? at.list.findIndex(f => f.name === at.name) : -1;
+        return at && i >= 0 ? at.list.splice(i, 1)[0] : null;
+    };
+
+    const attach = (path: string, file: ProjectFile) => {
+        const at = locate(path);
+        if (!at) return false;
+        const i = at.list.findIndex(f => f.name === at.name);
+        if (i >= 0) at.list.splice(i, 1);
+        file.name = at.name;
+        file.topParent = at.parent;
+        file.children?.forEach(child => child.topParent = at.name);
+        at.list.push(file);
+        return true;
+    };
+
+    for (const ev of events) {
+        if (ev.op === 'reset' || !ev.path) return null;
+        if (ev.op === 'added') {
+            const file: ProjectFile = {name: '', topParent: '', isFolder: !!ev.isFolder};
+            if (ev.isFolder) file.children = [];
+            if (!attach(ev.path, file)) return null;
+        } else if (ev.op === 'removed') {
+            detach(ev.path);
+        } else if (ev.op === 'renamed') {
+            const file = ev.from ? detach(ev.from) : null;
+            if (!file || !attach(ev.path, file)) return null;
+        }
+    }
+    return next;
+}
+
 export function Explorer({explorerWidth, scrollbarClasses, project, onSelectFile}: ExplorerProps) {
     const [projectTree, setProjectTree] = useState<ProjectTree | null>(null);
-    const {backendURL, showError} = useAppContext();
+    const {backendURL, wsURL, showError} = useAppContext();
     const [reload, setReload] = useState<number>(0);
+    const treeRef = useRef<ProjectTree | null>(null);
+    treeRef.current = projectTree;
 
     useEffect(() => {
         if (project == null) return;
@@ -50,6 +111,33 @@ export function Explorer({explorerWidth, scrollbarClasses, project, onSelectFile
         });
     }, [project, reload]);
 
+    // live updates: the backend pushes changes of the open project instead of us refetching
+    useEffect(() => {
+        if (project == null || !wsURL) return;
+        const projectName = project.name;
+
+        const unsub = socket.subscribe((msg: any) => {
+            if (msg?.type !== 'fs' || msg.projectName !== projectName) return;
+            if (!treeRef.current) return;
+            const next = applyFsEvents(treeRef.current, msg.events ?? []);
+            if (next == null) {
+                setReload(r => r + 1);
+                return;
+            }
+            treeRef.current = next;
+            setProjectTree(next);
+        });
+
+        socket.connect(wsURL)
+            .then(() => socket.subscribeProject(projectName))
+            .catch((err) => console.error('Error subscribing to project changes:', err));
+
+        return () => {
+            unsub();
+            socket.unsubscribeProject(projectName).catch(() => {});
+        };
+    }, [project, wsURL]);
+
     return (
         <div
             style={{width: `${explorerWidth}px`}}
@@ -0,0 +1,182 @@
+// Minimal MessagePack codec for the binary /ws protocol ("nora.msgpack").
+// Covers what JSON can express: maps with string keys, arrays, strings, numbers, booleans and null.
+
+const encoder = new TextEncoder();
+const decoder = new TextDecoder();
+
+class Writer {
+    private buf = new Uint8Array(256);
+    private view = new DataView(this.buf.buffer);
+    len = 0;
+
+    private reserve(n: number) {
+        if (this.len + n <= this.buf.length) return;
+        let size = this.buf.length * 2;
+        while (size < this.len + n) size *= 2;
+        const next = new Uint8Array(size);
+        next.set(this.buf.subarray(0, this.len));
+        this.buf = next;
+        this.view = new DataView(next.buffer);
+    }
+
+    byte(b: number) {
+        this.reserve(1);
+        this.buf[this.len++] = b;
+    }
+
+    // a type byte followed by a big-endian unsigned of n bytes
+    typed(type: number, v: number, n: 1 | 2 | 4) {
+        this.reserve(1 + n);
+        this.buf[this.len++] = type;
+        if (n === 1) this.view.setUint8(this.len, v);
+        else if (n === 2) this.view.setUint16(this.len, v);
+        else this.view.setUint32(this.len, v);
+        this.len += n;
+    }
+
+    float64(v: number) {
+        this.reserve(9);
+        this.buf[this.len++] = 0xcb;
+        this.view.setFloat64(this.len, v);
+        this.len += 8;
+    }
+
+    int64(type: number, v: number) {
+        this.reserve(9);
+        this.buf[this.len++] = type;
+        this.view.setBigUint64(this.len, BigInt.asUintN(64, BigInt(v)));
+        this.len += 8;
+    }
+
+    bytes(b: Uint8Array) {
+        this.reserve(b.length);
+        this.buf.set(b, this.len);
+        this.len += b.length;
+    }
+
+    result() {
+        return this.buf.slice(0, this.len);
+    }
+}
+
+function header(w: Writer, n: number, fix: number, fixMax: number, t16: number, t32: number) {
+    if (n < fixMax) w.byte(fix | n);
+    else if (n <= 0xffff) w.typed(t16, n, 2);
+    else w.typed(t32, n, 4);
+}
+
+function writeNumber(w: Writer, v: number) {
+    if (!Number.isInteger(v) || !Number.isSafeInteger(v)) return w.float64(v);
+    if (v >= 0) {
+        if (v < 128) w.byte(v);
+        else if (v <= 0xff) w.typed(0xcc, v, 1);
+        else if (v <= 0xffff) w.typed(0xcd, v, 2);
+        else if (v <= 0xffffffff) w.typed(0xce, v, 4);
+        else w.int64(0xcf, v);
+    } else {
+        if (v >= -32) w.byte(v & 0xff);
+        else if (v >= -0x80) w.typed(0xd0, v & 0xff, 1);
+        else if (v >= -0x8000) w.typed(0xd1, v & 0xffff, 2);
+        else if (v >= -0x80000000) w.typed(0xd2, v >>> 0, 4);
+        else w.int64(0xd3, v);
+    }
+}
+
+function writeValue(w: Writer, v: any) {
+    if (v === null || v === undefined) return w.byte(0xc0);
+    if (v === true) return w.byte(0xc3);
+    if (v === false) return w.byte(0xc2);
+    if (typeof v === 'number') return writeNumber(w, v);
+    if (typeof v === 'string') {
+        const b = encoder.encode(v);
+        if (b.length < 32) w.byte(0xa0 | b.length);
+        else if (b.length <= 0xff) w.typed(0xd9, b.length, 1);
+        else if (b.length <= 0xffff) w.typed(0xda, b.length, 2);
+        else w.typed(0xdb, b.length, 4);
+        return w.bytes(b);
+    }
+    if (Array.isArray(v)) {
+        header(w, v.length, 0x90, 16, 0xdc, 0xdd);
+        v.forEach(item => writeValue(w, item));
+        return;
+    }
+    // like JSON.stringify, members that are undefined are left out
+    const entries = Object.entries(v).filter(([, value]) => value !== undefined);
+    header(w, entries.length, 0x80, 16, 0xde, 0xdf);
+    entries.forEach(([key, value]) => {
+        writeValue(w, key);
+        writeValue(w, value);
+    });
+}
+
+export function encode(value: any): Uint8Array {
+    const w = new Writer();
+    writeValue(w, value);
+    return w.result();
+}
+
+export function decode(data: ArrayBuffer): any {
+    const bytes = new Uint8Array(data);
+    const view = new DataView(data);
+    let pos = 0;
+
+    const str = (n: number) => {
+        const s = decoder.decode(bytes.subarray(pos, pos + n));
+        pos += n;
+        return s;
+    };
+    const items = (n: number, map: boolean) => {
+        if (map) {
+            const obj: Record<string, any> = {};
+            for (let i = 0; i < n; i++) {
+                const key = read();
+                obj[key] = read();
+            }
+            return obj;
+        }
+        const arr = new Array(n);
+        for (let i = 0; i < n; i++) arr[i] = read();
+        return arr;
+    };
+    const u = (n: 1 | 2 | 4) => {
+        const v = n === 1 ? view.getUint8(pos) : n === 2 ? view.getUint16(pos) : view.getUint32(pos);
+        pos += n;
+        return v;
+    };
+
+    const read = (): any => {
+        const t = bytes[pos++];
+        if (t === undefined) throw new Error('msgpack: unexpected end of data');
+        if (t < 0x80) return t;
+        if (t >= 0xe0) return t - 0x100;
+        if (t < 0x90) return items(t & 0x0f, true);
+        if (t < 0xa0) return items(t & 0x0f, false);
+        if (t < 0xc0) return str(t & 0x1f);
+        let v: any;
+        switch (t) {
+            case 0xc0: return null;
+            case 0xc2: return false;
+            case 0xc3: return true;
+            case 0xca: v = view.getFloat32(pos); pos += 4; return v;
+            case 0xcb: v = view.getFloat64(pos); pos += 8; return v;
+            case 0xcc: return u(1);
+            case 0xcd: return u(2);
+            case 0xce: return u(4);
+            case 0xcf: v = Number(view.getBigUint64(pos)); pos += 8; return v;
+            case 0xd0: v = view.getInt8(pos); pos += 1; return v;
+            case 0xd1: v = view.getInt16(pos); pos += 2; return v;
+            case 0xd2: v = view.getInt32(pos); pos += 4; return v;
+            case 0xd3: v = Number(view.getBigInt64(pos)); pos += 8; return v;
+            case 0xd9: return str(u(1));
+            case 0xda: return str(u(2));
+            case 0xdb: return str(u(4));
+            case 0xdc: return items(u(2), false);
+            case 0xdd: return items(u(4), false);
+            case 0xde: return items(u(2), true);
+            case 0xdf: return items(u(4), true);
+            default: throw new Error(`msgpack: unsupported type 0x${t.toString(16)}`);
+        }
+    };
+
+    return read();
+}
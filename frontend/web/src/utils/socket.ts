@@ -1,5 +1,15 @@
 // Lightweight WebSocket manager implementing on-demand connection with a short keepalive window,
-// heartbeat and simple reconnection/backoff. Frontend-only; backend unchanged.
+// heartbeat and simple reconnection/backoff. Messages travel as MessagePack when the backend accepts
+// the "nora.msgpack" subprotocol, and as JSON text otherwise.
+// Runs are jobs on the one connection: each carries an id, every reply echoes it, and
+// a job ends with {type: 'end', id}. Several can run at once and each can be cancelled.
+// A run is shared as "run-N": other tabs attach to it and get its backlog, then the live output.
+// Server messages are numbered ("seq"); after a drop the socket resumes its server session and
+// only the messages it missed are sent again, while its runs keep going.
+
+import {decode, encode} from './msgpack';
+
+const PROTOCOLS = ['nora.msgpack', 'nora.json'];
 
 type MessageHandler = (msg: any) => void;
 
@@ -15,6 +25,13 @@ class SocketManager {
     private readonly HEARTBEAT_MS = 30_000; // heartbeat interval
     private heartbeatTimer: number | null = null;
     private readonly CONNECT_TIMEOUT_MS = 10000; // how long connect() waits before timing out (ms)
+    private projectSubscriptions = new Set<string>(); // projects receiving "fs" change events
+    private runningJobs = new Set<string>(); // ids of runs the backend has not ended yet
+    private jobRuns = new Map<string, string>(); // job id -> shared run name, once started/attached
+    private replies = new Map<string, (msg: any) => void>(); // requests waiting for their answer
+    private sessionToken = ''; // server session to resume after a reconnect
+    private lastSeq = 0; // highest "seq" received in that session
+    private nextJobId = 1;
 
     // Connect (on-demand). App should call connect(wsUrl) before sending.
     connect(url: string, connectTimeoutMs = this.CONNECT_TIMEOUT_MS) {
@@ -43,7 +60,8 @@ class SocketManager {
                 }
 
                 try {
-                    this.ws = new WebSocket(wsEndpoint);
+                    this.ws = new WebSocket(wsEndpoint, PROTOCOLS);
+                    this.ws.binaryType = 'arraybuffer';
                 } catch (err) {
                     // failed to construct WebSocket (rare); schedule retry
                     scheduleRetry();
@@ -68,12 +86,49 @@ class SocketManager {
                     settled = true;
                     this.reconnectDelay = 1000; // reset backoff
                     this.startHeartbeat();
+                    // first thing on every socket, so a reconnect picks up where the last one stopped
+                    this.ws?.send(this.serialize({type: 'resume', session: this.sessionToken, seq: this.lastSeq}));
+                    // subscriptions live on the server connection, renew them after a reconnect
+                    this.projectSubscriptions.forEach(projectName =>
+                        this.ws?.send(this.serialize({type: 'subscribe', projectName})));
                     resolve();
                 };
 
                 this.ws.onmessage = (ev) => {
                     let data: any = ev.data;
-                    try { data = JSON.parse(ev.data); } catch (_) { /* keep raw */ }
+                    if (data instanceof ArrayBuffer) {
+                        try { data = decode(data); } catch (_) { return; }
+                    } else {
+                        try { data = JSON.parse(ev.data); } catch (_) { /* keep raw */ }
+                    }
+                    if (data && typeof data.seq === 'number') {
+                        // a replay can overlap what already arrived
+                        if (data.seq <= this.lastSeq) return;
+                        this.lastSeq = data.seq;
+                    }
+                    if (data && data.type === 'session') {
+                        this.sessionToken = data.session;
+                        if (!data.resumed) {
+                            // a new session: the runs of the old one are gone for this socket
+                            this.lastSeq = 0;
+                            this.runningJobs.clear();
+                            this.jobRuns.clear();
+                        }
+                        return;
+                    }
+                    if (data && typeof data.id === 'string') {
+                        if (data.type === 'end') {
+                            this.runningJobs.delete(data.id);
+                            this.jobRuns.delete(data.id);
+                        } else if (data.type === 'started' || data.type === 'attached') {
+                            this.jobRuns.set(data.id, data.run);
+                        }
+                        const reply = this.replies.get(data.id);
+                        if (reply) {
+                            this.replies.delete(data.id);
+                            reply(data);
+                        }
+                    }
                     this.subscribers.forEach(s => s(data));
                     this.touchIdleTimer();
                 };
@@ -81,6 +136,7 @@ class SocketManager {
                 this.ws.onclose = (ev) => {
                     if (timeoutId) { window.clearTimeout(timeoutId); timeoutId = null; }
                     this.stopHeartbeat();
+                    // running jobs are kept, the backend holds them for a resume
                     this.subscribers.forEach(s => s({__socket_closed: true, code: ev.code, reason: ev.reason}));
 
                     // if connection wasn't established yet, reject the connect promise
@@ -127,25 +183,120 @@ class SocketManager {
 
     send(obj: any) {
         if (!this.ws || this.ws.readyState !== WebSocket.OPEN) return Promise.reject(new Error('Socket not open'));
-        const payload = typeof obj === 'string' ? obj : JSON.stringify(obj);
-        this.ws.send(payload);
+        this.ws.send(this.serialize(obj));
         this.touchIdleTimer();
         return Promise.resolve();
     }
 
-    // High-level helper to request a run for a project/file
+    // the subprotocol is only known once the socket is open
+    private serialize(obj: any) {
+        if (typeof obj === 'string') return obj;
+        return this.ws?.protocol === 'nora.msgpack' ? encode(obj) : JSON.stringify(obj);
+    }
+
+    private newJobId() {
+        return `run-${Date.now().toString(36)}-${this.nextJobId++}`;
+    }
+
+    // High-level helper to request a run for a project/file, resolves with the job id
     async runFile(projectName: string, path: string) {
         if (!this.url) return Promise.reject(new Error('No ws url provided'));
         await this.connect(this.url);
-        const msg = {type: 'run_file', projectName, path, ts: Date.now()};
-        return this.send(msg);
+        const id = this.newJobId();
+        // added first, the "end" of a short run can arrive before send() resolves
+        this.runningJobs.add(id);
+        await this.send({type: 'run_file', id, projectName, path, ts: Date.now()}).catch(err => {
+            this.runningJobs.delete(id);
+            throw err;
+        });
+        return id;
     }
 
     async runAllFiles(projectName: string) {
         if (!this.url) return Promise.reject(new Error('No ws url provided'));
         await this.connect(this.url);
-        const msg = {type: 'run_all_files', projectName, ts: Date.now()};
-        return this.send(msg);
+        const id = this.newJobId();
+        // added first, the "end" of a short run can arrive before send() resolves
+        this.runningJobs.add(id);
+        await this.send({type: 'run_all_files', id, projectName, ts: Date.now()}).catch(err => {
+            this.runningJobs.delete(id);
+            throw err;
+        });
+        return id;
+    }
+
+    // Stops a run started by runFile/runAllFiles; its "end" message still arrives
+    cancel(id: string) {
+        if (!this.runningJobs.has(id)) return Promise.resolve();
+        return this.send({type: 'cancel', id});
+    }
+
+    runningJobIds() {
+        return [...this.runningJobs];
+    }
+
+    // Resolves with the first message that answers obj, by its id
+    private request(obj: any) {
+        const id = this.newJobId();
+        return new Promise<any>((resolve, reject) => {
+            this.replies.set(id, resolve);
+            this.send({...obj, id}).catch(err => {
+                this.replies.delete(id);
+                reject(err);
+            });
+        });
+    }
+
+    // Runs the backend knows about: [{run, label, running, viewers}]
+    async listRuns() {
+        if (!this.url) return Promise.reject(new Error('No ws url provided'));
+        await this.connect(this.url);
+        const reply = await this.request({type: 'runs'});
+        return Array.isArray(reply?.runs) ? reply.runs : [];
+    }
+
+    // Follows a run started elsewhere: its backlog first, then the live output, then its "end"
+    async attach(run: string) {
+        if (!this.url) return Promise.reject(new Error('No ws url provided'));
+        await this.connect(this.url);
+        const id = this.newJobId();
+        this.runningJobs.add(id);
+        await this.send({type: 'attach', id, run}).catch(err => {
+            this.runningJobs.delete(id);
+            throw err;
+        });
+        return id;
+    }
+
+    // Stops following without cancelling; a run nobody follows is cancelled by the backend
+    detach(id: string) {
+        if (!this.runningJobs.has(id)) return Promise.resolve();
+        return this.send({type: 'detach', id});
+    }
+
+    // Joins every run in progress this connection does not follow yet
+    async attachRunning() {
+        const runs = await this.listRuns();
+        const followed = new Set(this.jobRuns.values());
+        const ids = [];
+        for (const r of runs) {
+            if (r.running && !followed.has(r.run)) ids.push(await this.attach(r.run));
+        }
+        return ids;
+    }
+
+    // Ask the backend to push file-system changes of a project as {type: 'fs', events: [...]}
+    async subscribeProject(projectName: string) {
+        if (!this.url) return Promise.reject(new Error('No ws url provided'));
+        this.projectSubscriptions.add(projectName);
+        await this.connect(this.url);
+        return this.send({type: 'subscribe', projectName});
+    }
+
+    unsubscribeProject(projectName: string) {
+        if (!this.projectSubscriptions.delete(projectName)) return Promise.resolve();
+        if (!this.ws || this.ws.readyState !== WebSocket.OPEN) return Promise.resolve();
+        return this.send({type: 'unsubscribe', projectName});
     }
 
     subscribe(handler: MessageHandler) {
@@ -156,14 +307,18 @@ class SocketManager {
     // touch idle timer: schedule a close in IDLE_CLOSE_MS after last activity
     private touchIdleTimer() {
         if (this.idleTimer) window.clearTimeout(this.idleTimer);
-        this.idleTimer = window.setTimeout(() => this.close(), this.IDLE_CLOSE_MS);
+        this.idleTimer = window.setTimeout(() => {
+            // a project subscription or a running job keeps the socket open even without traffic
+            if (this.projectSubscriptions.size > 0 || this.runningJobs.size > 0) this.touchIdleTimer();
+            else this.close();
+        }, this.IDLE_CLOSE_MS);
     }
 
     private startHeartbeat() {
         this.stopHeartbeat();
         this.heartbeatTimer = window.setInterval(() => {
             if (this.ws && this.ws.readyState === WebSocket.OPEN) {
-                try { this.ws.send(JSON.stringify({type: 'ping', ts: Date.now()})); }
+                try { this.ws.send(this.serialize({type: 'ping', ts: Date.now()})); }
                 catch (_) { /* ignore */ }
             }
         }, this.HEARTBEAT_MS);
@@ -183,6 +338,12 @@ class SocketManager {
         }
         // clear desired url (so reconnect won't auto happen)
         this.url = null;
+        this.projectSubscriptions.clear();
+        this.runningJobs.clear();
+        this.jobRuns.clear();
+        // closing on purpose gives the session up
+        this.sessionToken = '';
+        this.lastSeq = 0;
     }
 }
 
@@ -0,0 +1,34 @@
+// Smallest single range edit turning one text into another, for patch saves through /files/update.
+// Offsets are UTF-8 byte offsets into the base text, which is how the backend addresses the file.
+
+export interface TextEdit {
+    start: number;
+    end: number;
+    text: string;
+}
+
+const encoder = new TextEncoder();
+const byteLength = (s: string) => encoder.encode(s).length;
+
+const isHighSurrogate = (code: number) => code >= 0xd800 && code <= 0xdbff;
+const isLowSurrogate = (code: number) => code >= 0xdc00 && code <= 0xdfff;
+
+export function diffEdit(base: string, next: string): TextEdit | null {
+    if (base === next) return null;
+
+    const max = Math.min(base.length, next.length);
+    let prefix = 0;
+    while (prefix < max && base.charCodeAt(prefix) === next.charCodeAt(prefix)) prefix++;
+
+    let suffix = 0;
+    while (suffix < max - prefix &&
+        base.charCodeAt(base.length - 1 - suffix) === next.charCodeAt(next.length - 1 - suffix)) suffix++;
+
+    // never cut a surrogate pair in half, the byte offsets would land inside a character
+    if (prefix > 0 && isHighSurrogate(base.charCodeAt(prefix - 1))) prefix--;
+    if (suffix > 0 && isLowSurrogate(base.charCodeAt(base.length - suffix))) suffix--;
+
+    const start = byteLength(base.slice(0, prefix));
+    const end = start + byteLength(base.slice(prefix, base.length - suffix));
+    return {start, end, text: next.slice(prefix, next.length - suffix)};
+}
@@ -2,10 +2,12 @@
 #include <pthread.h>
 #include <signal.h>
 #include <errno.h>
+#include <stdlib.h>
 
 #include "args.h"
 #include "backend/backend.h"
 #include "frontend/frontend.h"
+#include "backend/fs/fs.h"
 #include "webDriver/src/utils/utils.h"
 #include "shared/shared.h"
 
@@ -45,6 +47,22 @@ int main(int argc, char *argv[]) {
     int sport = args.sport_arg;
     int auto_run = args.open_arg;
 
+    char root[4096];
+    if (args.root_given) {
+        snprintf(root, sizeof(root), "%s", args.root_arg);
+    } else {
+        char *home = getenv("HOME");
+        if (!home) {
+            ERROR(1, "HOME environment variable not set, use --root");
+            return 1;
+        }
+        snprintf(root, sizeof(root), "%s/Documents/Nora", home);
+    }
+
+    if (fs_init(root) != 0) {
+        ERROR(1, "Failed to open workspace %s", root);
+        return 1;
+    }
 
     pthread_t frontend_tid;
     pthread_t backend_tid;
@@ -54,7 +72,11 @@ int main(int argc, char *argv[]) {
             .web_port = fport,
             .server_host = bhost,
             .server_port = bport,
-            .ws_port = sport
+            .ws_port = sport,
+            .workspace_root = (char *) fs_root(),
+            .durable = args.durable_arg,
+            .writeback_ms = args.writeback_arg,
+            .stall_ms = args.stall_arg
     };
 
     frontend_args_t frontend_args = {
@@ -82,6 +104,7 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    fs_free();
     cmdline_parser_free(&args);
     return 0;
 }
\ No newline at end of file
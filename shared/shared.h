@@ -7,6 +7,10 @@ typedef struct {
     int server_port;
     char *server_host;
     int ws_port;
+    char *workspace_root;
+    int durable;
+    int writeback_ms;
+    int stall_ms;
 } threads_args_t;
 
 typedef struct {
@@ -0,0 +1,269 @@
+/*
+ Packs the built Web UI into a C source file so the frontend can serve it
+ from memory.
+
+ usage: pack <dist dir> > packed_fs.c
+
+ For every file the packer also picks up "<file>.gz" and "<file>.br" when
+ they exist (the makefile precompresses them) and keeps them only if they
+ are smaller than the original. The ETag is a hash of the original content,
+ so it only changes when the file does.
+ */
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char *path; // relative to dist, starts with '/'
+    unsigned char *data;
+    size_t size;
+    unsigned char *gzip;
+    size_t gzip_size;
+    unsigned char *br;
+    size_t br_size;
+} asset_t;
+
+static asset_t *assets = NULL;
+static size_t assets_count = 0;
+static size_t assets_capacity = 0;
+
+static const char *mime_types[][2] = {
+    {"html", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"mjs", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"wasm", "application/wasm"},
+    {"txt", "text/plain; charset=utf-8"},
+    {NULL, NULL}
+};
+
+static const char *guess_mime(const char *path) {
+    const char *dot = strrchr(path, '.');
+    if (dot) {
+        for (int i = 0; mime_types[i][0] != NULL; i++) {
+            if (strcmp(dot + 1, mime_types[i][0]) == 0) {
+                return mime_types[i][1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+static int ends_with(const char *s, const char *suffix) {
+    size_t ls = strlen(s), lx = strlen(suffix);
+    return ls >= lx && strcmp(s + ls - lx, suffix) == 0;
+}
+
+static unsigned char *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long fsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    unsigned char *data = malloc(fsize > 0 ? (size_t) fsize : 1);
+    if (data) {
+        *size = fread(data, 1, fsize, f);
+    }
+    fclose(f);
+    return data;
+}
+
+static uint64_t fnv1a(const unsigned char *data, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Vite writes content-hashed bundles to assets/, named like "index-Bx3f9a1c.js"
+static int is_immutable(const char *path) {
+    if (strncmp(path, "/assets/", 8) != 0) {
+        return 0;
+    }
+    const char *dash = strrchr(path, '-');
+    const char *dot = strrchr(path, '.');
+    return dash && dot && dash < dot && dot - dash > 6;
+}
+
+static void add_variant(const char *full_path, const char *suffix, const asset_t *a,
+                        unsigned char **data, size_t *size) {
+    char variant_path[4096 + 8];
+    snprintf(variant_path, sizeof(variant_path), "%s%s", full_path, suffix);
+
+    size_t vsize = 0;
+    unsigned char *vdata = read_file(variant_path, &vsize);
+    if (vdata && vsize < a->size) {
+        *data = vdata;
+        *size = vsize;
+    } else {
+        free(vdata);
+    }
+}
+
+static int walk(const char *root, const char *rel) {
+    char dir_path[4096];
+    snprintf(dir_path, sizeof(dir_path), "%s%s", root, rel);
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        fprintf(stderr, "pack: cannot open %s\n", dir_path);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        char rel_path[4096];
+        snprintf(rel_path, sizeof(rel_path), "%s/%s", rel, entry->d_name);
+        char full_path[4096];
+        snprintf(full_path, sizeof(full_path), "%s%s", root, rel_path);
+
+        struct stat st;
+        if (stat(full_path, &st) != 0) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (walk(root, rel_path) != 0) {
+                closedir(dir);
+                return -1;
+            }
+            continue;
+        }
+
+        // variants are attached to their original; backend.txt is generated at runtime
+        if (ends_with(entry->d_name, ".gz") || ends_with(entry->d_name, ".br") ||
+            strcmp(rel_path, "/backend.txt") == 0) {
+            continue;
+        }
+
+        if (assets_count == assets_capacity) {
+            assets_capacity = assets_capacity ? assets_capacity * 2 : 64;
+            asset_t *tmp = realloc(assets, assets_capacity * sizeof(asset_t));
+            if (!tmp) {
+                closedir(dir);
+                return -1;
+            }
+            assets = tmp;
+        }
+
+        asset_t *a = &assets[assets_count];
+        memset(a, 0, sizeof(*a));
+        a->path = strdup(rel_path);
+        a->data = read_file(full_path, &a->size);
+        if (!a->path || !a->data) {
+            fprintf(stderr, "pack: cannot read %s\n", full_path);
+            closedir(dir);
+            return -1;
+        }
+
+        add_variant(full_path, ".gz", a, &a->gzip, &a->gzip_size);
+        add_variant(full_path, ".br", a, &a->br, &a->br_size);
+        assets_count++;
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+static int compare_assets(const void *a, const void *b) {
+    return strcmp(((const asset_t *) a)->path, ((const asset_t *) b)->path);
+}
+
+static void print_bytes(const char *name, size_t index, const unsigned char *data, size_t size) {
+    printf("static const unsigned char %s_%zu[] = {", name, index);
+    for (size_t i = 0; i < size; i++) {
+        printf("%s%u,", i % 24 == 0 ? "\n" : "", data[i]);
+    }
+    printf("0};\n");
+}
+
+// File names can hold anything but '/' and NUL, so they are escaped for the C string literal
+static void print_string(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char) *s;
+        if (ch == '"' || ch == '\\' || ch == '?') {
+            printf("\\%c", ch); // '?' so no trigraph can form
+        } else if (ch < 0x20 || ch >= 0x7f) {
+            printf("\\%03o", ch); // octal stops after three digits, unlike \x
+        } else {
+            putchar(ch);
+        }
+    }
+    putchar('"');
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <dist dir>\n", argv[0]);
+        return 1;
+    }
+
+    if (walk(argv[1], "") != 0) {
+        return 1;
+    }
+
+    qsort(assets, assets_count, sizeof(asset_t), compare_assets);
+
+    printf("// Generated by tools/pack.c, do not edit.\n");
+    printf("#include \"../frontend/packed.h\"\n\n");
+
+    for (size_t i = 0; i < assets_count; i++) {
+        print_bytes("data", i, assets[i].data, assets[i].size);
+        if (assets[i].gzip) {
+            print_bytes("gzip", i, assets[i].gzip, assets[i].gzip_size);
+        }
+        if (assets[i].br) {
+            print_bytes("br", i, assets[i].br, assets[i].br_size);
+        }
+    }
+
+    printf("\nconst packed_file_t packed_files[] = {\n");
+    for (size_t i = 0; i < assets_count; i++) {
+        const asset_t *a = &assets[i];
+        printf("    {");
+        print_string(a->path);
+        printf(", \"%s\", \"%016llx\", %d, data_%zu, %zu, ",
+               guess_mime(a->path), (unsigned long long) fnv1a(a->data, a->size),
+               is_immutable(a->path), i, a->size);
+        if (a->gzip) {
+            printf("gzip_%zu, %zu, ", i, a->gzip_size);
+        } else {
+            printf("NULL, 0, ");
+        }
+        if (a->br) {
+            printf("br_%zu, %zu},\n", i, a->br_size);
+        } else {
+            printf("NULL, 0},\n");
+        }
+    }
+    printf("    {NULL, NULL, NULL, 0, NULL, 0, NULL, 0, NULL, 0}\n};\n\n");
+    printf("const size_t packed_files_count = %zu;\n", assets_count);
+
+    return 0;
+}